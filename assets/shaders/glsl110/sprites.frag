@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2021 Marty Mills <daggerbot@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#version 110
+
+/*
+ * Feature flags defined by gl_shaders.c for each program variant:
+ *   TEXTURE_RGB:     Multiply the color by the texture's color channels.
+ *   TEXTURE_ALPHA:   Multiply the alpha by the texture's alpha channel.
+ *   TEXTURE_INDEXED: Take the texel from the 256-entry palette instead, at
+ *                    the index in the texture's alpha channel.
+ *   TEXTURE_ARRAY:   The texture is an array. Its layers are stacked
+ *                    vertically in texture coordinates, so the integer part
+ *                    of y is the layer.
+ *   OPAQUE:          Never discard, and write full alpha. Discarding would
+ *                    keep the GPU from depth testing before shading.
+ */
+
+#ifdef TEXTURE_ARRAY
+#extension GL_EXT_texture_array : require
+uniform sampler2DArray uni_Texture;
+#else
+uniform sampler2D uni_Texture;
+#endif
+#ifdef TEXTURE_INDEXED
+uniform sampler2D uni_Palette;
+#endif
+
+varying vec2 var_TextureCoord;
+varying vec4 var_Color;
+
+#if defined(TEXTURE_RGB) || defined(TEXTURE_ALPHA)
+vec4 fetch_texel(vec2 coord)
+{
+#ifdef TEXTURE_ARRAY
+    float layer = floor(coord.y);
+    return texture2DArray(uni_Texture, vec3(coord.x, coord.y - layer, layer));
+#else
+    return texture2D(uni_Texture, coord);
+#endif
+}
+#endif
+
+void main()
+{
+#if defined(TEXTURE_INDEXED)
+    float index = fetch_texel(var_TextureCoord).a;
+    vec4 texel = texture2D(uni_Palette, vec2((index * 255.0 + 0.5) / 256.0, 0.5));
+#elif defined(TEXTURE_RGB) || defined(TEXTURE_ALPHA)
+    vec4 texel = fetch_texel(var_TextureCoord);
+#endif
+
+    gl_FragColor = var_Color;
+#ifdef TEXTURE_RGB
+    gl_FragColor.rgb *= texel.rgb;
+#endif
+#ifdef TEXTURE_ALPHA
+    gl_FragColor.a *= texel.a;
+#endif
+
+#ifdef OPAQUE
+    gl_FragColor.a = 1.0;
+#else
+    if (gl_FragColor.a <= 0.0) {
+        discard;
+    }
+#endif
+}
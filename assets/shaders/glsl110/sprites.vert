@@ -18,6 +18,7 @@
 
 uniform mat4 uni_Transform;
 uniform vec2 uni_TextureSize;
+uniform float uni_Depth; /* In normalized device coordinates, for the depth-tested passes */
 
 attribute vec2 attr_Position;
 attribute vec2 attr_TextureCoord;
@@ -29,6 +30,11 @@ varying vec4 var_Color;
 void main()
 {
     gl_Position = uni_Transform * vec4(attr_Position, 0.0, 1.0);
+    gl_Position.z = uni_Depth * gl_Position.w;
+#if defined(TEXTURE_RGB) || defined(TEXTURE_ALPHA)
     var_TextureCoord = attr_TextureCoord / uni_TextureSize;
+#else
+    var_TextureCoord = vec2(0.0);
+#endif
     var_Color = attr_Color;
 }
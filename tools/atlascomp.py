@@ -14,7 +14,9 @@
 # this program. If not, see <https://www.gnu.org/licenses/>.
 
 # atlascomp.py
-#   Compiles multiple images into one.
+#   Compiles multiple images into one. Indexed atlases store an 8-bit palette
+#   index per pixel, which the runtime looks up in a palette texture.
+#   Compressed atlases store S3TC (DXT1 or DXT5) blocks of 4x4 pixels.
 
 import os.path
 import sys
@@ -34,8 +36,16 @@ ROW_ALIGNMENT = 4
 MODE_NUMS = { # (format, bytes_per_pel)
     "RGB": (3, 3),
     "RGBA": (4, 4),
+    "L": (0x1906, 1), # Palette indices, uploaded as PIXEL_FORMAT_ALPHA_8
 }
 
+COMPRESSION_NUMS = { # (format, bytes_per_block)
+    "dxt1": (0x83F1, 8),
+    "dxt5": (0x83F3, 16),
+}
+
+MAX_PALETTE_SIZE = 256
+
 #
 # Keeps an image and caches a hash code of it so we can more quickly determine
 # that two images are not identical. Only accurate as long as the underlying
@@ -284,15 +294,180 @@ class AtlasCompiler:
 
         return atlas
 
+#
+# Replaces each pixel of an image with an index into a palette of its distinct
+# RGBA colors, in order of first appearance.
+# Returns (indices, palette), where indices is an "L" image.
+#
+def index_colors(image):
+    rgba = image.convert("RGBA")
+    indices = PIL.Image.new("L", image.size)
+    palette = []
+    color_indices = {}
+
+    for y in range(image.height):
+        for x in range(image.width):
+            color = rgba.getpixel((x, y))
+            index = color_indices.get(color)
+            if index is None:
+                if len(palette) == MAX_PALETTE_SIZE:
+                    raise Exception("Too many colors for an indexed atlas (max %d)" % MAX_PALETTE_SIZE)
+                index = len(palette)
+                palette.append(color)
+                color_indices[color] = index
+            indices.putpixel((x, y), index)
+
+    return indices, palette
+
+#
+# Image which has been compressed into S3TC blocks.
+#
+class CompressedImage:
+    def __init__(self, size, compression, blocks):
+        self.size = size
+        self.compression = compression
+        self.blocks = blocks
+
+def pack_565(color):
+    r, g, b = color[:3]
+    return ((r * 31 + 127) // 255) << 11 | ((g * 63 + 127) // 255) << 5 | (b * 31 + 127) // 255
+
+def unpack_565(c):
+    r, g, b = c >> 11 & 31, c >> 5 & 63, c & 31
+    return (r << 3 | r >> 2, g << 2 | g >> 4, b << 3 | b >> 2)
+
+def nearest_index(value, palette):
+    best = 0
+    best_error = None
+    for i in range(len(palette)):
+        if isinstance(value, tuple):
+            error = sum((a - b) ** 2 for a, b in zip(value, palette[i]))
+        else:
+            error = (value - palette[i]) ** 2
+        if best_error is None or error < best_error:
+            best, best_error = i, error
+    return best
+
+#
+# Picks the endpoints of a block's colors as the corners of their bounding
+# box, inset slightly since the extremes are rarely worth representing
+# exactly, and on the diagonal which the colors actually vary along.
+#
+def fit_color_endpoints(colors):
+    lo = [min(c[i] for c in colors) for i in range(3)]
+    hi = [max(c[i] for c in colors) for i in range(3)]
+    for i in range(3):
+        inset = (hi[i] - lo[i]) // 16
+        lo[i] += inset
+        hi[i] -= inset
+
+    # Flip the green and blue ranges if they vary against red (or green)
+    center = [(lo[i] + hi[i]) / 2 for i in range(3)]
+    axis = 0 if hi[0] - lo[0] >= hi[1] - lo[1] else 1
+    for i in range(axis + 1, 3):
+        covariance = sum((c[axis] - center[axis]) * (c[i] - center[i]) for c in colors)
+        if covariance < 0:
+            lo[i], hi[i] = hi[i], lo[i]
+
+    return tuple(hi), tuple(lo)
+
+#
+# Encodes the color part of a block. In DXT1, blocks with transparent pixels
+# use the 3-color mode, where index 3 is transparent black.
+#
+def encode_color_block(pixels, allow_transparency):
+    transparent = allow_transparency and any(p[3] < 128 for p in pixels)
+    opaque = [p for p in pixels if not transparent or p[3] >= 128]
+    if not opaque:
+        return u16le(0) + u16le(0) + u32le(0xFFFFFFFF)
+
+    c0, c1 = (pack_565(c) for c in fit_color_endpoints(opaque))
+    if transparent:
+        # The 3-color mode is selected by c0 <= c1
+        if c0 > c1:
+            c0, c1 = c1, c0
+        e0, e1 = unpack_565(c0), unpack_565(c1)
+        palette = [e0, e1, tuple((a + b) // 2 for a, b in zip(e0, e1))]
+    else:
+        if c0 < c1:
+            c0, c1 = c1, c0
+        elif c0 == c1:
+            return u16le(c0) + u16le(c1) + u32le(0)
+        e0, e1 = unpack_565(c0), unpack_565(c1)
+        palette = [e0, e1,
+                   tuple((2 * a + b + 1) // 3 for a, b in zip(e0, e1)),
+                   tuple((a + 2 * b + 1) // 3 for a, b in zip(e0, e1))]
+
+    indices = 0
+    for i in range(16):
+        if transparent and pixels[i][3] < 128:
+            index = 3
+        else:
+            index = nearest_index(tuple(pixels[i][:3]), palette)
+        indices |= index << (2 * i)
+    return u16le(c0) + u16le(c1) + u32le(indices)
+
+#
+# Encodes the alpha part of a DXT5 block, using the 8-value mode between the
+# lowest and highest alpha.
+#
+def encode_alpha_block(pixels):
+    a0 = max(p[3] for p in pixels)
+    a1 = min(p[3] for p in pixels)
+    if a0 == a1:
+        return bytearray([a0, a1, 0, 0, 0, 0, 0, 0])
+
+    palette = [a0, a1] + [((7 - i) * a0 + i * a1 + 3) // 7 for i in range(1, 7)]
+    indices = 0
+    for i in range(16):
+        indices |= nearest_index(pixels[i][3], palette) << (3 * i)
+    return bytearray([a0, a1]) + indices.to_bytes(6, "little")
+
+#
+# Compresses an image into rows of blocks. The image's size must be a multiple
+# of 4 in both dimensions.
+#
+def compress_image(image, compression):
+    rgba = image.convert("RGBA")
+    width, height = image.size
+    assert width % 4 == 0 and height % 4 == 0
+    blocks = bytearray()
+
+    for by in range(0, height, 4):
+        for bx in range(0, width, 4):
+            pixels = [rgba.getpixel((bx + i % 4, by + i // 4)) for i in range(16)]
+            if compression == "dxt5":
+                blocks += encode_alpha_block(pixels)
+                blocks += encode_color_block(pixels, False)
+            else:
+                blocks += encode_color_block(pixels, True)
+
+    return CompressedImage(image.size, compression, blocks)
+
 #
 # Compiles an image atlas.
-# Returns (image, subimages).
+# Returns (image, subimages, palette). palette is a list of RGBA tuples if
+# indexed is set, and image holds indices into it. Otherwise it's None.
+# If compression is "dxt1" or "dxt5", image is a CompressedImage, padded to
+# whole blocks.
 #
-def compile(sources, *, uniform=False):
+def compile(sources, *, uniform=False, indexed=False, compression=None):
+    assert compression is None or compression in COMPRESSION_NUMS
+    if indexed and compression:
+        raise Exception("Indexed atlases can't be compressed")
+
     compiler = AtlasCompiler(sources, uniform=uniform)
     compiler.generate_geometry()
     image = compiler.generate_atlas()
-    return image, compiler.subimages
+    palette = None
+    if indexed:
+        image, palette = index_colors(image)
+    elif compression:
+        width, height = image.size
+        padded = PIL.Image.new(image.mode, ((width + 3) // 4 * 4, (height + 3) // 4 * 4))
+        padded.paste(image, (0, 0))
+        image = compress_image(padded, compression)
+    return image, compiler.subimages, palette
 
 #
 # Writes an image atlas to a file.
@@ -300,9 +475,9 @@ def compile(sources, *, uniform=False):
 def serialize(fp, data, *, uniform=False):
     if isinstance(fp, str):
         with open(fp, "wb") as _fp:
-            return serialize(fp, data)
+            return serialize(_fp, data, uniform=uniform)
 
-    image, subimages = data
+    image, subimages, palette = data
     width, height = image.size
     tile_width = subimages[0].original_width
     tile_height = subimages[0].original_height
@@ -310,8 +485,10 @@ def serialize(fp, data, *, uniform=False):
     # Write atlas header
     fp.write(u16le(width))
     fp.write(u16le(height))
-    fp.write(u16le(MODE_NUMS[image.mode][0]))
-    bpp = MODE_NUMS[image.mode][1]
+    if isinstance(image, CompressedImage):
+        fp.write(u16le(COMPRESSION_NUMS[image.compression][0]))
+    else:
+        fp.write(u16le(MODE_NUMS[image.mode][0]))
 
     if uniform:
         fp.write(u16le(tile_width))
@@ -320,13 +497,25 @@ def serialize(fp, data, *, uniform=False):
     fp.write(u16le(len(subimages)))
 
     # Write image data
-    padding = bytearray([0] * ((ROW_ALIGNMENT - width * bpp % ROW_ALIGNMENT) % ROW_ALIGNMENT))
-    fp.write(u32le(height * (width * bpp + len(padding))))
-
-    for y in range(height):
-        for x in range(width):
-            fp.write(bytearray(image.getpixel((x, y))))
-        fp.write(padding)
+    if isinstance(image, CompressedImage):
+        fp.write(u32le(len(image.blocks)))
+        fp.write(image.blocks)
+    else:
+        bpp = MODE_NUMS[image.mode][1]
+        padding = bytearray([0] * ((ROW_ALIGNMENT - width * bpp % ROW_ALIGNMENT) % ROW_ALIGNMENT))
+        fp.write(u32le(height * (width * bpp + len(padding))))
+
+        for y in range(height):
+            for x in range(width):
+                pixel = image.getpixel((x, y))
+                fp.write(bytearray(pixel if isinstance(pixel, tuple) else (pixel,)))
+            fp.write(padding)
+
+    # Write palette, for indexed atlases
+    if palette is not None:
+        fp.write(u16le(len(palette)))
+        for color in palette:
+            fp.write(bytearray(color))
 
     # Write tile data
     for subimage in subimages:
@@ -0,0 +1,99 @@
+#!/usr/bin/python3
+# Copyright (c) 2021 Marty Mills <daggerbot@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify it
+# under the terms of the GNU General Public License version 3 as published by
+# the Free Software Foundation.
+#
+# This program is distributed in the hope that it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+# FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+# more details.
+#
+# You should have received a copy of the GNU General Public License along with
+# this program. If not, see <https://www.gnu.org/licenses/>.
+
+# imgdiff.py
+#   Compares a rendered image against a golden image, such as a frame captured
+#   with `vogroth -headless -capture FILE`.
+#
+# Usage:
+#   imgdiff.py [OPTIONS] ACTUAL EXPECTED
+#
+# Options:
+#   -t TOLERANCE  Maximum difference allowed per color channel (default 0).
+#   -n COUNT      Number of pixels allowed to exceed the tolerance (default 0).
+#   -o DIFFFILE   Write an image highlighting the differing pixels.
+#
+# Exits with status 1 if the images differ, or 2 if they can't be compared.
+
+import getopt
+import sys
+
+import PIL.Image
+
+#
+# Entry point
+#
+if __name__ == "__main__":
+    #
+    # Parse command line options
+    #
+
+    tolerance = 0
+    max_bad_pixels = 0
+    diff_path = None
+    opts, args = getopt.getopt(sys.argv[1:], "n:o:t:")
+
+    for opt, param in opts:
+        if opt == "-n":
+            max_bad_pixels = int(param)
+            assert max_bad_pixels >= 0
+        elif opt == "-o":
+            assert diff_path is None
+            diff_path = param
+        elif opt == "-t":
+            tolerance = int(param)
+            assert tolerance >= 0
+
+    assert len(args) == 2
+    actual_path = args[0]
+    expected_path = args[1]
+
+    #
+    # Compare images
+    #
+
+    # Alpha isn't compared, since the renderer doesn't define it for the frame.
+    actual = PIL.Image.open(actual_path).convert("RGB")
+    expected = PIL.Image.open(expected_path).convert("RGB")
+
+    if actual.size != expected.size:
+        print("{}: size is {}x{}, expected {}x{}".format(actual_path, *actual.size, *expected.size))
+        sys.exit(2)
+
+    width, height = actual.size
+    diff = PIL.Image.new("RGB", actual.size) if diff_path else None
+    bad_pixels = 0
+    max_error = 0
+
+    for i, (a, e) in enumerate(zip(actual.getdata(), expected.getdata())):
+        error = max(abs(a[0] - e[0]), abs(a[1] - e[1]), abs(a[2] - e[2]))
+        max_error = max(max_error, error)
+        if error > tolerance:
+            bad_pixels += 1
+            if diff:
+                diff.putpixel((i % width, i // width), (255, 0, 255))
+        elif diff:
+            diff.putpixel((i % width, i // width), tuple(c // 4 for c in e))
+
+    if diff:
+        diff.save(diff_path)
+
+    #
+    # Report result
+    #
+
+    print("{}: {} of {} pixels differ by more than {} (max difference {})".format(
+        actual_path, bad_pixels, width * height, tolerance, max_error))
+    sys.exit(1 if bad_pixels > max_bad_pixels else 0)
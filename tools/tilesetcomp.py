@@ -20,7 +20,9 @@
 #   tilesetcomp.py [OPTIONS] INFILE OUTFILE
 #
 # Options:
+#   -c FORMAT   Compress the tiles with FORMAT (dxt1 or dxt5).
 #   -d DEPFILE  Generate a depfile for make/ninja.
+#   -i          Store palette indices instead of colors (at most 256 colors).
 #   -R DIR      Generate dependencies relative to DIR.
 
 import getopt
@@ -46,12 +48,19 @@ if __name__ == "__main__":
 
     dep_path = None
     dep_base = None
-    opts, args = getopt.getopt(sys.argv[1:], "d:R:")
+    indexed = False
+    compression = None
+    opts, args = getopt.getopt(sys.argv[1:], "c:d:iR:")
 
     for opt, param in opts:
-        if opt == "-d":
+        if opt == "-c":
+            assert param in atlascomp.COMPRESSION_NUMS
+            compression = param
+        elif opt == "-d":
             assert dep_path is None
             dep_path = param
+        elif opt == "-i":
+            indexed = True
         elif opt == "-R":
             assert dep_base is None
             dep_base = param
@@ -114,7 +123,7 @@ if __name__ == "__main__":
     # Compile atlas image
     #
 
-    data = atlascomp.compile(images, uniform=True)
+    data = atlascomp.compile(images, uniform=True, indexed=indexed, compression=compression)
 
     #
     # Write output file
@@ -21,9 +21,11 @@
 
 #include "assets.h"
 #include "debug.h"
+#include "memory.h"
 #include "system.h"
 
 static struct zip *zip = NULL;
+static char *dir = NULL;
 
 void assets_init(const char *path)
 {
@@ -31,7 +33,7 @@ void assets_init(const char *path)
     struct zip_error zerr = {0};
     struct zip_source *source;
 
-    if (zip) {
+    if (zip || dir) {
         return;
     }
     if (!path) {
@@ -39,6 +41,11 @@ void assets_init(const char *path)
     }
     LOG_DEBUG("Loading assets from: %s", path);
 
+    if (system_is_dir(path)) {
+        dir = str_clone(path);
+        return;
+    }
+
     fp = system_fopen(path, "rb");
     if (!fp) {
         FATAL("%s: %s", path, strerror(errno));
@@ -64,9 +71,24 @@ void assets_fini(void)
         }
         zip = NULL;
     }
+    dir = mem_free(dir);
 }
 
 struct rw *assets_open(const char *name, char **out_err)
 {
+    char *path;
+    struct rw *rw;
+
+    if (dir) {
+        path = str_printf("%s/%s", dir, name);
+        rw = rw_fopen(path, "rb", out_err);
+        mem_free(path);
+        return rw;
+    }
     return rw_zip_fopen(zip, name, out_err);
 }
+
+const char *assets_get_dir(void)
+{
+    return dir;
+}
@@ -19,8 +19,14 @@
 
 #include "rw.h"
 
-void assets_init(const char *path); /* path can be null to use default */
+/*
+ * path can be null to use default. If path is a directory, assets are loaded
+ * from loose files inside it instead of from a package.
+ */
+void assets_init(const char *path);
 void assets_fini(void);
 struct rw *assets_open(const char *name, char **out_err);
+/* Returns the loose assets directory, or null if assets come from a package. */
+const char *assets_get_dir(void);
 
 #endif /* INCLUDED_ASSETS_H */
@@ -0,0 +1,402 @@
+/*
+ * Copyright (c) 2021 Marty Mills <daggerbot@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "atlas.h"
+#include "debug.h"
+#include "math.h"
+#include "memory.h"
+#include "texture.h"
+
+/* Empty pixels between images, so that sampling at their edges can't pick up a neighbor */
+#define PADDING 1
+
+/* Segment of the skyline: the lowest free row above the columns [x, x + width) */
+struct skyline_node {
+    int x, y, width;
+};
+
+struct atlas_page {
+    struct texture *texture;
+    struct pixbuf pixels; /* Copy of the texture, for compacting */
+    struct skyline_node *nodes;
+    int num_nodes;
+    int num_images;
+};
+
+struct atlas_image {
+    int page; /* -1 if the id is free */
+    struct rect2i rect;
+};
+
+struct atlas {
+    struct vec2i page_size;
+    enum pixel_format format;
+    struct atlas_page *pages;
+    int num_pages;
+    struct atlas_image *images;
+    int num_images;
+    int64_t used_area;
+};
+
+/******************************************************************************/
+
+static void reset_skyline(struct atlas_page *page, struct vec2i page_size)
+{
+    page->nodes[0] = (struct skyline_node) {0, 0, page_size.x};
+    page->num_nodes = 1;
+}
+
+/*
+ * Gets the y at which a box of the given width would rest if placed at node
+ * index, or -1 if it would stick out of the page.
+ */
+static int get_skyline_fit(const struct atlas_page *page, struct vec2i page_size, int index, struct vec2i size)
+{
+    int x = page->nodes[index].x;
+    int width_left = size.x;
+    int y = 0;
+
+    if (x + size.x > page_size.x) {
+        return -1;
+    }
+    while (width_left > 0) {
+        DASSERT(index < page->num_nodes);
+        y = max_int(y, page->nodes[index].y);
+        if (y + size.y > page_size.y) {
+            return -1;
+        }
+        width_left -= page->nodes[index].width;
+        ++index;
+    }
+    return y;
+}
+
+/*
+ * Finds the lowest place for a box, preferring the narrowest segment on ties
+ * so that wide gaps are kept for wide images, and raises the skyline over it.
+ * Returns false if there's no room.
+ */
+static bool place_on_skyline(struct atlas_page *page, struct vec2i page_size, struct vec2i size,
+                             struct vec2i *out_pos)
+{
+    struct skyline_node node;
+    int best_index = -1, best_top = INT_MAX, best_width = INT_MAX;
+    int i, y, shrink;
+
+    for (i = 0; i < page->num_nodes; ++i) {
+        y = get_skyline_fit(page, page_size, i, size);
+        if (y >= 0 && (y + size.y < best_top || (y + size.y == best_top && page->nodes[i].width < best_width))) {
+            best_index = i;
+            best_top = y + size.y;
+            best_width = page->nodes[i].width;
+        }
+    }
+    if (best_index < 0) {
+        return false;
+    }
+
+    /* The nodes covered by the box are replaced by one at its top */
+    node = (struct skyline_node) {page->nodes[best_index].x, best_top, size.x};
+    *out_pos = (struct vec2i) {node.x, best_top - size.y};
+    memmove(&page->nodes[best_index + 1], &page->nodes[best_index],
+            (size_t)(page->num_nodes - best_index) * sizeof(*page->nodes));
+    page->nodes[best_index] = node;
+    ++page->num_nodes;
+
+    for (i = best_index + 1; i < page->num_nodes; ++i) {
+        shrink = node.x + node.width - page->nodes[i].x;
+        if (shrink <= 0) {
+            break;
+        }
+        if (shrink < page->nodes[i].width) {
+            page->nodes[i].x += shrink;
+            page->nodes[i].width -= shrink;
+            break;
+        }
+        memmove(&page->nodes[i], &page->nodes[i + 1], (size_t)(page->num_nodes - i - 1) * sizeof(*page->nodes));
+        --page->num_nodes;
+        --i;
+    }
+
+    /* Merge neighbors at the same height */
+    for (i = 0; i + 1 < page->num_nodes; ++i) {
+        if (page->nodes[i].y == page->nodes[i + 1].y) {
+            page->nodes[i].width += page->nodes[i + 1].width;
+            memmove(&page->nodes[i + 1], &page->nodes[i + 2],
+                    (size_t)(page->num_nodes - i - 2) * sizeof(*page->nodes));
+            --page->num_nodes;
+            --i;
+        }
+    }
+    return true;
+}
+
+/******************************************************************************/
+
+static void init_page(struct atlas *atlas, struct atlas_page *page)
+{
+    *page = (struct atlas_page) {0};
+    page->pixels.size = atlas->page_size;
+    page->pixels.format = atlas->format;
+    pixbuf_alloc(&page->pixels);
+    memset(page->pixels.buf, 0, page->pixels.buf_size);
+    /* Each node is at least one pixel wide, and placing adds one before trimming the others */
+    page->nodes = mem_alloc_array((size_t)atlas->page_size.x + 1, sizeof(*page->nodes));
+    reset_skyline(page, atlas->page_size);
+}
+
+static void fini_page(struct atlas_page *page)
+{
+    if (page->texture) {
+        texture_destroy(page->texture);
+    }
+    pixbuf_fini(&page->pixels);
+    mem_free(page->nodes);
+}
+
+/* Evicted pages are restored from their copies. */
+static void restore_page(struct texture *texture, void *data)
+{
+    const struct atlas *atlas = data;
+    int i;
+
+    for (i = 0; i < atlas->num_pages; ++i) {
+        if (atlas->pages[i].texture == texture) {
+            texture_upload(texture, &atlas->pages[i].pixels, (struct vec2i) {0, 0});
+            return;
+        }
+    }
+    FATAL("Restoring a texture which isn't an atlas page");
+}
+
+/* Compacting creates the pages' textures afterwards, so that it can reuse the old ones. */
+static int add_page(struct atlas *atlas, bool create_texture)
+{
+    struct atlas_page *page;
+
+    atlas->pages = mem_realloc_array(atlas->pages, (size_t)atlas->num_pages + 1, sizeof(*atlas->pages));
+    page = &atlas->pages[atlas->num_pages];
+    init_page(atlas, page);
+    if (create_texture) {
+        page->texture = texture_create(atlas->page_size, atlas->format);
+        texture_set_restore(page->texture, &restore_page, atlas);
+        texture_upload(page->texture, &page->pixels, (struct vec2i) {0, 0});
+    }
+    return atlas->num_pages++;
+}
+
+/* Copies rows of pixels between views of the same format and size. */
+static void copy_pixels(const struct pixbuf *dst, struct vec2i dst_pos, const struct pixview *src)
+{
+    size_t row_size = (size_t)src->size.x * (size_t)pixbuf_get_bytes_per_pixel(src->format);
+    size_t x_offset = (size_t)dst_pos.x * (size_t)pixbuf_get_bytes_per_pixel(dst->format);
+    int y;
+
+    for (y = 0; y < src->size.y; ++y) {
+        memcpy(pixbuf_get_row(dst, dst_pos.y + y) + x_offset, pixview_get_row(src, y), row_size);
+    }
+}
+
+/* Finds room for an image of the given size, starting a new page if needed. */
+static int place_image(struct atlas *atlas, struct vec2i size, bool create_textures, struct vec2i *out_pos)
+{
+    struct vec2i padded = {size.x + PADDING, size.y + PADDING};
+    int i;
+
+    for (i = 0; i < atlas->num_pages; ++i) {
+        if (place_on_skyline(&atlas->pages[i], atlas->page_size, padded, out_pos)) {
+            return i;
+        }
+    }
+    i = add_page(atlas, create_textures);
+    if (!place_on_skyline(&atlas->pages[i], atlas->page_size, padded, out_pos)) {
+        FATAL("Image of %dx%d doesn't fit on a %dx%d atlas page",
+              size.x, size.y, atlas->page_size.x, atlas->page_size.y);
+    }
+    return i;
+}
+
+static struct atlas_image *get_image(const struct atlas *atlas, int id)
+{
+    ASSERT(id >= 0 && id < atlas->num_images && atlas->images[id].page >= 0);
+    return &atlas->images[id];
+}
+
+/******************************************************************************/
+
+struct atlas *atlas_create(struct vec2i page_size, enum pixel_format format)
+{
+    struct atlas *atlas;
+
+    ASSERT(page_size.x > 0 && page_size.y > 0);
+    atlas = mem_alloc(sizeof(*atlas));
+    *atlas = (struct atlas) {0};
+    atlas->page_size = page_size;
+    atlas->format = format;
+    return atlas;
+}
+
+void atlas_destroy(struct atlas *atlas)
+{
+    int i;
+
+    DASSERT(atlas != NULL);
+    for (i = 0; i < atlas->num_pages; ++i) {
+        fini_page(&atlas->pages[i]);
+    }
+    mem_free(atlas->pages);
+    mem_free(atlas->images);
+    mem_free(atlas);
+}
+
+int atlas_add(struct atlas *atlas, const struct pixview *image)
+{
+    struct atlas_page *page;
+    struct vec2i pos;
+    int id, page_index;
+
+    DASSERT(atlas && image && image->origin);
+    ASSERT(image->format == atlas->format);
+    ASSERT(image->size.x > 0 && image->size.y > 0);
+
+    for (id = 0; id < atlas->num_images && atlas->images[id].page >= 0; ++id) {}
+    if (id == atlas->num_images) {
+        atlas->images = mem_realloc_array(atlas->images, (size_t)atlas->num_images + 1, sizeof(*atlas->images));
+        ++atlas->num_images;
+    }
+
+    page_index = place_image(atlas, image->size, true, &pos);
+    page = &atlas->pages[page_index];
+    copy_pixels(&page->pixels, pos, image);
+    texture_upload_view(page->texture, image, pos);
+    ++page->num_images;
+    atlas->images[id].page = page_index;
+    atlas->images[id].rect = (struct rect2i) {pos, {pos.x + image->size.x, pos.y + image->size.y}};
+    atlas->used_area += (int64_t)image->size.x * image->size.y;
+    return id;
+}
+
+void atlas_remove(struct atlas *atlas, int id)
+{
+    struct atlas_image *image = get_image(atlas, id);
+    struct rect2i rect = image->rect;
+
+    --atlas->pages[image->page].num_images;
+    atlas->used_area -= (int64_t)(rect.b.x - rect.a.x) * (rect.b.y - rect.a.y);
+    image->page = -1;
+}
+
+struct texture *atlas_get_texture(const struct atlas *atlas, int id)
+{
+    return atlas->pages[get_image(atlas, id)->page].texture;
+}
+
+struct rect2i atlas_get_rect(const struct atlas *atlas, int id)
+{
+    return get_image(atlas, id)->rect;
+}
+
+struct compact_key {
+    int id;
+    struct vec2i size;
+};
+
+/* Orders images by decreasing height, then decreasing width, which packs well on a skyline */
+static int compare_compact_keys(const void *a, const void *b)
+{
+    const struct compact_key *key_a = a;
+    const struct compact_key *key_b = b;
+
+    if (key_a->size.y != key_b->size.y) {
+        return key_b->size.y - key_a->size.y;
+    }
+    if (key_a->size.x != key_b->size.x) {
+        return key_b->size.x - key_a->size.x;
+    }
+    return key_a->id - key_b->id;
+}
+
+void atlas_compact(struct atlas *atlas)
+{
+    struct atlas_page *old_pages = atlas->pages;
+    int num_old_pages = atlas->num_pages;
+    struct compact_key *keys;
+    struct atlas_image *image;
+    struct pixview old_pixels;
+    struct vec2i pos;
+    int num_keys = 0;
+    int i;
+
+    DASSERT(atlas != NULL);
+    keys = mem_alloc_array((size_t)atlas->num_images + 1, sizeof(*keys));
+    for (i = 0; i < atlas->num_images; ++i) {
+        image = &atlas->images[i];
+        if (image->page >= 0) {
+            keys[num_keys].id = i;
+            keys[num_keys].size = (struct vec2i) {image->rect.b.x - image->rect.a.x, image->rect.b.y - image->rect.a.y};
+            ++num_keys;
+        }
+    }
+    qsort(keys, (size_t)num_keys, sizeof(*keys), &compare_compact_keys);
+
+    /* Repack onto new pages in memory, copying the pixels over from the old ones */
+    atlas->pages = NULL;
+    atlas->num_pages = 0;
+    for (i = 0; i < num_keys; ++i) {
+        image = &atlas->images[keys[i].id];
+        old_pixels = pixbuf_get_view(&old_pages[image->page].pixels);
+        old_pixels = pixview_get_sub(&old_pixels, image->rect);
+        image->page = place_image(atlas, keys[i].size, false, &pos);
+        copy_pixels(&atlas->pages[image->page].pixels, pos, &old_pixels);
+        ++atlas->pages[image->page].num_images;
+        image->rect = (struct rect2i) {pos, {pos.x + keys[i].size.x, pos.y + keys[i].size.y}};
+    }
+    mem_free(keys);
+
+    /* Hand the old textures over to the new pages, and upload each page whole */
+    for (i = 0; i < num_old_pages; ++i) {
+        if (i < atlas->num_pages) {
+            atlas->pages[i].texture = old_pages[i].texture;
+            old_pages[i].texture = NULL;
+        }
+        fini_page(&old_pages[i]);
+    }
+    mem_free(old_pages);
+    for (i = 0; i < atlas->num_pages; ++i) {
+        if (!atlas->pages[i].texture) {
+            atlas->pages[i].texture = texture_create(atlas->page_size, atlas->format);
+            texture_set_restore(atlas->pages[i].texture, &restore_page, atlas);
+        }
+        texture_upload(atlas->pages[i].texture, &atlas->pages[i].pixels, (struct vec2i) {0, 0});
+    }
+    LOG_DEBUG("Compacted atlas from %d to %d pages", num_old_pages, atlas->num_pages);
+}
+
+int atlas_get_num_pages(const struct atlas *atlas)
+{
+    return atlas->num_pages;
+}
+
+float atlas_get_usage(const struct atlas *atlas)
+{
+    if (!atlas->num_pages) {
+        return 0.0f;
+    }
+    return (float)atlas->used_area / ((float)atlas->page_size.x * (float)atlas->page_size.y * (float)atlas->num_pages);
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2021 Marty Mills <daggerbot@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_ATLAS_H
+#define INCLUDED_ATLAS_H
+
+#include "pixbuf.h"
+
+/*
+ * Packs images into a few large textures at runtime, so that sprites from
+ * different images can share a texture and be drawn together. Each page is a
+ * texture of the same size and format. Images are placed with a skyline
+ * packer, and a new page is started whenever one doesn't fit on the existing
+ * ones.
+ *
+ * Removing images leaves holes that the skyline can't reuse, so the atlas
+ * keeps a copy of each page's pixels, which atlas_compact uses to repack the
+ * remaining images onto as few pages as possible. Since that moves images,
+ * they're referred to by id, and their page and rectangle should be looked up
+ * again after compacting.
+ */
+
+struct atlas;
+struct texture;
+
+struct atlas *atlas_create(struct vec2i page_size, enum pixel_format format);
+void atlas_destroy(struct atlas *atlas);
+
+/* Uploads a copy of an image, which must fit on a page, and returns its id. */
+int atlas_add(struct atlas *atlas, const struct pixview *image);
+void atlas_remove(struct atlas *atlas, int id);
+
+/* Gets the texture of the page an image is on, and its source rectangle for sprite_batch_put. */
+struct texture *atlas_get_texture(const struct atlas *atlas, int id);
+struct rect2i atlas_get_rect(const struct atlas *atlas, int id);
+
+/* Repacks the images, sorted by height, and destroys any pages which end up empty. */
+void atlas_compact(struct atlas *atlas);
+
+int atlas_get_num_pages(const struct atlas *atlas);
+/* Gets the fraction of the pages' area which is covered by images. */
+float atlas_get_usage(const struct atlas *atlas);
+
+#endif /* INCLUDED_ATLAS_H */
@@ -0,0 +1,1210 @@
+/*
+ * Copyright (c) 2021 Marty Mills <daggerbot@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL_events.h>
+
+#include "atlas.h"
+#include "benchmark.h"
+#include "cpu.h"
+#include "debug.h"
+#include "dxt.h"
+#include "gl_state.h"
+#include "jobs.h"
+#include "memory.h"
+#include "pixbuf.h"
+#include "pixconv.h"
+#include "render.h"
+#include "sprites.h"
+#include "system.h"
+#include "texture.h"
+#include "tileset.h"
+#include "video.h"
+
+#define WARMUP_FRAMES 10
+#define SCALING_RUNS 5 /* Also used by the kernel scenes */
+
+/* Procedurally generated atlas of 16x16 tiles */
+#define ATLAS_SIZE 256
+#define TILE_SIZE 16
+#define ATLAS_TILES_PER_ROW (ATLAS_SIZE / TILE_SIZE)
+#define NUM_ATLAS_TILES (ATLAS_TILES_PER_ROW * ATLAS_TILES_PER_ROW)
+
+#define MAP_SIZE 1024 /* In tiles */
+#define NUM_SPRITES 100000
+
+enum subsystem {
+    SUBSYSTEM_UPDATE,  /* Scene logic, including filling sprite batches */
+    SUBSYSTEM_RENDER,  /* Flushing texture streams and issuing render calls */
+    SUBSYSTEM_PRESENT, /* Swapping buffers and waiting for the GPU */
+    NUM_SUBSYSTEMS
+};
+
+static const char *const subsystem_names[NUM_SUBSYSTEMS] = {
+    "update",
+    "render",
+    "present",
+};
+
+struct scene {
+    const char *name;
+    void(*init)(void);
+    void(*fini)(void);
+    void(*update)(int frame);
+    void(*render)(void);
+};
+
+static struct texture *atlas = NULL;
+static struct tileset *tileset = NULL; /* The same tiles, for the tilemap_array scene */
+static struct vec2i surface_size;
+
+/* Deterministic pseudo-random numbers, so that every run draws the same frames */
+static uint32_t hash_u32(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7FEB352Du;
+    x ^= x >> 15;
+    x *= 0x846CA68Bu;
+    x ^= x >> 16;
+    return x;
+}
+
+static struct rect2i get_tile_rect_in_atlas(int tile)
+{
+    struct vec2i a = {(tile % ATLAS_TILES_PER_ROW) * TILE_SIZE, (tile / ATLAS_TILES_PER_ROW) * TILE_SIZE};
+
+    return (struct rect2i) {a, {a.x + TILE_SIZE, a.y + TILE_SIZE}};
+}
+
+/* Gets a tile's source rectangle in whichever texture the tiles are drawn from. */
+static struct rect2i get_tile_rect(int tile)
+{
+    return tileset ? tileset_get_rect(tileset, tile) : get_tile_rect_in_atlas(tile);
+}
+
+/*
+ * Fills the atlas with distinctly colored, checkered tiles. The alpha channel
+ * is a circle, so masked sprites look different from unmasked ones.
+ */
+static void generate_atlas_pixels(struct pixbuf *pixbuf)
+{
+    uint8_t *pixel;
+    uint32_t tile;
+    int x, y, dx, dy;
+    bool dark;
+
+    pixbuf->size = (struct vec2i) {ATLAS_SIZE, ATLAS_SIZE};
+    pixbuf->format = PIXEL_FORMAT_RGBA_8888;
+    pixbuf_alloc(pixbuf);
+
+    for (y = 0; y < ATLAS_SIZE; ++y) {
+        pixel = pixbuf_get_row(pixbuf, y);
+        for (x = 0; x < ATLAS_SIZE; ++x) {
+            tile = (uint32_t)((y / TILE_SIZE) * ATLAS_TILES_PER_ROW + x / TILE_SIZE);
+            dx = 2 * (x % TILE_SIZE) - (TILE_SIZE - 1);
+            dy = 2 * (y % TILE_SIZE) - (TILE_SIZE - 1);
+            dark = ((x / 4) ^ (y / 4)) & 1;
+            pixel[0] = (uint8_t)((tile * 37) >> dark);
+            pixel[1] = (uint8_t)((tile * 91) >> dark);
+            pixel[2] = (uint8_t)((tile * 53) >> dark);
+            pixel[3] = dx * dx + dy * dy <= TILE_SIZE * TILE_SIZE ? 255 : 0;
+            pixel += 4;
+        }
+    }
+}
+
+static void create_atlas(void)
+{
+    struct pixbuf pixbuf = PIXBUF_INIT;
+
+    generate_atlas_pixels(&pixbuf);
+    atlas = texture_create(pixbuf.size, pixbuf.format);
+    texture_upload(atlas, &pixbuf, (struct vec2i) {0, 0});
+    pixbuf_fini(&pixbuf);
+}
+
+/******************************************************************************/
+
+static uint8_t *ground_tiles = NULL;
+static uint8_t *overlay_tiles = NULL; /* 0 means no tile */
+static struct sprite_batch *ground_batch = NULL;
+static struct sprite_batch *overlay_batch = NULL;
+static int num_overlay_sprites = 0;
+
+static void tilemap_init(void)
+{
+    size_t i;
+    uint32_t h;
+
+    ground_tiles = mem_alloc((size_t)MAP_SIZE * MAP_SIZE);
+    overlay_tiles = mem_alloc((size_t)MAP_SIZE * MAP_SIZE);
+    for (i = 0; i < (size_t)MAP_SIZE * MAP_SIZE; ++i) {
+        h = hash_u32((uint32_t)i);
+        ground_tiles[i] = (uint8_t)(h % (NUM_ATLAS_TILES / 2));
+        overlay_tiles[i] = (h >> 16) % 4 ? 0 : (uint8_t)(NUM_ATLAS_TILES / 2 + (h >> 8) % (NUM_ATLAS_TILES / 2));
+    }
+
+    /* Batches are sized for the whole screen once, so scrolling doesn't reallocate them */
+    ground_batch = sprite_batch_create();
+    overlay_batch = sprite_batch_create();
+    sprite_batch_resize(ground_batch, (surface_size.x / TILE_SIZE + 2) * (surface_size.y / TILE_SIZE + 2));
+    sprite_batch_resize(overlay_batch, (surface_size.x / TILE_SIZE + 2) * (surface_size.y / TILE_SIZE + 2));
+}
+
+static void tilemap_fini(void)
+{
+    sprite_batch_destroy(overlay_batch);
+    sprite_batch_destroy(ground_batch);
+    overlay_batch = NULL;
+    ground_batch = NULL;
+    overlay_tiles = mem_free(overlay_tiles);
+    ground_tiles = mem_free(ground_tiles);
+}
+
+static void tilemap_update(int frame)
+{
+    struct vec2i camera = {frame * 3 % (MAP_SIZE * TILE_SIZE), frame * 2 % (MAP_SIZE * TILE_SIZE)};
+    struct vec2i first = {camera.x / TILE_SIZE, camera.y / TILE_SIZE};
+    struct vec2i pos;
+    struct vec4f white = {1.0f, 1.0f, 1.0f, 1.0f};
+    size_t map_index;
+    int num_cols = surface_size.x / TILE_SIZE + 2;
+    int num_rows = surface_size.y / TILE_SIZE + 2;
+    int index = 0;
+    int x, y;
+
+    num_overlay_sprites = 0;
+    for (y = 0; y < num_rows; ++y) {
+        for (x = 0; x < num_cols; ++x) {
+            map_index = (size_t)((first.y + y) % MAP_SIZE) * MAP_SIZE + (size_t)((first.x + x) % MAP_SIZE);
+            pos.x = (first.x + x) * TILE_SIZE - camera.x;
+            pos.y = (first.y + y) * TILE_SIZE - camera.y;
+            sprite_batch_put(ground_batch, index++, get_tile_rect(ground_tiles[map_index]), pos, white);
+            if (overlay_tiles[map_index]) {
+                sprite_batch_put(overlay_batch, num_overlay_sprites++,
+                                 get_tile_rect(overlay_tiles[map_index]), pos, white);
+            }
+        }
+    }
+}
+
+/* Same as tilemap, but with each tile in its own layer of a texture array, if the GL supports them */
+static void tilemap_array_init(void)
+{
+    struct pixbuf pixbuf = PIXBUF_INIT;
+    struct pixview view, tile_view;
+    int i;
+
+    generate_atlas_pixels(&pixbuf);
+    view = pixbuf_get_view(&pixbuf);
+    tileset = tileset_create((struct vec2i) {TILE_SIZE, TILE_SIZE}, NUM_ATLAS_TILES, pixbuf.format);
+    for (i = 0; i < NUM_ATLAS_TILES; ++i) {
+        tile_view = pixview_get_sub(&view, get_tile_rect_in_atlas(i));
+        tileset_upload(tileset, i, &tile_view);
+    }
+    pixbuf_fini(&pixbuf);
+    LOG_DEBUG("Tileset is %s", tileset_is_array(tileset) ? "a texture array" : "a 2D texture");
+    tilemap_init();
+}
+
+static void tilemap_array_fini(void)
+{
+    tilemap_fini();
+    tileset_destroy(tileset);
+    tileset = NULL;
+}
+
+static void tilemap_render(void)
+{
+    render_use_ui_transform(NULL);
+    render_use_texture(tileset ? tileset_get_texture(tileset) : atlas);
+    render_draw_sprites_now(ground_batch, SPRITE_MODE_RGB, 0, ground_batch->num_sprites);
+    if (num_overlay_sprites) {
+        render_draw_sprites_now(overlay_batch, SPRITE_MODE_RGB_MASK, 0, num_overlay_sprites);
+    }
+}
+
+/*
+ * Same as tilemap, but with the atlas uploaded as DXT1 blocks. Each 4x4 block
+ * of the procedural atlas is one color, apart from the transparent corners
+ * of the tiles, so it compresses exactly in the 3-color mode: both endpoints
+ * are the block's color, and index 3 is transparent.
+ */
+static void compress_atlas_dxt1(const struct pixbuf *pixbuf, uint8_t *blocks)
+{
+    const uint8_t *pixel;
+    unsigned color;
+    uint32_t indices;
+    int bx, by, x, y;
+
+    for (by = 0; by < ATLAS_SIZE; by += 4) {
+        for (bx = 0; bx < ATLAS_SIZE; bx += 4) {
+            color = 0;
+            indices = 0;
+            for (y = 0; y < 4; ++y) {
+                pixel = pixbuf_get_row(pixbuf, by + y) + (size_t)bx * 4;
+                for (x = 0; x < 4; ++x, pixel += 4) {
+                    if (pixel[3]) {
+                        color = (unsigned)(pixel[0] >> 3) << 11 | (unsigned)(pixel[1] >> 2) << 5
+                                | (unsigned)(pixel[2] >> 3);
+                    } else {
+                        indices |= (uint32_t)3 << (2 * (y * 4 + x));
+                    }
+                }
+            }
+            blocks[0] = blocks[2] = (uint8_t)color;
+            blocks[1] = blocks[3] = (uint8_t)(color >> 8);
+            blocks[4] = (uint8_t)indices;
+            blocks[5] = (uint8_t)(indices >> 8);
+            blocks[6] = (uint8_t)(indices >> 16);
+            blocks[7] = (uint8_t)(indices >> 24);
+            blocks += 8;
+        }
+    }
+}
+
+static void tilemap_dxt_init(void)
+{
+    struct pixbuf pixbuf = PIXBUF_INIT;
+    size_t size;
+    uint8_t *blocks;
+
+    generate_atlas_pixels(&pixbuf);
+    size = dxt_get_image_size(PIXEL_FORMAT_DXT1, pixbuf.size);
+    blocks = mem_alloc(size);
+    compress_atlas_dxt1(&pixbuf, blocks);
+    texture_destroy(atlas);
+    atlas = texture_create(pixbuf.size, PIXEL_FORMAT_DXT1);
+    texture_upload_compressed(atlas, blocks, size);
+    mem_free(blocks);
+    pixbuf_fini(&pixbuf);
+    tilemap_init();
+}
+
+/* Same as tilemap, but with the atlas as palette indices, and a different palette every frame */
+static struct texture *palette = NULL;
+static struct pixbuf palette_pixels = PIXBUF_INIT;
+
+static void tilemap_indexed_init(void)
+{
+    struct pixbuf rgba = PIXBUF_INIT, indices = PIXBUF_INIT;
+    const uint8_t *src;
+    uint8_t *dst;
+    int x, y;
+
+    /* Index 0 is transparent, and the others are picked by each pixel's color */
+    generate_atlas_pixels(&rgba);
+    indices.size = rgba.size;
+    indices.format = PIXEL_FORMAT_ALPHA_8;
+    pixbuf_alloc(&indices);
+    for (y = 0; y < ATLAS_SIZE; ++y) {
+        src = pixbuf_get_row(&rgba, y);
+        dst = pixbuf_get_row(&indices, y);
+        for (x = 0; x < ATLAS_SIZE; ++x) {
+            dst[x] = src[3] ? (uint8_t)(1 + (src[0] + src[1] * 3u) % 255u) : 0;
+            src += 4;
+        }
+    }
+    texture_destroy(atlas);
+    atlas = texture_create(indices.size, indices.format);
+    texture_upload(atlas, &indices, (struct vec2i) {0, 0});
+    pixbuf_fini(&indices);
+    pixbuf_fini(&rgba);
+
+    palette_pixels.size = (struct vec2i) {256, 1};
+    palette_pixels.format = PIXEL_FORMAT_RGBA_8888;
+    pixbuf_alloc(&palette_pixels);
+    palette = texture_create(palette_pixels.size, palette_pixels.format);
+    tilemap_init();
+}
+
+static void tilemap_indexed_fini(void)
+{
+    tilemap_fini();
+    texture_destroy(palette);
+    palette = NULL;
+    pixbuf_fini(&palette_pixels);
+}
+
+static void tilemap_indexed_update(int frame)
+{
+    uint8_t *entry = palette_pixels.buf;
+    int i;
+
+    memset(entry, 0, 4);
+    for (i = 1; i < 256; ++i) {
+        entry += 4;
+        entry[0] = (uint8_t)(i * 37 + frame);
+        entry[1] = (uint8_t)(i * 91 + frame * 3);
+        entry[2] = (uint8_t)(i * 53 - frame);
+        entry[3] = 255;
+    }
+    texture_upload(palette, &palette_pixels, (struct vec2i) {0, 0});
+    tilemap_update(frame);
+}
+
+static void tilemap_indexed_render(void)
+{
+    render_use_ui_transform(NULL);
+    render_use_texture(atlas);
+    render_use_palette(palette);
+    render_draw_sprites_now(ground_batch, SPRITE_MODE_INDEXED, 0, ground_batch->num_sprites);
+    if (num_overlay_sprites) {
+        render_draw_sprites_now(overlay_batch, SPRITE_MODE_INDEXED, 0, num_overlay_sprites);
+    }
+}
+
+/******************************************************************************/
+
+static const enum sprite_mode sprite_modes[] = {
+    SPRITE_MODE_MASK,
+    SPRITE_MODE_RGB,
+    SPRITE_MODE_RGB_MASK,
+};
+#define NUM_SPRITE_MODES ((int)LENGTHOF(sprite_modes))
+
+static struct sprite_batch *sprite_batches[NUM_SPRITE_MODES];
+static struct vec2i *sprite_origins = NULL;
+static uint8_t *sprite_tiles = NULL;
+
+static void sprites_init(void)
+{
+    uint32_t h;
+    int i;
+
+    for (i = 0; i < NUM_SPRITE_MODES; ++i) {
+        sprite_batches[i] = sprite_batch_create();
+        sprite_batch_resize(sprite_batches[i], (NUM_SPRITES + NUM_SPRITE_MODES - 1 - i) / NUM_SPRITE_MODES);
+    }
+    sprite_origins = mem_alloc_array(NUM_SPRITES, sizeof(*sprite_origins));
+    sprite_tiles = mem_alloc(NUM_SPRITES);
+    for (i = 0; i < NUM_SPRITES; ++i) {
+        h = hash_u32((uint32_t)i);
+        sprite_origins[i].x = (int)(h % (uint32_t)surface_size.x) - TILE_SIZE / 2;
+        sprite_origins[i].y = (int)((h >> 12) % (uint32_t)surface_size.y) - TILE_SIZE / 2;
+        sprite_tiles[i] = (uint8_t)(h >> 24);
+    }
+}
+
+static void sprites_fini(void)
+{
+    int i;
+
+    sprite_tiles = mem_free(sprite_tiles);
+    sprite_origins = mem_free(sprite_origins);
+    for (i = 0; i < NUM_SPRITE_MODES; ++i) {
+        sprite_batch_destroy(sprite_batches[i]);
+        sprite_batches[i] = NULL;
+    }
+}
+
+/* Triangle wave with a period of 64 and an amplitude of 16 */
+static int wobble(int t)
+{
+    t &= 63;
+    return (t < 32 ? t : 64 - t) - 16;
+}
+
+static void sprites_update(int frame)
+{
+    struct vec2i pos;
+    struct vec4f color;
+    int i;
+
+    /* Sprites are dealt out to the batches in turn, so each mode gets a third of them */
+    for (i = 0; i < NUM_SPRITES; ++i) {
+        pos.x = sprite_origins[i].x + wobble(frame + i);
+        pos.y = sprite_origins[i].y + wobble(frame * 2 + i / 7);
+        color = (struct vec4f) {
+            (float)(i & 3) / 3.0f,
+            (float)((i >> 2) & 3) / 3.0f,
+            1.0f,
+            0.75f,
+        };
+        sprite_batch_put(sprite_batches[i % NUM_SPRITE_MODES], i / NUM_SPRITE_MODES,
+                         get_tile_rect(sprite_tiles[i]), pos, color);
+    }
+}
+
+static void sprites_render(void)
+{
+    int i;
+
+    render_use_ui_transform(NULL);
+    render_use_texture(atlas);
+    for (i = 0; i < NUM_SPRITE_MODES; ++i) {
+        render_draw_sprites_now(sprite_batches[i], sprite_modes[i], 0, sprite_batches[i]->num_sprites);
+    }
+}
+
+/******************************************************************************/
+
+#define STREAM_SIZE 1024
+#define STREAM_BANDS 16 /* Streamed separately, and filled by whichever job thread gets them */
+
+static struct texture *stream_texture = NULL;
+static struct sprite_batch *stream_batch = NULL;
+static struct texture_stream streams[STREAM_BANDS];
+static int stream_frame;
+
+static void streaming_init(void)
+{
+    stream_texture = texture_create((struct vec2i) {STREAM_SIZE, STREAM_SIZE}, PIXEL_FORMAT_RGBA_8888);
+    stream_batch = sprite_batch_create();
+    sprite_batch_resize(stream_batch, 1);
+}
+
+static void streaming_fini(void)
+{
+    sprite_batch_destroy(stream_batch);
+    texture_destroy(stream_texture);
+    stream_batch = NULL;
+    stream_texture = NULL;
+}
+
+/* Fills bands of the texture with a scrolling pattern, then ends their streams. */
+static void streaming_fill_bands(UNUSED void *data, int begin, int end)
+{
+    uint8_t *pixel;
+    int band, x, y;
+
+    for (band = begin; band < end; ++band) {
+        for (y = 0; y < STREAM_SIZE / STREAM_BANDS; ++y) {
+            pixel = streams[band].pixels + (size_t)y * (size_t)streams[band].row_pitch;
+            for (x = 0; x < STREAM_SIZE; ++x) {
+                pixel[0] = (uint8_t)(x + stream_frame);
+                pixel[1] = (uint8_t)(band * (STREAM_SIZE / STREAM_BANDS) + y + stream_frame * 2);
+                pixel[2] = (uint8_t)((x ^ y) + stream_frame);
+                pixel[3] = 255;
+                pixel += 4;
+            }
+        }
+        texture_stream_end(&streams[band]);
+    }
+}
+
+static void streaming_update(int frame)
+{
+    static const struct vec4f white = {1.0f, 1.0f, 1.0f, 1.0f};
+    int i;
+
+    stream_frame = frame;
+    for (i = 0; i < STREAM_BANDS; ++i) {
+        texture_stream_begin(&streams[i], stream_texture, (struct vec2i) {0, i * (STREAM_SIZE / STREAM_BANDS)},
+                             (struct vec2i) {STREAM_SIZE, STREAM_SIZE / STREAM_BANDS});
+    }
+    jobs_parallel_for(STREAM_BANDS, 1, &streaming_fill_bands, NULL);
+    sprite_batch_put(stream_batch, 0, (struct rect2i) {{0, 0}, {STREAM_SIZE, STREAM_SIZE}}, (struct vec2i) {0, 0},
+                     white);
+}
+
+/* texture_begin_frame has flushed the streams by now */
+static void streaming_render(void)
+{
+    render_use_ui_transform(NULL);
+    render_use_texture(stream_texture);
+    render_draw_sprites_now(stream_batch, SPRITE_MODE_RGB, 0, 1);
+}
+
+/******************************************************************************/
+
+#define PACK_PAGE_SIZE 512
+#define PACK_IMAGES 1024
+#define PACK_CHURN 16 /* Images replaced every frame */
+#define PACK_COMPACT_FRAMES 60
+
+/* Sprites drawn from one atlas page, up to end in pack_batch */
+struct pack_run {
+    struct texture *texture;
+    int end;
+};
+
+static struct atlas *pack_atlas = NULL;
+static struct pixbuf pack_source = PIXBUF_INIT; /* The images are cut out of the procedural atlas */
+static struct sprite_batch *pack_batch = NULL;
+static int pack_ids[PACK_IMAGES];
+static bool pack_drawn[PACK_IMAGES];
+static struct pack_run pack_runs[PACK_IMAGES];
+static int num_pack_runs = 0;
+
+/* Adds a piece of the procedural atlas, of a size and place picked by seed. */
+static int add_pack_image(uint32_t seed)
+{
+    uint32_t h = hash_u32(seed);
+    struct vec2i size = {8 + (int)(h % 57), 8 + (int)((h >> 8) % 57)};
+    struct vec2i a = {(int)((h >> 16) % (uint32_t)(ATLAS_SIZE - size.x + 1)),
+                      (int)((h >> 24) % (uint32_t)(ATLAS_SIZE - size.y + 1))};
+    struct pixview view = pixbuf_get_view(&pack_source);
+
+    view = pixview_get_sub(&view, (struct rect2i) {a, {a.x + size.x, a.y + size.y}});
+    return atlas_add(pack_atlas, &view);
+}
+
+static void packing_init(void)
+{
+    int i;
+
+    generate_atlas_pixels(&pack_source);
+    pack_atlas = atlas_create((struct vec2i) {PACK_PAGE_SIZE, PACK_PAGE_SIZE}, pack_source.format);
+    for (i = 0; i < PACK_IMAGES; ++i) {
+        pack_ids[i] = add_pack_image((uint32_t)i);
+    }
+    pack_batch = sprite_batch_create();
+    sprite_batch_resize(pack_batch, PACK_IMAGES);
+}
+
+static void packing_fini(void)
+{
+    LOG_DEBUG("Atlas has %d pages, %.0f%% used", atlas_get_num_pages(pack_atlas),
+              atlas_get_usage(pack_atlas) * 100.0f);
+    sprite_batch_destroy(pack_batch);
+    atlas_destroy(pack_atlas);
+    pixbuf_fini(&pack_source);
+    pack_batch = NULL;
+    pack_atlas = NULL;
+}
+
+/*
+ * Replaces a few images every frame, which leaves holes in the pages, and
+ * compacts the atlas every so often. Every image is drawn, with the ones on
+ * each page put together so that the page only has to be bound once.
+ */
+static void packing_update(int frame)
+{
+    static const struct vec4f white = {1.0f, 1.0f, 1.0f, 1.0f};
+    struct texture *texture;
+    struct vec2i pos;
+    uint32_t seed, h;
+    int i, j, index = 0;
+
+    for (i = 0; i < PACK_CHURN; ++i) {
+        seed = (uint32_t)(PACK_IMAGES + frame * PACK_CHURN + i);
+        j = (int)(hash_u32(seed ^ 0x9E3779B9u) % PACK_IMAGES);
+        atlas_remove(pack_atlas, pack_ids[j]);
+        pack_ids[j] = add_pack_image(seed);
+    }
+    if (frame % PACK_COMPACT_FRAMES == PACK_COMPACT_FRAMES - 1) {
+        atlas_compact(pack_atlas);
+    }
+
+    memset(pack_drawn, 0, sizeof(pack_drawn));
+    num_pack_runs = 0;
+    for (i = 0; i < PACK_IMAGES; ++i) {
+        if (pack_drawn[i]) {
+            continue;
+        }
+        texture = atlas_get_texture(pack_atlas, pack_ids[i]);
+        for (j = i; j < PACK_IMAGES; ++j) {
+            if (!pack_drawn[j] && atlas_get_texture(pack_atlas, pack_ids[j]) == texture) {
+                h = hash_u32((uint32_t)j);
+                pos.x = (int)(h % (uint32_t)surface_size.x) - 32 + wobble(frame + j);
+                pos.y = (int)((h >> 12) % (uint32_t)surface_size.y) - 32;
+                sprite_batch_put(pack_batch, index++, atlas_get_rect(pack_atlas, pack_ids[j]), pos, white);
+                pack_drawn[j] = true;
+            }
+        }
+        pack_runs[num_pack_runs++] = (struct pack_run) {texture, index};
+    }
+}
+
+static void packing_render(void)
+{
+    int first = 0;
+    int i;
+
+    render_use_ui_transform(NULL);
+    for (i = 0; i < num_pack_runs; ++i) {
+        render_use_texture(pack_runs[i].texture);
+        render_draw_sprites_now(pack_batch, SPRITE_MODE_RGB_MASK, first, pack_runs[i].end - first);
+        first = pack_runs[i].end;
+    }
+}
+
+/******************************************************************************/
+
+#define JOBS_HASH_COUNT (1 << 23)
+#define JOBS_TREE_DEPTH 16
+#define JOBS_LEAF_HASHES 64
+
+static _Atomic uint32_t jobs_checksum;
+
+static void jobs_hash_range(UNUSED void *data, int begin, int end)
+{
+    uint32_t sum = 0;
+    int i;
+
+    for (i = begin; i < end; ++i) {
+        sum += hash_u32((uint32_t)i);
+    }
+    atomic_fetch_add_explicit(&jobs_checksum, sum, memory_order_relaxed);
+}
+
+/* Binary tree of fork/join jobs with tiny leaves, to stress stealing */
+static void jobs_tree(void *data)
+{
+    int depth = (int)(intptr_t)data;
+    struct job_counter counter = JOB_COUNTER_INIT;
+
+    if (!depth) {
+        jobs_hash_range(NULL, 0, JOBS_LEAF_HASHES);
+        return;
+    }
+    jobs_run(&jobs_tree, (void *)(intptr_t)(depth - 1), &counter);
+    jobs_tree((void *)(intptr_t)(depth - 1));
+    jobs_wait(&counter);
+}
+
+static void jobs_run_once(void)
+{
+    jobs_parallel_for(JOBS_HASH_COUNT, 0, &jobs_hash_range, NULL);
+    jobs_tree((void *)(intptr_t)JOBS_TREE_DEPTH);
+}
+
+/******************************************************************************/
+
+#define FILL_SPRITES 1000000
+
+static struct sprite_batch *fill_batch = NULL;
+
+static void sprite_fill_init(void)
+{
+    fill_batch = sprite_batch_create();
+}
+
+static void sprite_fill_fini(void)
+{
+    sprite_batch_destroy(fill_batch);
+    fill_batch = NULL;
+}
+
+static void sprite_fill_range(UNUSED void *data, int begin, int end)
+{
+    static const struct vec4f white = {1.0f, 1.0f, 1.0f, 1.0f};
+    int index = sprite_batch_claim(fill_batch, end - begin);
+    struct vec2i pos;
+    uint32_t h;
+    int i;
+
+    for (i = begin; i < end; ++i) {
+        h = hash_u32((uint32_t)i);
+        pos.x = (int)(h & 0x3FF);
+        pos.y = (int)((h >> 10) & 0x3FF);
+        sprite_batch_put(fill_batch, index++, get_tile_rect((int)(h >> 24)), pos, white);
+    }
+}
+
+static void sprite_fill_run_once(void)
+{
+    sprite_batch_begin_fill(fill_batch, FILL_SPRITES);
+    jobs_parallel_for(FILL_SPRITES, 0, &sprite_fill_range, NULL);
+    sprite_batch_end_fill(fill_batch, SPRITE_BATCH_NUM_CLAIMED);
+    ASSERT(fill_batch->num_sprites == FILL_SPRITES);
+}
+
+/******************************************************************************/
+
+#define PUT_MANY_SPRITES 1000000
+
+static struct sprite_batch *put_batch = NULL;
+static struct vec2i *put_positions = NULL;
+static struct rect2i *put_src_rects = NULL;
+static struct vec4f *put_colors = NULL;
+
+static void put_many_init(void)
+{
+    uint32_t h;
+    int i;
+
+    put_batch = sprite_batch_create();
+    sprite_batch_resize(put_batch, PUT_MANY_SPRITES);
+    put_positions = mem_alloc_array(PUT_MANY_SPRITES, sizeof(*put_positions));
+    put_src_rects = mem_alloc_array(PUT_MANY_SPRITES, sizeof(*put_src_rects));
+    put_colors = mem_alloc_array(PUT_MANY_SPRITES, sizeof(*put_colors));
+    for (i = 0; i < PUT_MANY_SPRITES; ++i) {
+        h = hash_u32((uint32_t)i);
+        put_positions[i] = (struct vec2i) {(int)(h & 0x3FF), (int)((h >> 10) & 0x3FF)};
+        put_src_rects[i] = get_tile_rect((int)(h >> 24));
+        put_colors[i] = (struct vec4f) {1.0f, 1.0f, 1.0f, (float)(h & 0xFF) / 255.0f};
+    }
+}
+
+static void put_many_fini(void)
+{
+    put_colors = mem_free(put_colors);
+    put_src_rects = mem_free(put_src_rects);
+    put_positions = mem_free(put_positions);
+    sprite_batch_destroy(put_batch);
+    put_batch = NULL;
+}
+
+static void put_one_at_a_time(void)
+{
+    int i;
+
+    for (i = 0; i < PUT_MANY_SPRITES; ++i) {
+        sprite_batch_put(put_batch, i, put_src_rects[i], put_positions[i], put_colors[i]);
+    }
+}
+
+static void put_many(void)
+{
+    sprite_batch_put_many(put_batch, 0, PUT_MANY_SPRITES, put_positions, put_src_rects, put_colors);
+}
+
+/******************************************************************************/
+
+#define PIXCONV_SIZE 2048
+#define PIXCONV_PIXELS (PIXCONV_SIZE * PIXCONV_SIZE)
+#define PIXCONV_PARALLEL_SIZE 4096
+
+static struct pixbuf pixconv_rgb = PIXBUF_INIT;
+static struct pixbuf pixconv_rgba = PIXBUF_INIT;
+static struct pixbuf pixconv_dst = PIXBUF_INIT;
+
+static void pixconv_fill(struct pixbuf *pixbuf, int size, enum pixel_format format)
+{
+    uint32_t *words;
+    size_t i;
+
+    pixbuf->size = (struct vec2i) {size, size};
+    pixbuf->format = format;
+    pixbuf_alloc(pixbuf);
+    words = (uint32_t *)pixbuf->buf;
+    for (i = 0; i < pixbuf->buf_size / sizeof(*words); ++i) {
+        words[i] = hash_u32((uint32_t)i);
+    }
+}
+
+static void pixconv_init(void)
+{
+    pixconv_fill(&pixconv_rgb, PIXCONV_SIZE, PIXEL_FORMAT_RGB_888);
+    pixconv_fill(&pixconv_rgba, PIXCONV_SIZE, PIXEL_FORMAT_RGBA_8888);
+}
+
+static void pixconv_parallel_init(void)
+{
+    pixconv_fill(&pixconv_rgba, PIXCONV_PARALLEL_SIZE, PIXEL_FORMAT_RGBA_8888);
+}
+
+static void pixconv_fini(void)
+{
+    pixbuf_fini(&pixconv_dst);
+    pixbuf_fini(&pixconv_rgba);
+    pixbuf_fini(&pixconv_rgb);
+}
+
+static void pixconv_convert_to(const struct pixbuf *src, enum pixel_format format)
+{
+    pixconv_dst.format = format;
+    pixconv_convert(src, &pixconv_dst);
+}
+
+static void pixconv_rgb_to_rgba(void)
+{
+    pixconv_convert_to(&pixconv_rgb, PIXEL_FORMAT_RGBA_8888);
+}
+
+static void pixconv_rgba_to_rgb(void)
+{
+    pixconv_convert_to(&pixconv_rgba, PIXEL_FORMAT_RGB_888);
+}
+
+static void pixconv_rgba_to_bgra(void)
+{
+    pixconv_convert_to(&pixconv_rgba, PIXEL_FORMAT_BGRA_8888);
+}
+
+static void pixconv_rgba_to_alpha(void)
+{
+    pixconv_convert_to(&pixconv_rgba, PIXEL_FORMAT_ALPHA_8);
+}
+
+/* These work in place, but take the same time whatever the pixels are, so repeating them is fine */
+static void pixconv_premultiply_run(void)
+{
+    pixconv_premultiply(&pixconv_rgba);
+}
+
+static void pixconv_unpremultiply_run(void)
+{
+    pixconv_unpremultiply(&pixconv_rgba);
+}
+
+/******************************************************************************/
+
+static const struct scene scenes[] = {
+    {"tilemap", &tilemap_init, &tilemap_fini, &tilemap_update, &tilemap_render},
+    {"sprites", &sprites_init, &sprites_fini, &sprites_update, &sprites_render},
+    {"tilemap_array", &tilemap_array_init, &tilemap_array_fini, &tilemap_update, &tilemap_render},
+    {"compressed", &tilemap_dxt_init, &tilemap_fini, &tilemap_update, &tilemap_render},
+    {"indexed", &tilemap_indexed_init, &tilemap_indexed_fini, &tilemap_indexed_update, &tilemap_indexed_render},
+    {"streaming", &streaming_init, &streaming_fini, &streaming_update, &streaming_render},
+    {"packing", &packing_init, &packing_fini, &packing_update, &packing_render},
+};
+
+/* Measure how a CPU workload scales with the number of job threads, rather than rendering frames */
+struct scaling_scene {
+    const char *name;
+    void(*init)(void); /* Optional */
+    void(*fini)(void); /* Optional */
+    void(*run_once)(void);
+};
+
+static const struct scaling_scene scaling_scenes[] = {
+    {"jobs", NULL, NULL, &jobs_run_once},
+    {"sprite_fill", &sprite_fill_init, &sprite_fill_fini, &sprite_fill_run_once},
+    {"pixconv_parallel", &pixconv_parallel_init, &pixconv_fini, &pixconv_premultiply_run},
+};
+
+/* Compare implementations of the same workload on one thread, such as SIMD kernels and scalar code */
+struct kernel_variant {
+    const char *name;
+    unsigned cpu_features; /* Required, and the only ones the variant may use */
+    void(*run_once)(void);
+};
+
+struct kernel_scene {
+    const char *name;
+    const char *unit; /* What run_once processes PER_RUN of */
+    int per_run;
+    void(*init)(void);
+    void(*fini)(void);
+    const struct kernel_variant *variants;
+    int num_variants;
+};
+
+static const struct kernel_variant put_many_variants[] = {
+    {"put", 0, &put_one_at_a_time},
+    {"put_many_scalar", 0, &put_many},
+    {"put_many_sse2", CPU_FEATURE_SSE2, &put_many},
+    {"put_many_avx2", CPU_FEATURE_AVX2, &put_many},
+};
+
+/* The AVX2 pixel conversion kernels use the SSE ones for the ends of rows */
+#define SSSE3_FEATURES (CPU_FEATURE_SSE2 | CPU_FEATURE_SSSE3)
+#define AVX2_FEATURES (SSSE3_FEATURES | CPU_FEATURE_AVX2)
+
+#define PIXCONV_VARIANTS(fn, sse_name, sse_features) \
+    static const struct kernel_variant fn##_variants[] = { \
+        {"scalar", 0, &fn}, \
+        {sse_name, sse_features, &fn}, \
+        {"avx2", AVX2_FEATURES, &fn}, \
+    }
+
+PIXCONV_VARIANTS(pixconv_rgb_to_rgba, "ssse3", SSSE3_FEATURES);
+PIXCONV_VARIANTS(pixconv_rgba_to_rgb, "ssse3", SSSE3_FEATURES);
+PIXCONV_VARIANTS(pixconv_rgba_to_bgra, "ssse3", SSSE3_FEATURES);
+PIXCONV_VARIANTS(pixconv_rgba_to_alpha, "sse2", CPU_FEATURE_SSE2);
+PIXCONV_VARIANTS(pixconv_premultiply_run, "ssse3", SSSE3_FEATURES);
+PIXCONV_VARIANTS(pixconv_unpremultiply_run, "sse2", CPU_FEATURE_SSE2);
+
+#define PIXCONV_SCENE(name, fn) \
+    {name, "pixels", PIXCONV_PIXELS, &pixconv_init, &pixconv_fini, fn##_variants, (int)LENGTHOF(fn##_variants)}
+
+static const struct kernel_scene kernel_scenes[] = {
+    {"put_many", "sprites", PUT_MANY_SPRITES, &put_many_init, &put_many_fini,
+     put_many_variants, (int)LENGTHOF(put_many_variants)},
+    PIXCONV_SCENE("rgb_to_rgba", pixconv_rgb_to_rgba),
+    PIXCONV_SCENE("rgba_to_rgb", pixconv_rgba_to_rgb),
+    PIXCONV_SCENE("rgba_to_bgra", pixconv_rgba_to_bgra),
+    PIXCONV_SCENE("rgba_to_alpha", pixconv_rgba_to_alpha),
+    PIXCONV_SCENE("premultiply", pixconv_premultiply_run),
+    PIXCONV_SCENE("unpremultiply", pixconv_unpremultiply_run),
+};
+
+static const struct scene *find_scene(const char *name)
+{
+    char *names = NULL;
+    unsigned i;
+
+    for (i = 0; i < LENGTHOF(scenes); ++i) {
+        if (!strcmp(scenes[i].name, name)) {
+            return &scenes[i];
+        }
+    }
+    for (i = 0; i < LENGTHOF(scenes); ++i) {
+        names = str_appendf(names, "%s%s", i ? ", " : "", scenes[i].name);
+    }
+    for (i = 0; i < LENGTHOF(scaling_scenes); ++i) {
+        names = str_appendf(names, ", %s", scaling_scenes[i].name);
+    }
+    for (i = 0; i < LENGTHOF(kernel_scenes); ++i) {
+        names = str_appendf(names, ", %s", kernel_scenes[i].name);
+    }
+    FATAL("Unknown benchmark scene: %s (available scenes: %s)", name, names);
+}
+
+static const struct scaling_scene *find_scaling_scene(const char *name)
+{
+    unsigned i;
+
+    for (i = 0; i < LENGTHOF(scaling_scenes); ++i) {
+        if (!strcmp(scaling_scenes[i].name, name)) {
+            return &scaling_scenes[i];
+        }
+    }
+    return NULL;
+}
+
+static const struct kernel_scene *find_kernel_scene(const char *name)
+{
+    unsigned i;
+
+    for (i = 0; i < LENGTHOF(kernel_scenes); ++i) {
+        if (!strcmp(kernel_scenes[i].name, name)) {
+            return &kernel_scenes[i];
+        }
+    }
+    return NULL;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t value_a = *(const uint64_t *)a;
+    uint64_t value_b = *(const uint64_t *)b;
+
+    return (value_a > value_b) - (value_a < value_b);
+}
+
+/* Gets a percentile of sorted values by the nearest-rank method */
+static double get_percentile_ms(const uint64_t *sorted, int count, int percentile)
+{
+    int rank = (count * percentile + 99) / 100;
+
+    if (rank < 1) {
+        rank = 1;
+    }
+    return (double)sorted[rank - 1] / 1e6;
+}
+
+/* Runs a workload once to warm up, then gets the median time of a few more runs. */
+static uint64_t time_median(void(*run_once)(void))
+{
+    uint64_t times[SCALING_RUNS];
+    uint64_t t0;
+    int run;
+
+    run_once();
+    for (run = 0; run < SCALING_RUNS; ++run) {
+        t0 = system_get_time_ns();
+        run_once();
+        times[run] = system_get_time_ns() - t0;
+    }
+    qsort(times, SCALING_RUNS, sizeof(*times), compare_u64);
+    return times[SCALING_RUNS / 2];
+}
+
+/*
+ * Runs the workload with every thread count from 1 to the number the job
+ * system was started with, and reports the median time of each.
+ */
+static void run_scaling(const struct scaling_scene *scene)
+{
+    int max_threads = jobs_get_num_threads();
+    uint64_t base_time = 0, time;
+    int threads;
+
+    if (scene->init) {
+        scene->init();
+    }
+
+    printf("{\n");
+    printf("  \"scene\": \"%s\",\n", scene->name);
+    printf("  \"runs\": %d,\n", SCALING_RUNS);
+    printf("  \"threads\": [\n");
+    for (threads = 1; threads <= max_threads; ++threads) {
+        jobs_fini();
+        jobs_init(threads);
+        time = time_median(scene->run_once);
+        if (threads == 1) {
+            base_time = time;
+        }
+        printf("    {\"threads\": %d, \"ms\": %.4f, \"speedup\": %.3f}%s\n",
+               threads, (double)time / 1e6, (double)base_time / (double)time,
+               threads < max_threads ? "," : "");
+        fflush(stdout);
+    }
+    printf("  ]\n");
+    printf("}\n");
+    fflush(stdout);
+
+    if (scene->fini) {
+        scene->fini();
+    }
+    jobs_fini();
+    jobs_init(max_threads);
+}
+
+/*
+ * Runs each variant the CPU supports, with the SIMD features limited to the
+ * ones it's meant to use, and reports its throughput and speedup over the
+ * first variant. The job system is restarted with one thread meanwhile, so
+ * that kernels which split their work between jobs run on this thread alone.
+ */
+static void run_kernels(const struct kernel_scene *scene)
+{
+    int max_threads = jobs_get_num_threads();
+    uint64_t base_time = 0, time;
+    bool first = true;
+    int i;
+
+    jobs_fini();
+    jobs_init(1);
+    if (scene->init) {
+        scene->init();
+    }
+
+    printf("{\n");
+    printf("  \"scene\": \"%s\",\n", scene->name);
+    printf("  \"%s_per_run\": %d,\n", scene->unit, scene->per_run);
+    printf("  \"runs\": %d,\n", SCALING_RUNS);
+    printf("  \"kernels\": [");
+    for (i = 0; i < scene->num_variants; ++i) {
+        if (!cpu_has(scene->variants[i].cpu_features)) {
+            continue;
+        }
+        cpu_set_feature_mask(scene->variants[i].cpu_features);
+        time = time_median(scene->variants[i].run_once);
+        cpu_set_feature_mask(CPU_FEATURE_ALL);
+        if (first) {
+            base_time = time;
+        }
+        printf("%s\n    {\"kernel\": \"%s\", \"ms\": %.4f, \"%s_per_sec\": %.0f, \"speedup\": %.3f}",
+               first ? "" : ",", scene->variants[i].name, (double)time / 1e6, scene->unit,
+               (double)scene->per_run * 1e9 / (double)time, (double)base_time / (double)time);
+        fflush(stdout);
+        first = false;
+    }
+    printf("\n  ]\n");
+    printf("}\n");
+    fflush(stdout);
+
+    if (scene->fini) {
+        scene->fini();
+    }
+    jobs_fini();
+    jobs_init(max_threads);
+}
+
+void benchmark_run(const char *scene_name, int num_frames)
+{
+    const struct scaling_scene *scaling_scene = find_scaling_scene(scene_name);
+    const struct kernel_scene *kernel_scene = find_kernel_scene(scene_name);
+    const struct scene *scene;
+    uint64_t *frame_times;
+    uint64_t subsystem_times[NUM_SUBSYSTEMS] = {0};
+    uint64_t total_time = 0;
+    uint64_t draw_calls = 0, vertices = 0, uniform_calls = 0;
+    uint64_t t0, t1, t2, t3;
+    struct mem_stats mem_start = MEM_STATS_INIT;
+    struct mem_stats mem_end;
+    SDL_Event event;
+    bool quit = false;
+    int frame, num_measured = 0;
+    int i;
+
+    if (scaling_scene) {
+        run_scaling(scaling_scene);
+        return;
+    }
+    if (kernel_scene) {
+        run_kernels(kernel_scene);
+        return;
+    }
+    scene = find_scene(scene_name);
+
+    DASSERT(num_frames > 0);
+    surface_size = video_get_surface_size();
+    create_atlas();
+    scene->init();
+    frame_times = mem_alloc_array((size_t)num_frames, sizeof(*frame_times));
+
+    for (frame = 0; frame < WARMUP_FRAMES + num_frames && !quit; ++frame) {
+        if (frame == WARMUP_FRAMES) {
+            mem_start = mem_get_stats();
+        }
+
+        t0 = system_get_time_ns();
+        while (SDL_PollEvent(&event)) {
+            if (event.type == SDL_QUIT) {
+                quit = true;
+            }
+        }
+        scene->update(frame);
+        t1 = system_get_time_ns();
+        texture_begin_frame();
+        render_begin_frame();
+        scene->render();
+        render_end_frame();
+        t2 = system_get_time_ns();
+        render_present();
+        render_finish();
+        t3 = system_get_time_ns();
+
+        if (frame < WARMUP_FRAMES) {
+            continue;
+        }
+        frame_times[num_measured++] = t3 - t0;
+        total_time += t3 - t0;
+        subsystem_times[SUBSYSTEM_UPDATE] += t1 - t0;
+        subsystem_times[SUBSYSTEM_RENDER] += t2 - t1;
+        subsystem_times[SUBSYSTEM_PRESENT] += t3 - t2;
+        draw_calls += gl_last_frame_stats.draw_calls;
+        vertices += gl_last_frame_stats.vertices;
+        uniform_calls += gl_last_frame_stats.uniform_calls;
+    }
+
+    if (!num_measured) {
+        FATAL("Benchmark was interrupted before any frames were measured");
+    }
+    qsort(frame_times, (size_t)num_measured, sizeof(*frame_times), compare_u64);
+
+    printf("{\n");
+    printf("  \"scene\": \"%s\",\n", scene->name);
+    printf("  \"frames\": %d,\n", num_measured);
+    printf("  \"warmup_frames\": %d,\n", WARMUP_FRAMES);
+    printf("  \"surface\": [%d, %d],\n", surface_size.x, surface_size.y);
+    printf("  \"frame_ms\": {\"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f},\n",
+           (double)total_time / 1e6 / num_measured,
+           get_percentile_ms(frame_times, num_measured, 50),
+           get_percentile_ms(frame_times, num_measured, 95),
+           get_percentile_ms(frame_times, num_measured, 99),
+           (double)frame_times[num_measured - 1] / 1e6);
+    printf("  \"cpu_ms_per_frame\": {");
+    for (i = 0; i < NUM_SUBSYSTEMS; ++i) {
+        printf("%s\"%s\": %.4f", i ? ", " : "", subsystem_names[i],
+               (double)subsystem_times[i] / 1e6 / num_measured);
+    }
+    printf("},\n");
+    printf("  \"draw_calls_per_frame\": %.1f,\n", (double)draw_calls / num_measured);
+    printf("  \"vertices_per_frame\": %.1f,\n", (double)vertices / num_measured);
+    printf("  \"uniform_calls_per_frame\": %.1f,\n", (double)uniform_calls / num_measured);
+    mem_end = mem_get_stats();
+    printf("  \"allocations\": {\"allocs\": %" PRIu64 ", \"reallocs\": %" PRIu64 ", \"frees\": %" PRIu64 "}\n",
+           mem_end.allocs - mem_start.allocs,
+           mem_end.reallocs - mem_start.reallocs,
+           mem_end.frees - mem_start.frees);
+    printf("}\n");
+    fflush(stdout);
+
+    mem_free(frame_times);
+    scene->fini();
+    texture_destroy(atlas);
+    atlas = NULL;
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2021 Marty Mills <daggerbot@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_BENCHMARK_H
+#define INCLUDED_BENCHMARK_H
+
+#include "types.h"
+
+/*
+ * Runs a deterministic scene for a number of frames as fast as possible, then
+ * prints frame time percentiles, CPU time per subsystem, draw calls and
+ * allocation counts to stdout as JSON. Every frame waits for the GPU to finish
+ * so that frame times include rendering. The first few frames are a warm-up
+ * and aren't counted.
+ *
+ * Scenes:
+ *   tilemap       - Scrolls diagonally across a large two-layer tilemap.
+ *   sprites       - 100000 moving sprites, split between the three sprite modes.
+ *   tilemap_array - Same as tilemap, with the tiles in a tileset (see tileset.h).
+ *   compressed    - Same as tilemap, with the atlas uploaded as DXT1 blocks.
+ *   indexed       - Same as tilemap, with the atlas as palette indices drawn
+ *                   with SPRITE_MODE_INDEXED, and a new palette every frame.
+ *   streaming     - Streams a new 1024x1024 image into a texture every frame,
+ *                   in bands filled by the job threads, and draws it.
+ *   packing       - Replaces 16 of 1024 images in a runtime atlas (see atlas.h)
+ *                   every frame and draws them all, compacting every 60 frames.
+ *
+ * Scaling scenes ignore num_frames, and instead time a CPU workload with 1 to
+ * N job threads, printing the median of a few runs and the speedup over 1:
+ *   jobs             - Hashing with jobs_parallel_for, then a deep fork/join job tree.
+ *   sprite_fill      - Fills a batch of 1000000 sprites, claiming a range per job.
+ *   pixconv_parallel - Premultiplies a 4096x4096 image, a band of rows per job.
+ *
+ * Kernel scenes ignore num_frames too, and compare the throughput of scalar
+ * and SIMD implementations of the same workload on one thread:
+ *   put_many      - Puts 1000000 sprites one at a time, then with put_many.
+ *   rgb_to_rgba, rgba_to_rgb, rgba_to_bgra, rgba_to_alpha, premultiply,
+ *   unpremultiply - Pixel format conversions of a 2048x2048 image.
+ */
+void benchmark_run(const char *scene_name, int num_frames);
+
+#endif /* INCLUDED_BENCHMARK_H */
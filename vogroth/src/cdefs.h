@@ -41,6 +41,23 @@
 /* STATIC_ASSERT: Single parameter static_assert. */
 #define STATIC_ASSERT(CONDITION) _Static_assert((CONDITION), #CONDITION)
 
+/*
+ * TARGET: Attribute for functions which use an instruction set extension, such
+ * as TARGET("avx2"). They must only be called after checking cpu_has.
+ */
+#ifdef __GNUC__
+# define TARGET(isa) __attribute__((__target__(isa)))
+#else
+# define TARGET(isa)
+#endif
+
+/* THREAD_LOCAL: Storage class for variables with one instance per thread. */
+#if defined(_MSC_VER) && !defined(__clang__)
+# define THREAD_LOCAL __declspec(thread)
+#else
+# define THREAD_LOCAL _Thread_local
+#endif
+
 /* UNUSED: Attribute which silences warnings about unused items. */
 #ifdef __GNUC__
 # define UNUSED __attribute__((__unused__))
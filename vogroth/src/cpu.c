@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2021 Marty Mills <daggerbot@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "cpu.h"
+#include "debug.h"
+
+#ifdef CPU_X86
+# ifdef _MSC_VER
+#  include <intrin.h>
+# else
+#  include <cpuid.h>
+# endif
+#endif
+
+static unsigned detected_features = 0;
+static unsigned feature_mask = CPU_FEATURE_ALL;
+
+#ifdef CPU_X86
+static void get_cpuid(unsigned leaf, unsigned subleaf, unsigned regs[4])
+{
+#ifdef _MSC_VER
+    int info[4];
+
+    __cpuidex(info, (int)leaf, (int)subleaf);
+    regs[0] = (unsigned)info[0];
+    regs[1] = (unsigned)info[1];
+    regs[2] = (unsigned)info[2];
+    regs[3] = (unsigned)info[3];
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+/* Checks that the OS saves the XMM and YMM registers on context switches. */
+static bool os_saves_ymm(void)
+{
+    uint32_t xcr0;
+
+#ifdef _MSC_VER
+    xcr0 = (uint32_t)_xgetbv(0);
+#else
+    uint32_t edx;
+
+    __asm__ ("xgetbv" : "=a"(xcr0), "=d"(edx) : "c"(0));
+    (void)edx;
+#endif
+    return (xcr0 & 0x6) == 0x6;
+}
+
+static unsigned detect_features(void)
+{
+    unsigned regs[4];
+    unsigned max_leaf;
+    unsigned features = 0;
+
+    get_cpuid(0, 0, regs);
+    max_leaf = regs[0];
+    if (max_leaf < 1) {
+        return 0;
+    }
+
+    get_cpuid(1, 0, regs);
+    if (regs[3] & (1u << 26)) {
+        features |= CPU_FEATURE_SSE2;
+    }
+    if (regs[2] & (1u << 9)) {
+        features |= CPU_FEATURE_SSSE3;
+    }
+    if (regs[2] & (1u << 19)) {
+        features |= CPU_FEATURE_SSE41;
+    }
+
+    /* AVX2 needs OSXSAVE and AVX before it's worth checking leaf 7 */
+    if (max_leaf >= 7 && (regs[2] & (1u << 27)) && (regs[2] & (1u << 28)) && os_saves_ymm()) {
+        get_cpuid(7, 0, regs);
+        if (regs[1] & (1u << 5)) {
+            features |= CPU_FEATURE_AVX2;
+        }
+    }
+    return features;
+}
+#else /* !defined(CPU_X86) */
+static unsigned detect_features(void)
+{
+    return 0;
+}
+#endif /* !defined(CPU_X86) */
+
+void cpu_init(void)
+{
+    unsigned i;
+
+    detected_features = detect_features();
+    for (i = 1; i & CPU_FEATURE_ALL; i <<= 1) {
+        if (detected_features & i) {
+            LOG_DEBUG("CPU supports %s", cpu_get_feature_name((enum cpu_feature)i));
+        }
+    }
+}
+
+unsigned cpu_get_features(void)
+{
+    return detected_features & feature_mask;
+}
+
+bool cpu_has(unsigned features)
+{
+    return (cpu_get_features() & features) == features;
+}
+
+void cpu_set_feature_mask(unsigned mask)
+{
+    feature_mask = mask;
+}
+
+const char *cpu_get_feature_name(enum cpu_feature feature)
+{
+    switch (feature) {
+    case CPU_FEATURE_SSE2:
+        return "sse2";
+    case CPU_FEATURE_SSSE3:
+        return "ssse3";
+    case CPU_FEATURE_SSE41:
+        return "sse4.1";
+    case CPU_FEATURE_AVX2:
+        return "avx2";
+    default:
+        return "unknown";
+    }
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2021 Marty Mills <daggerbot@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_CPU_H
+#define INCLUDED_CPU_H
+
+#include "types.h"
+
+/* CPU_X86: Defined when building for x86 or x86-64, where the SIMD kernels are available. */
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+# define CPU_X86 1
+#endif
+
+enum cpu_feature {
+    CPU_FEATURE_SSE2 = 1 << 0,
+    CPU_FEATURE_SSSE3 = 1 << 1,
+    CPU_FEATURE_SSE41 = 1 << 2,
+    CPU_FEATURE_AVX2 = 1 << 3, /* Only if the OS saves the YMM registers too */
+    CPU_FEATURE_ALL = (1 << 4) - 1,
+};
+
+/* Detects the CPU's features. Until this is called, no features are reported. */
+void cpu_init(void);
+
+/* Gets the detected features, limited by the mask. */
+unsigned cpu_get_features(void);
+bool cpu_has(unsigned features);
+
+/*
+ * Limits the features reported by cpu_get_features, so that benchmarks can
+ * compare the SIMD kernels with each other and with the scalar code. Must not
+ * be called while other threads may be using them.
+ */
+void cpu_set_feature_mask(unsigned mask);
+
+/* Gets a name for a single feature, like "avx2". */
+const char *cpu_get_feature_name(enum cpu_feature feature);
+
+#endif /* INCLUDED_CPU_H */
@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2021 Marty Mills <daggerbot@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "debug.h"
+#include "dxt.h"
+#include "jobs.h"
+#include "math.h"
+
+/* Images with fewer blocks than this aren't worth splitting between threads */
+#define PARALLEL_MIN_BLOCKS 4096
+
+bool dxt_is_format(enum pixel_format format)
+{
+    return format == PIXEL_FORMAT_DXT1 || format == PIXEL_FORMAT_DXT5;
+}
+
+int dxt_get_block_size(enum pixel_format format)
+{
+    switch (format) {
+    case PIXEL_FORMAT_DXT1:
+        return 8;
+    case PIXEL_FORMAT_DXT5:
+        return 16;
+    default:
+        FATAL("Not a DXT format: 0x%04" PRIx32, (uint32_t)format);
+    }
+}
+
+size_t dxt_get_image_size(enum pixel_format format, struct vec2i size)
+{
+    ASSERT(size.x > 0 && size.y > 0);
+    return (size_t)((size.x + 3) / 4) * (size_t)((size.y + 3) / 4) * (size_t)dxt_get_block_size(format);
+}
+
+static inline unsigned read_u16le(const uint8_t *p)
+{
+    return (unsigned)p[0] | (unsigned)p[1] << 8;
+}
+
+/* Expands an RGB565 color to RGBA8888, replicating the high bits into the low ones */
+static void unpack_565(unsigned color, uint8_t *out)
+{
+    unsigned r = (color >> 11) & 31, g = (color >> 5) & 63, b = color & 31;
+
+    out[0] = (uint8_t)((r << 3) | (r >> 2));
+    out[1] = (uint8_t)((g << 2) | (g >> 4));
+    out[2] = (uint8_t)((b << 3) | (b >> 2));
+    out[3] = 255;
+}
+
+/*
+ * Decodes the color part of a block into 16 RGBA pixels. In DXT1, a first
+ * endpoint which isn't greater than the second selects the 3-color mode,
+ * where index 3 is transparent black. DXT5 always uses the 4-color mode.
+ */
+static void decode_color_block(const uint8_t *block, bool allow_3_color, uint8_t out[16][4])
+{
+    unsigned c0 = read_u16le(block), c1 = read_u16le(block + 2);
+    uint32_t indices = (uint32_t)block[4] | (uint32_t)block[5] << 8 | (uint32_t)block[6] << 16
+                       | (uint32_t)block[7] << 24;
+    uint8_t palette[4][4];
+    int i;
+
+    unpack_565(c0, palette[0]);
+    unpack_565(c1, palette[1]);
+    if (c0 > c1 || !allow_3_color) {
+        for (i = 0; i < 3; ++i) {
+            palette[2][i] = (uint8_t)((2 * palette[0][i] + palette[1][i] + 1) / 3);
+            palette[3][i] = (uint8_t)((palette[0][i] + 2 * palette[1][i] + 1) / 3);
+        }
+        palette[2][3] = palette[3][3] = 255;
+    } else {
+        for (i = 0; i < 3; ++i) {
+            palette[2][i] = (uint8_t)((palette[0][i] + palette[1][i]) / 2);
+        }
+        palette[2][3] = 255;
+        memset(palette[3], 0, sizeof(palette[3]));
+    }
+
+    for (i = 0; i < 16; ++i) {
+        memcpy(out[i], palette[(indices >> (2 * i)) & 3], 4);
+    }
+}
+
+/* Decodes the alpha part of a DXT5 block into the pixels' alpha channels */
+static void decode_alpha_block(const uint8_t *block, uint8_t out[16][4])
+{
+    unsigned a0 = block[0], a1 = block[1];
+    uint64_t indices = 0;
+    uint8_t palette[8];
+    int i;
+
+    palette[0] = (uint8_t)a0;
+    palette[1] = (uint8_t)a1;
+    if (a0 > a1) {
+        for (i = 1; i < 7; ++i) {
+            palette[i + 1] = (uint8_t)(((7 - (unsigned)i) * a0 + (unsigned)i * a1 + 3) / 7);
+        }
+    } else {
+        for (i = 1; i < 5; ++i) {
+            palette[i + 1] = (uint8_t)(((5 - (unsigned)i) * a0 + (unsigned)i * a1 + 2) / 5);
+        }
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+
+    for (i = 0; i < 6; ++i) {
+        indices |= (uint64_t)block[2 + i] << (8 * i);
+    }
+    for (i = 0; i < 16; ++i) {
+        out[i][3] = palette[(indices >> (3 * i)) & 7];
+    }
+}
+
+struct decompression {
+    enum pixel_format format;
+    struct vec2i size;
+    const uint8_t *blocks;
+    const struct pixbuf *out;
+};
+
+static void decompress_block_rows(void *data, int begin, int end)
+{
+    const struct decompression *job = data;
+    int block_size = dxt_get_block_size(job->format);
+    int blocks_per_row = (job->size.x + 3) / 4;
+    const uint8_t *block;
+    uint8_t pixels[16][4];
+    int by, bx, y, width;
+
+    for (by = begin; by < end; ++by) {
+        block = job->blocks + (size_t)by * (size_t)blocks_per_row * (size_t)block_size;
+        for (bx = 0; bx < blocks_per_row; ++bx, block += block_size) {
+            if (job->format == PIXEL_FORMAT_DXT5) {
+                decode_color_block(block + 8, false, pixels);
+                decode_alpha_block(block, pixels);
+            } else {
+                decode_color_block(block, true, pixels);
+            }
+
+            /* Blocks at the right and bottom edges may stick out of the image */
+            width = min_int(4, job->size.x - 4 * bx);
+            for (y = 0; y < 4 && 4 * by + y < job->size.y; ++y) {
+                memcpy(pixbuf_get_row(job->out, 4 * by + y) + 16 * bx, pixels[4 * y], (size_t)width * 4);
+            }
+        }
+    }
+}
+
+void dxt_decompress(enum pixel_format format, struct vec2i size, const uint8_t *blocks, struct pixbuf *out)
+{
+    struct decompression job = {format, size, blocks, out};
+    int num_block_rows = (size.y + 3) / 4;
+
+    DASSERT(blocks && out);
+    ASSERT(dxt_is_format(format));
+    out->size = size;
+    out->format = PIXEL_FORMAT_RGBA_8888;
+    pixbuf_alloc(out);
+
+    if ((int64_t)num_block_rows * ((size.x + 3) / 4) >= PARALLEL_MIN_BLOCKS && jobs_get_num_threads() > 1) {
+        jobs_parallel_for(num_block_rows, 0, &decompress_block_rows, &job);
+    } else {
+        decompress_block_rows(&job, 0, num_block_rows);
+    }
+}
@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) 2021 Marty Mills <daggerbot@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_DXT_H
+#define INCLUDED_DXT_H
+
+#include "pixbuf.h"
+
+/*
+ * S3TC (DXT) block compressed images, which are stored as rows of 4x4 pixel
+ * blocks, left to right and top to bottom. DXT1 blocks are 8 bytes, with
+ * 1-bit alpha. DXT5 blocks are 16 bytes, with interpolated 8-bit alpha.
+ */
+
+bool dxt_is_format(enum pixel_format format);
+int dxt_get_block_size(enum pixel_format format);
+/* Gets the size of an image of the given size in pixels, which is rounded up to whole blocks. */
+size_t dxt_get_image_size(enum pixel_format format, struct vec2i size);
+
+/*
+ * Decompresses an image to RGBA_8888 for when the GL can't use it directly.
+ * out->row_pitch is used if it's set, and out is resized and reallocated.
+ * Large images are decompressed in parallel by the job system.
+ */
+void dxt_decompress(enum pixel_format format, struct vec2i size, const uint8_t *blocks, struct pixbuf *out);
+
+#endif /* INCLUDED_DXT_H */
@@ -15,9 +15,11 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 
 #include "debug.h"
 #include "gl_api.h"
+#include "gl_trace.h"
 #include "video.h"
 
 /*
@@ -27,8 +29,11 @@
     RETURN(GLAPIENTRY *pgl##NAME)(__VA_ARGS__) = NULL; \
     STATIC_ASSERT(sizeof(pgl##NAME) == sizeof(void *));
 FOREACH_GL_FUNCTION(DO)
+FOREACH_GL_OPTIONAL_FUNCTION(DO)
 #undef DO
 
+struct gl_caps gl_caps = {0};
+
 /*
  * Make a list of the 'pgl' OpenGL API functions. This allows us to work with
  * them in a loop which should result in smaller and faster generated code.
@@ -44,6 +49,12 @@ static const struct symdef symdefs[] = {
 #undef DO
 };
 
+static const struct symdef optional_symdefs[] = {
+#define DO(RETURN, NAME, ...) {"gl" #NAME, (void **)&pgl##NAME},
+    FOREACH_GL_OPTIONAL_FUNCTION(DO)
+#undef DO
+};
+
 static void *require_proc_address(const char *name)
 {
     void *sym;
@@ -55,6 +66,10 @@ static void *require_proc_address(const char *name)
     return sym;
 }
 
+/* Version of the context, set by check_version */
+static int major_version;
+static int minor_version;
+
 static void check_version(void)
 {
     const char *verstr;
@@ -74,6 +89,8 @@ static void check_version(void)
         FATAL("Unsupported OpenGL version: %s; need at least %d.%d",
               verstr, RENDER_GL_MAJOR_VERSION, RENDER_GL_MINOR_VERSION);
     }
+    major_version = major;
+    minor_version = minor;
     LOG_DEBUG("OpenGL %s", verstr);
 }
 
@@ -84,6 +101,58 @@ static void load_functions(void)
     for (i = 0; i < LENGTHOF(symdefs); ++i) {
         *symdefs[i].ptr = require_proc_address(symdefs[i].name);
     }
+    for (i = 0; i < LENGTHOF(optional_symdefs); ++i) {
+        *optional_symdefs[i].ptr = video_gl_get_proc_address(optional_symdefs[i].name);
+    }
+}
+
+static void detect_caps(void)
+{
+    GLint num_formats = 0;
+
+    if (gl_has_extension("GL_ARB_get_program_binary")
+        && pglGetProgramBinary && pglProgramBinary && pglProgramParameteri)
+    {
+        pglGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+        gl_caps.program_binary = num_formats > 0;
+    }
+    if ((major_version >= 3 || gl_has_extension("GL_ARB_vertex_array_object"))
+        && pglBindVertexArray && pglDeleteVertexArrays && pglGenVertexArrays)
+    {
+        gl_caps.vertex_array_object = true;
+    }
+    if ((major_version >= 3 || gl_has_extension("GL_ARB_framebuffer_object"))
+        && pglBindFramebuffer && pglCheckFramebufferStatus && pglDeleteFramebuffers
+        && pglFramebufferTexture2D && pglGenFramebuffers && pglBindRenderbuffer
+        && pglDeleteRenderbuffers && pglFramebufferRenderbuffer && pglGenRenderbuffers
+        && pglRenderbufferStorage)
+    {
+        gl_caps.framebuffer_object = true;
+    }
+    /* Core since OpenGL 1.1 */
+    gl_caps.unpack_row_length = true;
+    gl_caps.pixel_buffer_object = major_version >= 3 || minor_version >= 1
+                                  || gl_has_extension("GL_ARB_pixel_buffer_object");
+    if ((major_version >= 3 || gl_has_extension("GL_ARB_map_buffer_range")) && pglMapBufferRange) {
+        gl_caps.map_buffer_range = true;
+    }
+    if ((major_version > 3 || (major_version == 3 && minor_version >= 2) || gl_has_extension("GL_ARB_sync"))
+        && pglClientWaitSync && pglDeleteSync && pglFenceSync)
+    {
+        gl_caps.sync = true;
+    }
+    gl_caps.texture_compression_s3tc = gl_has_extension("GL_EXT_texture_compression_s3tc");
+    if (gl_has_extension("GL_EXT_texture_array") && pglTexImage3D && pglTexSubImage3D) {
+        pglGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &gl_caps.max_texture_layers);
+        gl_caps.texture_array = gl_caps.max_texture_layers > 0;
+    }
+    if (gl_has_extension("GL_ARB_timer_query")) {
+        gl_caps.timer_query = pglGetQueryObjectui64v != NULL;
+    } else if (gl_has_extension("GL_EXT_timer_query")) {
+        /* The EXT version only differs by the suffix on this one function */
+        *(void **)&pglGetQueryObjectui64v = video_gl_get_proc_address("glGetQueryObjectui64vEXT");
+        gl_caps.timer_query = pglGetQueryObjectui64v != NULL;
+    }
 }
 
 /*
@@ -98,19 +167,45 @@ static void unload_functions(void)
     for (i = 0; i < LENGTHOF(symdefs); ++i) {
         *symdefs[i].ptr = NULL;
     }
+    for (i = 0; i < LENGTHOF(optional_symdefs); ++i) {
+        *optional_symdefs[i].ptr = NULL;
+    }
+    gl_caps = (struct gl_caps){0};
+    major_version = 0;
+    minor_version = 0;
 }
 
 void gl_init_api(void)
 {
     check_version();
     load_functions();
+    gl_trace_init();
+    detect_caps();
 }
 
 void gl_fini_api(void)
 {
+    gl_trace_fini();
     unload_functions();
 }
 
+bool gl_has_extension(const char *name)
+{
+    const char *exts = pglGetString(GL_EXTENSIONS);
+    size_t len = strlen(name);
+    const char *p;
+
+    if (!exts) {
+        return false;
+    }
+    for (p = exts; (p = strstr(p, name)); p += len) {
+        if ((p == exts || p[-1] == ' ') && (p[len] == ' ' || !p[len])) {
+            return true;
+        }
+    }
+    return false;
+}
+
 const char *gl_strerror(GLenum errcode)
 {
     static char buf[32] = {0};
@@ -46,10 +46,40 @@
 /* Texture unit indices */
 #define RENDER_GL_TEXTURE_UNIT_MANAGER 0
 #define RENDER_GL_TEXTURE_UNIT_TEXTURE 1
+#define RENDER_GL_TEXTURE_UNIT_PALETTE 2
+
+/*
+ * Vertex attribute locations. These are bound before linking so that every
+ * program agrees on them, which lets a vertex array object work with any
+ * program.
+ */
+#define RENDER_GL_ATTRIB_POSITION 0
+#define RENDER_GL_ATTRIB_TEXTURE_COORD 1
+#define RENDER_GL_ATTRIB_COLOR 2
+
+/*
+ * Optional features which were detected by gl_init_api.
+ */
+struct gl_caps {
+    bool program_binary; /* GL_ARB_get_program_binary */
+    bool vertex_array_object; /* GL_ARB_vertex_array_object or OpenGL 3.0 */
+    bool timer_query; /* GL_ARB_timer_query or GL_EXT_timer_query */
+    bool framebuffer_object; /* GL_ARB_framebuffer_object or OpenGL 3.0 */
+    bool unpack_row_length; /* GL_UNPACK_ROW_LENGTH, which OpenGL ES 2.0 lacks without GL_EXT_unpack_subimage */
+    bool pixel_buffer_object; /* GL_ARB_pixel_buffer_object or OpenGL 2.1 */
+    bool map_buffer_range; /* GL_ARB_map_buffer_range or OpenGL 3.0 */
+    bool sync; /* GL_ARB_sync or OpenGL 3.2 */
+    bool texture_compression_s3tc; /* GL_EXT_texture_compression_s3tc */
+    bool texture_array; /* GL_EXT_texture_array, which the GLSL 1.10 shaders need for sampler2DArray */
+    int max_texture_layers; /* GL_MAX_ARRAY_TEXTURE_LAYERS if texture_array */
+};
 
 void gl_init_api(void);
 void gl_fini_api(void);
 
+/* Checks whether the current context supports the named extension. */
+bool gl_has_extension(const char *name);
+
 /*
  * Gets a string describing an OpenGL error code. Subsequent calls may
  * invalidate the previously returned string. Not thread-safe. This is okay as
@@ -69,34 +99,54 @@ void gl_flush_errors(void);
 #define FOREACH_GL_FUNCTION(x) \
     x(void, ActiveTexture, GLenum) \
     x(void, AttachShader, GLuint, GLuint) \
+    x(void, BeginQuery, GLenum, GLuint) \
+    x(void, BindAttribLocation, GLuint, GLuint, const GLchar *) \
+    x(void, BindBuffer, GLenum, GLuint) \
     x(void, BindTexture, GLenum, GLuint) \
+    x(void, BufferData, GLenum, GLsizeiptr, const GLvoid *, GLenum) \
     x(void, Clear, GLbitfield) \
     x(void, ClearColor, GLclampf, GLclampf, GLclampf, GLclampf) \
     x(void, CompileShader, GLuint) \
+    x(void, CompressedTexImage2D, GLenum, GLint, GLenum, GLsizei, GLsizei, GLint, GLsizei, const GLvoid *) \
     x(GLuint, CreateProgram, void) \
     x(GLuint, CreateShader, GLenum) \
+    x(void, DeleteBuffers, GLsizei, const GLuint *) \
     x(void, DeleteProgram, GLuint) \
+    x(void, DeleteQueries, GLsizei, const GLuint *) \
     x(void, DeleteShader, GLuint) \
     x(void, DeleteTextures, GLsizei, const GLuint *) \
+    x(void, DepthFunc, GLenum) \
+    x(void, DepthMask, GLboolean) \
     x(void, Disable, GLenum) \
     x(void, DisableVertexAttribArray, GLuint) \
     x(void, DrawArrays, GLenum, GLint, GLsizei) \
     x(void, Enable, GLenum) \
     x(void, EnableVertexAttribArray, GLuint) \
+    x(void, EndQuery, GLenum) \
+    x(void, Finish, void) \
+    x(void, GenBuffers, GLsizei, GLuint *) \
+    x(void, GenQueries, GLsizei, GLuint *) \
     x(void, GenTextures, GLsizei, GLuint *) \
     x(GLint, GetAttribLocation, GLuint, const GLchar *) \
     x(GLenum, GetError, void) \
+    x(void, GetIntegerv, GLenum, GLint *) \
     x(void, GetProgramiv, GLuint, GLenum, GLint *) \
     x(void, GetProgramInfoLog, GLuint, GLsizei, GLsizei *, GLchar *) \
+    x(void, GetQueryObjectiv, GLuint, GLenum, GLint *) \
     x(void, GetShaderiv, GLuint, GLenum, GLint *) \
     x(void, GetShaderInfoLog, GLuint, GLsizei, GLsizei *, GLchar *) \
     x(const GLchar *, GetString, GLenum) \
     x(GLint, GetUniformLocation, GLuint, const GLchar *) \
     x(void, LinkProgram, GLuint) \
+    x(GLvoid *, MapBuffer, GLenum, GLenum) \
+    x(void, PixelStorei, GLenum, GLint) \
+    x(void, ReadPixels, GLint, GLint, GLsizei, GLsizei, GLenum, GLenum, GLvoid *) \
     x(void, ShaderSource, GLuint, GLsizei, const GLchar **, const GLint *) \
     x(void, TexImage2D, GLenum, GLint, GLint, GLsizei, GLsizei, GLint, GLenum, GLenum, const GLvoid *) \
     x(void, TexParameteri, GLenum, GLenum, GLint) \
     x(void, TexSubImage2D, GLenum, GLint, GLint, GLint, GLsizei, GLsizei, GLenum, GLenum, const GLvoid *) \
+    x(GLboolean, UnmapBuffer, GLenum) \
+    x(void, Uniform1f, GLint, GLfloat) \
     x(void, Uniform1i, GLint, GLint) \
     x(void, Uniform2f, GLint, GLfloat, GLfloat) \
     x(void, UniformMatrix4fv, GLint, GLsizei, GLboolean, const GLfloat *) \
@@ -104,12 +154,46 @@ void gl_flush_errors(void);
     x(void, VertexAttribPointer, GLuint, GLint, GLenum, GLboolean, GLsizei, const GLvoid *) \
     x(void, Viewport, GLint, GLint, GLsizei, GLsizei)
 
+/*
+ * Like FOREACH_GL_FUNCTION, but for functions provided by extensions. These
+ * are null if the driver doesn't provide them, so check gl_caps before using
+ * them.
+ */
+#define FOREACH_GL_OPTIONAL_FUNCTION(x) \
+    x(void, BindFramebuffer, GLenum, GLuint) \
+    x(void, BindRenderbuffer, GLenum, GLuint) \
+    x(void, BindVertexArray, GLuint) \
+    x(GLenum, CheckFramebufferStatus, GLenum) \
+    x(GLenum, ClientWaitSync, GLsync, GLbitfield, GLuint64) \
+    x(void, DeleteFramebuffers, GLsizei, const GLuint *) \
+    x(void, DeleteRenderbuffers, GLsizei, const GLuint *) \
+    x(void, DeleteSync, GLsync) \
+    x(void, DeleteVertexArrays, GLsizei, const GLuint *) \
+    x(GLsync, FenceSync, GLenum, GLbitfield) \
+    x(void, FramebufferRenderbuffer, GLenum, GLenum, GLenum, GLuint) \
+    x(void, FramebufferTexture2D, GLenum, GLenum, GLenum, GLuint, GLint) \
+    x(void, GenFramebuffers, GLsizei, GLuint *) \
+    x(void, GenRenderbuffers, GLsizei, GLuint *) \
+    x(void, GenVertexArrays, GLsizei, GLuint *) \
+    x(void, GetProgramBinary, GLuint, GLsizei, GLsizei *, GLenum *, GLvoid *) \
+    x(void, GetQueryObjectui64v, GLuint, GLenum, GLuint64 *) \
+    x(GLvoid *, MapBufferRange, GLenum, GLintptr, GLsizeiptr, GLbitfield) \
+    x(void, ProgramBinary, GLuint, GLenum, const GLvoid *, GLsizei) \
+    x(void, ProgramParameteri, GLuint, GLenum, GLint) \
+    x(void, RenderbufferStorage, GLenum, GLenum, GLsizei, GLsizei) \
+    x(void, TexImage3D, GLenum, GLint, GLint, GLsizei, GLsizei, GLsizei, GLint, GLenum, GLenum, const GLvoid *) \
+    x(void, TexSubImage3D, GLenum, GLint, GLint, GLint, GLint, GLsizei, GLsizei, GLsizei, GLenum, GLenum, \
+      const GLvoid *)
+
 /*
  * Declare the above API functions as function pointers with the 'pgl' prefix
  * instead of 'gl' to avoid name conflicts.
  */
 #define DO(RETURN, NAME, ...) extern RETURN(GLAPIENTRY *pgl##NAME)(__VA_ARGS__);
 FOREACH_GL_FUNCTION(DO)
+FOREACH_GL_OPTIONAL_FUNCTION(DO)
 #undef DO
 
+extern struct gl_caps gl_caps;
+
 #endif /* INCLUDED_GL_API_H */
@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2021 Marty Mills <daggerbot@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+
+#include "debug.h"
+#include "gl_api.h"
+#include "gl_cache.h"
+#include "hash.h"
+#include "memory.h"
+#include "rw.h"
+#include "system.h"
+
+#define CACHE_MAGIC 0x42504756 /* "VGPB" */
+#define CACHE_VERSION 1
+#define MAX_BINARY_SIZE (16*MiB)
+
+struct cache_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint32_t format;
+    uint32_t length;
+};
+
+static bool cache_enabled = false;
+static uint64_t driver_hash = 0;
+
+void gl_init_program_cache(void)
+{
+    cache_enabled = gl_caps.program_binary && system_get_cache_dir();
+    if (!cache_enabled) {
+        return;
+    }
+
+    driver_hash = hash_str(HASH_INIT, pglGetString(GL_VENDOR));
+    driver_hash = hash_str(driver_hash, pglGetString(GL_RENDERER));
+    driver_hash = hash_str(driver_hash, pglGetString(GL_VERSION));
+}
+
+void gl_fini_program_cache(void)
+{
+    cache_enabled = false;
+    driver_hash = 0;
+}
+
+static uint64_t get_key(uint64_t source_hash)
+{
+    return hash_bytes(driver_hash, sizeof(source_hash), &source_hash);
+}
+
+static char *get_path(uint64_t key)
+{
+    return str_printf("%s/program-%016" PRIx64 ".bin", system_get_cache_dir(), key);
+}
+
+bool gl_program_cache_load(GLuint program, uint64_t source_hash)
+{
+    uint64_t key;
+    char *path;
+    struct rw *rw;
+    struct cache_header header;
+    void *binary = NULL;
+    GLint status = GL_FALSE;
+
+    if (!cache_enabled) {
+        return false;
+    }
+    key = get_key(source_hash);
+    path = get_path(key);
+    rw = rw_fopen(path, "rb", NULL);
+    mem_free(path);
+    if (!rw) {
+        return false;
+    }
+
+    if (rw_read_all(rw, sizeof(header), &header) == sizeof(header)
+        && header.magic == CACHE_MAGIC && header.version == CACHE_VERSION
+        && header.key == key && header.length && header.length <= MAX_BINARY_SIZE)
+    {
+        binary = mem_alloc(header.length);
+        if (rw_read_all(rw, header.length, binary) == header.length) {
+            gl_flush_errors();
+            pglProgramBinary(program, header.format, binary, (GLsizei)header.length);
+            pglGetProgramiv(program, GL_LINK_STATUS, &status);
+
+            /* Drivers may reject binaries for any reason, which isn't an error. */
+            while (pglGetError() != GL_NO_ERROR) {
+                status = GL_FALSE;
+            }
+        }
+        mem_free(binary);
+    }
+
+    rw_close(rw, NULL);
+    return status == GL_TRUE;
+}
+
+/*
+ * Writes the file under a temporary name and then renames it, so that a crash
+ * partway through can't leave a truncated binary in the cache.
+ */
+void gl_program_cache_store(GLuint program, uint64_t source_hash)
+{
+    char *path, *temp_path;
+    char *err = NULL;
+    struct rw *rw;
+    struct cache_header header;
+    GLint length = 0;
+    GLenum format = 0;
+    void *binary;
+
+    if (!cache_enabled) {
+        return;
+    }
+
+    gl_flush_errors();
+    pglGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0 || length > MAX_BINARY_SIZE) {
+        return;
+    }
+    binary = mem_alloc((size_t)length);
+    pglGetProgramBinary(program, length, &length, &format, binary);
+    if (pglGetError() != GL_NO_ERROR || length <= 0) {
+        mem_free(binary);
+        return;
+    }
+
+    header = (struct cache_header) {
+        .magic = CACHE_MAGIC,
+        .version = CACHE_VERSION,
+        .key = get_key(source_hash),
+        .format = format,
+        .length = (uint32_t)length,
+    };
+
+    path = get_path(header.key);
+    temp_path = str_printf("%s.tmp", path);
+    rw = rw_fopen(temp_path, "wb", NULL);
+    if (rw) {
+        /* A partly written entry is deleted, rather than left in the cache directory */
+        if (rw_write(rw, sizeof(header), &header) != sizeof(header)
+            || rw_write(rw, (size_t)length, binary) != (size_t)length)
+        {
+            LOG_WARNING("%s: %s", temp_path, rw->error);
+            rw_close(rw, NULL);
+            remove(temp_path);
+        } else if (rw_close(rw, &err) || !system_replace_file(temp_path, path, &err)) {
+            LOG_WARNING("%s: %s", temp_path, err);
+            mem_free(err);
+            remove(temp_path);
+        }
+    }
+    mem_free(temp_path);
+    mem_free(path);
+    mem_free(binary);
+}
@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) 2021 Marty Mills <daggerbot@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_GL_CACHE_H
+#define INCLUDED_GL_CACHE_H
+
+#include "gl_types.h"
+
+/*
+ * On-disk cache of linked program binaries (GL_ARB_get_program_binary). Keys
+ * are hashes of the program's sources, which are combined with the GL vendor,
+ * renderer and version strings so that a driver update invalidates the cache.
+ * Every function silently does nothing if the cache is unavailable.
+ */
+void gl_init_program_cache(void);
+void gl_fini_program_cache(void);
+
+/*
+ * Tries to load a program binary into the program object. Returns true if the
+ * program was successfully linked from the cache.
+ */
+bool gl_program_cache_load(GLuint program, uint64_t source_hash);
+
+/* Saves the binary of a successfully linked program. */
+void gl_program_cache_store(GLuint program, uint64_t source_hash);
+
+#endif /* INCLUDED_GL_CACHE_H */
@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2021 Marty Mills <daggerbot@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "debug.h"
+#include "gl_api.h"
+#include "gl_framebuffer.h"
+#include "memory.h"
+#include "pixbuf.h"
+
+static GLuint framebuffer = 0;
+static GLuint color_texture = 0;
+static GLuint depth_renderbuffer = 0;
+
+void gl_init_offscreen(struct vec2i size, bool depth)
+{
+    GLenum status;
+
+    if (framebuffer) {
+        return;
+    }
+    if (!gl_caps.framebuffer_object) {
+        LOG_WARNING("Framebuffer objects are not supported; rendering to a hidden window instead");
+        return;
+    }
+
+    /*
+     * The color attachment is created directly rather than with
+     * texture_create(), so it is never evicted and doesn't count toward the
+     * texture budget.
+     */
+    pglGenTextures(1, &color_texture);
+    if (!color_texture) {
+        FATAL("glGenTextures: %s", gl_strerror(pglGetError()));
+    }
+    pglActiveTexture(GL_TEXTURE0 + RENDER_GL_TEXTURE_UNIT_MANAGER);
+    pglBindTexture(GL_TEXTURE_2D, color_texture);
+    pglTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, size.x, size.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    pglTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    pglTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    pglTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+
+    pglGenFramebuffers(1, &framebuffer);
+    pglBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    pglFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color_texture, 0);
+    if (depth) {
+        pglGenRenderbuffers(1, &depth_renderbuffer);
+        pglBindRenderbuffer(GL_RENDERBUFFER, depth_renderbuffer);
+        pglRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, size.x, size.y);
+        pglBindRenderbuffer(GL_RENDERBUFFER, 0);
+        pglFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth_renderbuffer);
+    }
+    status = pglCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        FATAL("Offscreen framebuffer is incomplete: 0x%04" PRIX32, (uint32_t)status);
+    }
+    LOG_DEBUG("Rendering offscreen at %dx%d", size.x, size.y);
+}
+
+void gl_fini_offscreen(void)
+{
+    if (framebuffer && pglDeleteFramebuffers) {
+        pglBindFramebuffer(GL_FRAMEBUFFER, 0);
+        pglDeleteFramebuffers(1, &framebuffer);
+    }
+    framebuffer = 0;
+    if (depth_renderbuffer && pglDeleteRenderbuffers) {
+        pglDeleteRenderbuffers(1, &depth_renderbuffer);
+    }
+    depth_renderbuffer = 0;
+    if (color_texture && pglDeleteTextures) {
+        pglDeleteTextures(1, &color_texture);
+    }
+    color_texture = 0;
+}
+
+void gl_read_frame(struct vec2i size, struct pixbuf *out)
+{
+    uint8_t *row;
+    uint8_t *top, *bottom;
+    size_t row_size;
+    GLenum errcode;
+
+    DASSERT(out != NULL);
+    pixbuf_fini(out);
+    out->size = size;
+    out->format = PIXEL_FORMAT_RGB_888;
+    pixbuf_alloc(out);
+
+    /* The default GL_PACK_ALIGNMENT of 4 matches the ideal row pitch. */
+    gl_flush_errors();
+    pglReadPixels(0, 0, size.x, size.y, GL_RGB, GL_UNSIGNED_BYTE, out->buf);
+    if ((errcode = pglGetError()) != GL_NO_ERROR) {
+        FATAL("Reading frame failed: %s", gl_strerror(errcode));
+    }
+
+    /* OpenGL returns the bottom row first */
+    row_size = (size_t)out->row_pitch;
+    row = mem_alloc(row_size);
+    top = out->buf;
+    bottom = out->buf + (size_t)(size.y - 1) * row_size;
+    while (top < bottom) {
+        memcpy(row, top, row_size);
+        memcpy(top, bottom, row_size);
+        memcpy(bottom, row, row_size);
+        top += row_size;
+        bottom -= row_size;
+    }
+    mem_free(row);
+}
@@ -0,0 +1,37 @@
+/*
+ * Copyright (c) 2021 Marty Mills <daggerbot@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_GL_FRAMEBUFFER_H
+#define INCLUDED_GL_FRAMEBUFFER_H
+
+#include "gl_types.h"
+
+/*
+ * Offscreen render target for headless mode. If framebuffer objects aren't
+ * supported, rendering goes to the (hidden) window's back buffer instead,
+ * which works just as well as long as the buffers are never swapped. A depth
+ * buffer is only attached if depth is true.
+ */
+void gl_init_offscreen(struct vec2i size, bool depth);
+void gl_fini_offscreen(void);
+
+/*
+ * Reads back the current contents of the render target as RGB with rows in
+ * top-to-bottom order. This waits for rendering to finish.
+ */
+void gl_read_frame(struct vec2i size, struct pixbuf *out);
+
+#endif /* INCLUDED_GL_FRAMEBUFFER_H */
@@ -14,51 +14,130 @@
  * this program. If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <string.h>
+
 #include "assets.h"
 #include "debug.h"
 #include "gl_api.h"
+#include "gl_cache.h"
 #include "gl_shaders.h"
 #include "gl_state.h"
+#include "hash.h"
+#include "hotreload.h"
 #include "memory.h"
+#include "render.h"
+#include "system.h"
+
+#define SPRITES_VERT_NAME "shaders/glsl110/sprites.vert"
+#define SPRITES_FRAG_NAME "shaders/glsl110/sprites.frag"
+
+/* Preprocessor symbols for each gl_sprite_feature bit, in bit order */
+static const char *const sprite_feature_names[GL_SPRITE_NUM_FEATURES] = {
+    "TEXTURE_RGB",
+    "TEXTURE_ALPHA",
+    "TEXTURE_INDEXED",
+    "TEXTURE_ARRAY",
+    "OPAQUE",
+};
 
-struct gl_program gl_program_alpha_sprites = RENDER_GL_PROGRAM_INIT;
-struct gl_program gl_program_rgb_sprites = RENDER_GL_PROGRAM_INIT;
-struct gl_program gl_program_rgba_sprites = RENDER_GL_PROGRAM_INIT;
+/* Vertex attribute locations, which are bound before linking */
+static const struct {
+    GLuint index;
+    const char *name;
+} sprite_attribs[] = {
+    {RENDER_GL_ATTRIB_POSITION, "attr_Position"},
+    {RENDER_GL_ATTRIB_TEXTURE_COORD, "attr_TextureCoord"},
+    {RENDER_GL_ATTRIB_COLOR, "attr_Color"},
+};
 
-static GLuint load_shader(const char *name, GLenum type)
+/*
+ * Sprite program variants indexed by feature flags. Variants with an id of 0
+ * haven't been built yet.
+ */
+static struct gl_program sprite_programs[GL_SPRITE_NUM_VARIANTS];
+
+/* Shader sources are kept in memory so that variants can be built at any time. */
+static struct buf sprites_vert_src = BUF_INIT;
+static struct buf sprites_frag_src = BUF_INIT;
+
+/* Totals for the log, which compare cold starts with warm ones */
+static unsigned num_programs_built = 0;
+static unsigned num_programs_cached = 0;
+static uint64_t program_build_time = 0;
+
+static bool load_source(const char *name, struct buf *src, char **out_err)
 {
     char *err = NULL;
     struct rw *rw;
-    struct buf src = BUF_INIT;
-    const GLchar *src_ptr;
-    GLint src_len;
-    GLuint id;
-    GLint status = GL_FALSE;
-    GLint info_log_len = 0;
-    char *info_log;
-    GLenum errcode;
 
-    gl_flush_errors();
-
-    /* Load shader source */
     rw = assets_open(name, &err);
     if (!rw) {
-        FATAL("%s: %s", name, err);
+        str_putf(out_err, "%s: %s", name, err);
+        mem_free(err);
+        return false;
     }
-    rw_read_to_buf(rw, 1*MiB, &src);
+    rw_read_to_buf(rw, 1*MiB, src);
     if (rw->error) {
-        FATAL("%s: %s", name, rw->error);
+        str_putf(out_err, "%s: %s", name, rw->error);
+        rw_close(rw, NULL);
+        return false;
     }
     rw_close(rw, NULL);
-    src_ptr = src.data;
-    src_len = (GLint)src.len;
+    return true;
+}
+
+/*
+ * Returns the offset just past the #version line, or 0 if there isn't one.
+ */
+static size_t find_preamble_offset(const struct buf *src)
+{
+    const char *line = src->data;
+    const char *end = src->data + src->len;
+    const char *eol;
+
+    while (line && line < end) {
+        eol = memchr(line, '\n', (size_t)(end - line));
+        if ((size_t)(end - line) >= 8 && !memcmp(line, "#version", 8)) {
+            return eol ? (size_t)(eol + 1 - src->data) : src->len;
+        }
+        line = eol ? eol + 1 : NULL;
+    }
+    return 0;
+}
+
+/*
+ * Compiles a shader from source with the preamble inserted after the #version
+ * directive, which has to come first. Returns 0 and sets *out_err on failure.
+ * Line numbers in error messages are offset by the number of lines in the
+ * preamble.
+ */
+static GLuint compile_shader(const char *name, GLenum type, const struct buf *src, const char *preamble,
+                             char **out_err)
+{
+    const GLchar *src_ptrs[3];
+    GLint src_lens[3];
+    size_t split;
+    GLuint id;
+    GLint status = GL_FALSE;
+    GLint info_log_len = 0;
+    char *info_log;
+    GLenum errcode;
+
+    split = find_preamble_offset(src);
+    src_ptrs[0] = src->data;
+    src_lens[0] = (GLint)split;
+    src_ptrs[1] = preamble;
+    src_lens[1] = (GLint)strlen(preamble);
+    src_ptrs[2] = src->data + split;
+    src_lens[2] = (GLint)(src->len - split);
+
+    gl_flush_errors();
 
-    /* Initialize OpenGL shader */
     id = pglCreateShader(type);
     if (!id) {
         FATAL("glCreateShader: %s", gl_strerror(pglGetError()));
     }
-    pglShaderSource(id, 1, &src_ptr, &src_len);
+    pglShaderSource(id, 3, src_ptrs, src_lens);
     pglCompileShader(id);
     pglGetShaderiv(id, GL_COMPILE_STATUS, &status);
     if (status != GL_TRUE) {
@@ -69,7 +148,10 @@ static GLuint load_shader(const char *name, GLenum type)
         info_log = mem_alloc((size_t)info_log_len + 1);
         info_log[0] = 0;
         pglGetShaderInfoLog(id, info_log_len + 1, &info_log_len, info_log);
-        FATAL("%s: %s", name, info_log);
+        str_putf(out_err, "%s: %s", name, info_log);
+        mem_free(info_log);
+        pglDeleteShader(id);
+        return 0;
     }
 
     /* If by some chance there are errors we didn't catch */
@@ -80,38 +162,125 @@ static GLuint load_shader(const char *name, GLenum type)
     return id;
 }
 
-static void link_program(struct gl_program *program, const char *name, GLuint vert, GLuint frag)
+/*
+ * Links a program from compiled shaders. Returns false and sets *out_err on
+ * failure.
+ */
+static bool link_program(GLuint id, const char *name, GLuint vert, GLuint frag, char **out_err)
 {
     GLint status = GL_FALSE;
     GLint info_log_len = 0;
     char *info_log;
-    GLenum errcode;
-
-    gl_flush_errors();
 
-    program->id = pglCreateProgram();
-    if (!program->id) {
-        FATAL("glCreateProgram: %s", gl_strerror(pglGetError()));
+    pglAttachShader(id, vert);
+    pglAttachShader(id, frag);
+    if (gl_caps.program_binary) {
+        pglProgramParameteri(id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     }
-    pglAttachShader(program->id, vert);
-    pglAttachShader(program->id, frag);
-    pglLinkProgram(program->id);
-    pglGetProgramiv(program->id, GL_LINK_STATUS, &status);
+    pglLinkProgram(id);
+    pglGetProgramiv(id, GL_LINK_STATUS, &status);
     if (status != GL_TRUE) {
-        pglGetProgramiv(program->id, GL_INFO_LOG_LENGTH, &info_log_len);
+        pglGetProgramiv(id, GL_INFO_LOG_LENGTH, &info_log_len);
         if (info_log_len < 0) {
             info_log_len = 0;
         }
         info_log = mem_alloc((size_t)info_log_len + 1);
         info_log[0] = 0;
-        pglGetProgramInfoLog(program->id, info_log_len + 1, &info_log_len, info_log);
-        FATAL("%s: %s", name, info_log);
+        pglGetProgramInfoLog(id, info_log_len + 1, &info_log_len, info_log);
+        str_putf(out_err, "%s: %s", name, info_log);
+        mem_free(info_log);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Builds a sprite program variant, using a cached program binary if one is
+ * available. On failure, returns false, sets *out_err, and leaves the program
+ * unmodified.
+ */
+static bool build_sprite_program(unsigned features, char **out_err)
+{
+    uint64_t start_time = system_get_time_ns();
+    struct gl_program *program = &sprite_programs[features];
+    struct buf preamble = BUF_INIT;
+    char *name;
+    const char *separator = "";
+    uint64_t source_hash;
+    GLuint id;
+    GLuint vert = 0;
+    GLuint frag = 0;
+    bool cached;
+    bool ok = false;
+    GLenum errcode;
+    unsigned i;
+
+    /* Generate the variant's name and #defines */
+    name = str_clone("sprites[");
+    buf_terminate(&preamble);
+    for (i = 0; i < GL_SPRITE_NUM_FEATURES; ++i) {
+        if (features & (1u << i)) {
+            buf_appendf(&preamble, "#define %s 1\n", sprite_feature_names[i]);
+            name = str_appendf(name, "%s%s", separator, sprite_feature_names[i]);
+            separator = ",";
+        }
+    }
+    name = str_append(name, "]");
+
+    source_hash = hash_str(HASH_INIT, preamble.data);
+    source_hash = hash_bytes(source_hash, sizeof(sprites_vert_src.len), &sprites_vert_src.len);
+    source_hash = hash_bytes(source_hash, sprites_vert_src.len, sprites_vert_src.data);
+    source_hash = hash_bytes(source_hash, sprites_frag_src.len, sprites_frag_src.data);
+    for (i = 0; i < LENGTHOF(sprite_attribs); ++i) {
+        source_hash = hash_bytes(source_hash, sizeof(sprite_attribs[i].index), &sprite_attribs[i].index);
+        source_hash = hash_str(source_hash, sprite_attribs[i].name);
+    }
+
+    gl_flush_errors();
+    id = pglCreateProgram();
+    if (!id) {
+        FATAL("glCreateProgram: %s", gl_strerror(pglGetError()));
+    }
+
+    cached = gl_program_cache_load(id, source_hash);
+    if (!cached) {
+        /* Start over with a clean program object if the driver rejected the binary. */
+        pglDeleteProgram(id);
+        id = pglCreateProgram();
+        if (!id) {
+            FATAL("glCreateProgram: %s", gl_strerror(pglGetError()));
+        }
+
+        vert = compile_shader(SPRITES_VERT_NAME, GL_VERTEX_SHADER, &sprites_vert_src, preamble.data, out_err);
+        if (!vert) {
+            goto done;
+        }
+        frag = compile_shader(SPRITES_FRAG_NAME, GL_FRAGMENT_SHADER, &sprites_frag_src, preamble.data, out_err);
+        if (!frag) {
+            goto done;
+        }
+        for (i = 0; i < LENGTHOF(sprite_attribs); ++i) {
+            pglBindAttribLocation(id, sprite_attribs[i].index, sprite_attribs[i].name);
+        }
+        if (!link_program(id, name, vert, frag, out_err)) {
+            goto done;
+        }
+        gl_program_cache_store(id, source_hash);
     }
 
+    if (program->id) {
+        pglDeleteProgram(program->id);
+    }
+    *program = RENDER_GL_PROGRAM_NULL;
+    program->id = id;
+    id = 0;
+
     /* Get uniform and vertex attribute indices */
     program->uni_transform = pglGetUniformLocation(program->id, "uni_Transform");
     program->uni_texture = pglGetUniformLocation(program->id, "uni_Texture");
     program->uni_texture_size = pglGetUniformLocation(program->id, "uni_TextureSize");
+    program->uni_palette = pglGetUniformLocation(program->id, "uni_Palette");
+    program->uni_depth = pglGetUniformLocation(program->id, "uni_Depth");
 
     program->attr_position = pglGetAttribLocation(program->id, "attr_Position");
     program->attr_texture_coord = pglGetAttribLocation(program->id, "attr_TextureCoord");
@@ -121,6 +290,26 @@ static void link_program(struct gl_program *program, const char *name, GLuint ve
     if ((errcode = pglGetError()) != GL_NO_ERROR) {
         FATAL("%s: %s", name, gl_strerror(errcode));
     }
+    LOG_DEBUG("Built program %s in %.2f ms%s", name, (double)(system_get_time_ns() - start_time) / 1e6,
+              cached ? " (from cache)" : "");
+    ++num_programs_built;
+    num_programs_cached += cached;
+    program_build_time += system_get_time_ns() - start_time;
+    ok = true;
+
+done:
+    if (id) {
+        pglDeleteProgram(id);
+    }
+    if (vert) {
+        pglDeleteShader(vert);
+    }
+    if (frag) {
+        pglDeleteShader(frag);
+    }
+    buf_fini(&preamble);
+    mem_free(name);
+    return ok;
 }
 
 static void fini_program(struct gl_program *program)
@@ -131,28 +320,100 @@ static void fini_program(struct gl_program *program)
     *program = RENDER_GL_PROGRAM_NULL;
 }
 
+/*
+ * Reloads the sprite shader sources and rebuilds every variant that has been
+ * built so far. If anything fails, the error is logged and the old programs
+ * are kept.
+ */
+static void rebuild_sprite_programs(UNUSED void *data)
+{
+    struct buf vert_src = BUF_INIT;
+    struct buf frag_src = BUF_INIT;
+    char *err = NULL;
+    unsigned i;
+
+    if (!load_source(SPRITES_VERT_NAME, &vert_src, &err) || !load_source(SPRITES_FRAG_NAME, &frag_src, &err)) {
+        LOG_ERROR("%s", err);
+        buf_fini(&vert_src);
+        buf_fini(&frag_src);
+        mem_free(err);
+        return;
+    }
+    buf_fini(&sprites_vert_src);
+    buf_fini(&sprites_frag_src);
+    sprites_vert_src = vert_src;
+    sprites_frag_src = frag_src;
+
+    for (i = 0; i < GL_SPRITE_NUM_VARIANTS; ++i) {
+        if (!sprite_programs[i].id) {
+            continue;
+        }
+        if (build_sprite_program(i, &err)) {
+            /* Force the uniforms to be reinitialized if the program is in use. */
+            if (gl_state.program == &sprite_programs[i]) {
+                gl_state.program = NULL;
+                gl_use_program(&sprite_programs[i]);
+            }
+        } else {
+            LOG_ERROR("%s", err);
+        }
+    }
+    mem_free(err);
+}
+
+/* Called by hotreload on the main thread, but the programs belong to the render thread. */
+static void reload_sprite_shaders(UNUSED const char *name, UNUSED void *data)
+{
+    render_run(&rebuild_sprite_programs, NULL);
+}
+
 void gl_init_shaders(void)
 {
-    GLuint vert_sprites = load_shader("shaders/glsl110/sprites.vert", GL_VERTEX_SHADER);
-    GLuint frag_sprites_alpha = load_shader("shaders/glsl110/sprites_alpha.frag", GL_FRAGMENT_SHADER);
-    GLuint frag_sprites_rgb = load_shader("shaders/glsl110/sprites_rgb.frag", GL_FRAGMENT_SHADER);
-    GLuint frag_sprites_rgba = load_shader("shaders/glsl110/sprites_rgba.frag", GL_FRAGMENT_SHADER);
-
-    link_program(&gl_program_alpha_sprites, "alpha_sprites", vert_sprites, frag_sprites_alpha);
-    link_program(&gl_program_rgb_sprites, "rgb_sprites", vert_sprites, frag_sprites_rgb);
-    link_program(&gl_program_rgba_sprites, "rgba_sprites", vert_sprites, frag_sprites_rgba);
-
-    pglDeleteShader(vert_sprites);
-    pglDeleteShader(frag_sprites_alpha);
-    pglDeleteShader(frag_sprites_rgb);
-    pglDeleteShader(frag_sprites_rgba);
+    char *err = NULL;
+    unsigned i;
+
+    for (i = 0; i < GL_SPRITE_NUM_VARIANTS; ++i) {
+        sprite_programs[i] = RENDER_GL_PROGRAM_NULL;
+    }
+    gl_init_program_cache();
+
+    if (!load_source(SPRITES_VERT_NAME, &sprites_vert_src, &err)
+        || !load_source(SPRITES_FRAG_NAME, &sprites_frag_src, &err))
+    {
+        FATAL("%s", err);
+    }
+    hotreload_watch(SPRITES_VERT_NAME, &reload_sprite_shaders, NULL);
+    hotreload_watch(SPRITES_FRAG_NAME, &reload_sprite_shaders, NULL);
 }
 
 void gl_fini_shaders(void)
 {
-    fini_program(&gl_program_alpha_sprites);
-    fini_program(&gl_program_rgb_sprites);
-    fini_program(&gl_program_rgba_sprites);
+    unsigned i;
+
+    LOG_DEBUG("Built %u shader programs in %.2f ms (%u from cache)",
+              num_programs_built, (double)program_build_time / 1e6, num_programs_cached);
+    num_programs_built = 0;
+    num_programs_cached = 0;
+    program_build_time = 0;
+
+    hotreload_unwatch(&reload_sprite_shaders, NULL);
+    for (i = 0; i < GL_SPRITE_NUM_VARIANTS; ++i) {
+        fini_program(&sprite_programs[i]);
+    }
+    buf_fini(&sprites_vert_src);
+    buf_fini(&sprites_frag_src);
+    gl_fini_program_cache();
+}
+
+struct gl_program *gl_get_sprite_program(unsigned features)
+{
+    char *err = NULL;
+
+    DASSERT(features < GL_SPRITE_NUM_VARIANTS);
+    if (!sprite_programs[features].id && !build_sprite_program(features, &err)) {
+        FATAL("%s", err);
+    }
+    return &sprite_programs[features];
 }
 
 void gl_use_program(struct gl_program *program)
@@ -165,17 +426,79 @@ void gl_use_program(struct gl_program *program)
     gl_state.program = program;
 
     /*
-     * Reinitialize all of the uniform states. This may result in some
-     * redundant calls, but it eliminates undefined behavior if the caller
-     * doesn't update them manually.
+     * Bring all of the uniform states up to date. This eliminates undefined
+     * behavior if the caller doesn't update them manually, and the program's
+     * shadow values prevent redundant calls.
      */
-    if (program->uni_transform >= 0) {
-        pglUniformMatrix4fv(program->uni_transform, 1, GL_FALSE, &gl_state.transform.x.x);
-    }
+    gl_update_transform_uniform();
     if (program->uni_texture >= 0) {
-        pglUniform1i(program->uni_texture, RENDER_GL_TEXTURE_UNIT_TEXTURE);
+        if (program->cur_texture != RENDER_GL_TEXTURE_UNIT_TEXTURE) {
+            pglUniform1i(program->uni_texture, RENDER_GL_TEXTURE_UNIT_TEXTURE);
+            program->cur_texture = RENDER_GL_TEXTURE_UNIT_TEXTURE;
+            ++gl_frame_stats.uniform_calls;
+        } else {
+            ++gl_frame_stats.skipped_uniform_calls;
+        }
     }
-    if (program->uni_texture_size >= 0 && gl_state.texture) {
-        pglUniform2f(program->uni_texture_size, (float)gl_state.texture->size.x, (float)gl_state.texture->size.y);
+    if (program->uni_palette >= 0) {
+        if (program->cur_palette != RENDER_GL_TEXTURE_UNIT_PALETTE) {
+            pglUniform1i(program->uni_palette, RENDER_GL_TEXTURE_UNIT_PALETTE);
+            program->cur_palette = RENDER_GL_TEXTURE_UNIT_PALETTE;
+            ++gl_frame_stats.uniform_calls;
+        } else {
+            ++gl_frame_stats.skipped_uniform_calls;
+        }
+    }
+    gl_update_texture_size_uniform();
+    gl_update_depth_uniform();
+}
+
+void gl_update_transform_uniform(void)
+{
+    struct gl_program *program = gl_state.program;
+
+    if (!program || program->uni_transform < 0) {
+        return;
+    }
+    if (program->cur_transform_version == gl_state.transform_version) {
+        ++gl_frame_stats.skipped_uniform_calls;
+        return;
+    }
+    pglUniformMatrix4fv(program->uni_transform, 1, GL_FALSE, &gl_state.transform.x.x);
+    program->cur_transform_version = gl_state.transform_version;
+    ++gl_frame_stats.uniform_calls;
+}
+
+void gl_update_texture_size_uniform(void)
+{
+    struct gl_program *program = gl_state.program;
+    struct vec2i size;
+
+    if (!program || program->uni_texture_size < 0 || !gl_state.texture) {
+        return;
+    }
+    size = gl_state.texture->size;
+    if (program->cur_texture_size.x == size.x && program->cur_texture_size.y == size.y) {
+        ++gl_frame_stats.skipped_uniform_calls;
+        return;
+    }
+    pglUniform2f(program->uni_texture_size, (float)size.x, (float)size.y);
+    program->cur_texture_size = size;
+    ++gl_frame_stats.uniform_calls;
+}
+
+void gl_update_depth_uniform(void)
+{
+    struct gl_program *program = gl_state.program;
+
+    if (!program || program->uni_depth < 0) {
+        return;
+    }
+    if (program->cur_depth == gl_state.depth) {
+        ++gl_frame_stats.skipped_uniform_calls;
+        return;
     }
+    pglUniform1f(program->uni_depth, gl_state.depth);
+    program->cur_depth = gl_state.depth;
+    ++gl_frame_stats.uniform_calls;
 }
@@ -19,6 +19,21 @@
 
 #include "gl_types.h"
 
+/*
+ * Feature flags for sprite shader variants. Each flag is injected into the
+ * shader sources as a #define of the name listed in gl_shaders.c, and every
+ * combination of flags is a separate program which is built on first use.
+ */
+enum gl_sprite_feature {
+    GL_SPRITE_TEXTURE_RGB = 1 << 0,   /* Multiply color by the texture's color channels */
+    GL_SPRITE_TEXTURE_ALPHA = 1 << 1, /* Multiply alpha by the texture's alpha channel */
+    GL_SPRITE_TEXTURE_INDEXED = 1 << 2, /* The texture's alpha channel indexes the palette texture */
+    GL_SPRITE_TEXTURE_ARRAY = 1 << 3, /* The texture is an array, with its layers stacked vertically */
+    GL_SPRITE_OPAQUE = 1 << 4, /* Never discard, for the depth-tested opaque pass */
+};
+#define GL_SPRITE_NUM_FEATURES 5
+#define GL_SPRITE_NUM_VARIANTS (1 << GL_SPRITE_NUM_FEATURES)
+
 struct gl_program {
     GLuint id;
 
@@ -26,20 +41,35 @@ struct gl_program {
     GLint uni_transform;
     GLint uni_texture;
     GLint uni_texture_size;
+    GLint uni_palette;
+    GLint uni_depth;
 
     /* Vertex attribute indices */
     GLint attr_position;
     GLint attr_texture_coord;
     GLint attr_color;
+
+    /* Uniform values last uploaded to this program, used to skip redundant calls */
+    unsigned cur_transform_version; /* 0 if never uploaded */
+    GLint cur_texture;
+    struct vec2i cur_texture_size;
+    GLint cur_palette;
+    float cur_depth; /* Outside [-1, 1] if never uploaded */
 };
 #define RENDER_GL_PROGRAM_INIT \
     { \
         .uni_transform = -1, \
         .uni_texture = -1, \
         .uni_texture_size = -1, \
+        .uni_palette = -1, \
+        .uni_depth = -1, \
         .attr_position = -1, \
         .attr_texture_coord = -1, \
         .attr_color = -1, \
+        .cur_texture = -1, \
+        .cur_texture_size = {-1, -1}, \
+        .cur_palette = -1, \
+        .cur_depth = -2.0f, \
     }
 #define RENDER_GL_PROGRAM_NULL ((struct gl_program)RENDER_GL_PROGRAM_INIT)
 
@@ -47,8 +77,15 @@ void gl_init_shaders(void);
 void gl_fini_shaders(void);
 void gl_use_program(struct gl_program *program);
 
-extern struct gl_program gl_program_alpha_sprites;
-extern struct gl_program gl_program_rgb_sprites;
-extern struct gl_program gl_program_rgba_sprites;
+/*
+ * Upload uniform values from gl_state to the current program, unless the
+ * program already has the same values.
+ */
+void gl_update_transform_uniform(void);
+void gl_update_texture_size_uniform(void);
+void gl_update_depth_uniform(void);
+
+/* Gets the sprite program for a set of gl_sprite_feature flags, building it if necessary. */
+struct gl_program *gl_get_sprite_program(unsigned features);
 
 #endif /* INCLUDED_GL_SHADERS_H */
@@ -14,6 +14,8 @@
  * this program. If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <string.h>
+
 #include "debug.h"
 #include "gl_api.h"
 #include "gl_shaders.h"
@@ -27,13 +29,20 @@
 STATIC_ASSERT(MAX_ATTRIBS <= sizeof(gl_attrib_mask_t) * CHAR_BIT);
 
 struct gl_state gl_state = RENDER_GL_STATE_INIT;
+struct gl_frame_stats gl_frame_stats = RENDER_GL_FRAME_STATS_INIT;
+struct gl_frame_stats gl_last_frame_stats = RENDER_GL_FRAME_STATS_INIT;
 
 void gl_use_transform(struct mat4f transform)
 {
+    if (!memcmp(&transform, &gl_state.transform, sizeof(transform))) {
+        return;
+    }
     gl_state.transform = transform;
-    if (gl_state.program && gl_state.program->uni_transform >= 0) {
-        pglUniformMatrix4fv(gl_state.program->uni_transform, 1, GL_FALSE, &gl_state.transform.x.x);
+    if (!++gl_state.transform_version) {
+        /* Skip 0 on overflow, since programs use it to mean "never uploaded" */
+        gl_state.transform_version = 1;
     }
+    gl_update_transform_uniform();
 }
 
 /*
@@ -81,12 +90,34 @@ static void use_attrib_mask(int count, ...)
     gl_state.attrib_mask = desired_mask;
 }
 
+static void use_vertex_array(GLuint vao)
+{
+    if (vao != gl_state.vertex_array) {
+        pglBindVertexArray(vao);
+        gl_state.vertex_array = vao;
+    }
+}
+
+static void use_array_buffer(GLuint vbo)
+{
+    if (vbo != gl_state.array_buffer) {
+        pglBindBuffer(GL_ARRAY_BUFFER, vbo);
+        gl_state.array_buffer = vbo;
+    }
+}
+
 void gl_use_sprite_vertex_ptr(const struct sprite_vertex *ptr)
 {
     if (!gl_state.program) {
         return;
     }
 
+    /* Client-side arrays only work with the default vertex array and no buffer bound */
+    if (gl_caps.vertex_array_object) {
+        use_vertex_array(0);
+    }
+    use_array_buffer(0);
+
     use_attrib_mask(3, gl_state.program->attr_position,
                        gl_state.program->attr_texture_coord,
                        gl_state.program->attr_color);
@@ -104,3 +135,72 @@ void gl_use_sprite_vertex_ptr(const struct sprite_vertex *ptr)
                                4, GL_FLOAT, GL_FALSE, sizeof(*ptr), &ptr->color.x);
     }
 }
+
+/*
+ * Creates a batch's vertex buffer and vertex array object, and records the
+ * vertex layout in the latter. This only needs to be done once per batch,
+ * since resizing the batch only reallocates the buffer's storage.
+ */
+static void init_sprite_batch_objects(struct sprite_batch *batch)
+{
+    pglGenBuffers(1, &batch->vbo);
+    pglGenVertexArrays(1, &batch->vao);
+    use_vertex_array(batch->vao);
+    use_array_buffer(batch->vbo);
+
+    pglEnableVertexAttribArray(RENDER_GL_ATTRIB_POSITION);
+    pglEnableVertexAttribArray(RENDER_GL_ATTRIB_TEXTURE_COORD);
+    pglEnableVertexAttribArray(RENDER_GL_ATTRIB_COLOR);
+    pglVertexAttribPointer(RENDER_GL_ATTRIB_POSITION,
+                           2, GL_INT, GL_FALSE, sizeof(struct sprite_vertex),
+                           (const GLvoid *)offsetof(struct sprite_vertex, position));
+    pglVertexAttribPointer(RENDER_GL_ATTRIB_TEXTURE_COORD,
+                           2, GL_INT, GL_FALSE, sizeof(struct sprite_vertex),
+                           (const GLvoid *)offsetof(struct sprite_vertex, texture_coord));
+    pglVertexAttribPointer(RENDER_GL_ATTRIB_COLOR,
+                           4, GL_FLOAT, GL_FALSE, sizeof(struct sprite_vertex),
+                           (const GLvoid *)offsetof(struct sprite_vertex, color));
+}
+
+void gl_use_sprite_batch(struct sprite_batch *batch, const struct sprite_vertex *verts, int num_verts)
+{
+    DASSERT(batch != NULL);
+    if (!gl_caps.vertex_array_object) {
+        DASSERT(verts != NULL);
+        gl_use_sprite_vertex_ptr(verts);
+        return;
+    }
+
+    if (!batch->vao) {
+        DASSERT(verts != NULL); /* The new buffer has no contents yet */
+        init_sprite_batch_objects(batch);
+    } else {
+        use_vertex_array(batch->vao);
+    }
+    if (verts) {
+        use_array_buffer(batch->vbo);
+        pglBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)num_verts * (GLsizeiptr)sizeof(*verts),
+                      verts, GL_STREAM_DRAW);
+    }
+}
+
+void gl_fini_sprite_batch(struct sprite_batch *batch)
+{
+    DASSERT(batch != NULL);
+
+    /* The context may already be gone, in which case so are the objects. */
+    if (batch->vao && pglDeleteVertexArrays) {
+        if (batch->vao == gl_state.vertex_array) {
+            use_vertex_array(0);
+        }
+        pglDeleteVertexArrays(1, &batch->vao);
+    }
+    if (batch->vbo && pglDeleteBuffers) {
+        if (batch->vbo == gl_state.array_buffer) {
+            use_array_buffer(0);
+        }
+        pglDeleteBuffers(1, &batch->vbo);
+    }
+    batch->vao = 0;
+    batch->vbo = 0;
+}
@@ -25,19 +25,56 @@ typedef uint32_t gl_attrib_mask_t;
 struct gl_state {
     struct gl_program *program;
     struct mat4f transform;
+    unsigned transform_version; /* Incremented whenever transform changes */
     struct texture *texture;
-    gl_attrib_mask_t attrib_mask;
+    struct texture *palette;
+    float depth; /* Of the sprites being drawn, when the depth-tested passes are enabled */
+    gl_attrib_mask_t attrib_mask; /* Enabled attributes of vertex array object 0 */
+    GLuint vertex_array;
+    GLuint array_buffer;
+
+    /*
+     * Batch between render_begin_sprites and render_end_sprites. Unlike the
+     * rest, this belongs to the thread calling the render functions rather
+     * than the render thread.
+     */
     struct sprite_batch *sprite_batch;
 };
 #define RENDER_GL_STATE_INIT \
     { \
         .transform = MAT4F_IDENTITY_INIT, \
+        .transform_version = 1, \
     }
 #define RENDER_GL_STATE_NULL ((struct gl_state)RENDER_GL_STATE_INIT)
 
+/* Counters for the current frame, reset by render_end_frame */
+struct gl_frame_stats {
+    unsigned draw_calls;
+    unsigned vertices;
+    unsigned uniform_calls;
+    unsigned skipped_uniform_calls;
+};
+#define RENDER_GL_FRAME_STATS_INIT {0}
+#define RENDER_GL_FRAME_STATS_NULL ((struct gl_frame_stats)RENDER_GL_FRAME_STATS_INIT)
+
 void gl_use_transform(struct mat4f transform);
 void gl_use_sprite_vertex_ptr(const struct sprite_vertex *ptr);
 
+/*
+ * Sets up vertex attributes for drawing a sprite batch. If vertex array
+ * objects are supported, verts are uploaded to the batch's own vertex buffer
+ * unless they're NULL, meaning the buffer is up to date, and binding its
+ * vertex array object is the only other cost. Otherwise this is the same as
+ * gl_use_sprite_vertex_ptr(verts). The verts are passed separately from the
+ * batch so that the render thread can be given a copy of them.
+ */
+void gl_use_sprite_batch(struct sprite_batch *batch, const struct sprite_vertex *verts, int num_verts);
+
+/* Deletes the GL objects owned by a sprite batch. */
+void gl_fini_sprite_batch(struct sprite_batch *batch);
+
 extern struct gl_state gl_state;
+extern struct gl_frame_stats gl_frame_stats;
+extern struct gl_frame_stats gl_last_frame_stats; /* Stats of the last completed frame */
 
 #endif /* INCLUDED_GL_STATE_H */
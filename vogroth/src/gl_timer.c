@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) 2021 Marty Mills <daggerbot@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "debug.h"
+#include "gl_api.h"
+#include "gl_timer.h"
+#include "memory.h"
+#include "system.h"
+
+struct timer_frame {
+    bool pending; /* Queries were issued and haven't been read back yet */
+    int num_timers;
+    const char *names[RENDER_GL_MAX_TIMERS];
+    GLuint queries[RENDER_GL_MAX_TIMERS];
+};
+
+static bool enabled = false;
+static bool active = false; /* Enabled and supported */
+static bool recording = false; /* Whether the current frame is being timed */
+static bool timer_open = false;
+static struct timer_frame frames[RENDER_GL_TIMER_FRAMES];
+static int cur_frame_index = 0;
+static uint64_t skipped_frames = 0;
+
+static struct gl_timer_stats *stats = NULL;
+static int num_stats = 0;
+
+static void add_sample(const char *name, uint64_t time_ns)
+{
+    struct gl_timer_stats *entry = NULL;
+    int i;
+
+    for (i = 0; i < num_stats; ++i) {
+        if (stats[i].name == name || !strcmp(stats[i].name, name)) {
+            entry = &stats[i];
+            break;
+        }
+    }
+    if (!entry) {
+        stats = mem_realloc_array(stats, (size_t)num_stats + 1, sizeof(*stats));
+        entry = &stats[num_stats++];
+        *entry = (struct gl_timer_stats){.name = name};
+    }
+
+    entry->last_ns = time_ns;
+    if (time_ns > entry->max_ns) {
+        entry->max_ns = time_ns;
+    }
+    entry->total_ns += time_ns;
+    ++entry->samples;
+}
+
+/*
+ * Reads back a frame's query results if they're available. Queries complete
+ * in order, so if the last one is available, they all are. Returns false if
+ * the results aren't ready yet.
+ */
+static bool read_frame(struct timer_frame *frame)
+{
+    GLint available = GL_FALSE;
+    GLuint64 time_ns;
+    int i;
+
+    if (!frame->pending) {
+        return true;
+    }
+    pglGetQueryObjectiv(frame->queries[frame->num_timers - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) {
+        return false;
+    }
+    for (i = 0; i < frame->num_timers; ++i) {
+        pglGetQueryObjectui64v(frame->queries[i], GL_QUERY_RESULT, &time_ns);
+        add_sample(frame->names[i], time_ns);
+    }
+    frame->pending = false;
+    return true;
+}
+
+static void dump_stats(void)
+{
+    int i;
+
+    system_lock_console();
+    fprintf(stderr, "GPU timers: %" PRIu64 " frames skipped waiting for results\n", skipped_frames);
+    fprintf(stderr, "  %-20s %12s %12s %12s\n", "Section", "Avg ms", "Max ms", "Samples");
+    for (i = 0; i < num_stats; ++i) {
+        fprintf(stderr, "  %-20s %12.3f %12.3f %12" PRIu64 "\n", stats[i].name,
+                (double)stats[i].total_ns / (double)stats[i].samples / 1e6,
+                (double)stats[i].max_ns / 1e6, stats[i].samples);
+    }
+    fflush(stderr);
+    system_unlock_console();
+}
+
+void gl_enable_timers(void)
+{
+    enabled = true;
+}
+
+void gl_init_timers(void)
+{
+    int i;
+
+    if (!enabled) {
+        return;
+    }
+    if (!gl_caps.timer_query) {
+        LOG_WARNING("GPU timers are not supported by this OpenGL driver");
+        return;
+    }
+    active = true;
+    for (i = 0; i < RENDER_GL_TIMER_FRAMES; ++i) {
+        frames[i] = (struct timer_frame){0};
+        pglGenQueries(RENDER_GL_MAX_TIMERS, frames[i].queries);
+    }
+    cur_frame_index = 0;
+    skipped_frames = 0;
+}
+
+void gl_fini_timers(void)
+{
+    int i;
+
+    if (!active) {
+        return;
+    }
+    if (timer_open) {
+        pglEndQuery(GL_TIME_ELAPSED);
+        timer_open = false;
+    }
+    recording = false;
+
+    /* Collect whatever the GPU has finished by now */
+    for (i = 1; i <= RENDER_GL_TIMER_FRAMES; ++i) {
+        read_frame(&frames[(cur_frame_index + i) % RENDER_GL_TIMER_FRAMES]);
+    }
+    if (num_stats) {
+        dump_stats();
+    }
+
+    for (i = 0; i < RENDER_GL_TIMER_FRAMES; ++i) {
+        pglDeleteQueries(RENDER_GL_MAX_TIMERS, frames[i].queries);
+        frames[i] = (struct timer_frame){0};
+    }
+    stats = mem_free(stats);
+    num_stats = 0;
+    active = false;
+}
+
+void gl_timer_begin_frame(void)
+{
+    struct timer_frame *frame = &frames[cur_frame_index];
+
+    if (!active) {
+        return;
+    }
+    recording = read_frame(frame);
+    if (recording) {
+        frame->num_timers = 0;
+    } else {
+        ++skipped_frames;
+    }
+}
+
+void gl_timer_end_frame(void)
+{
+    struct timer_frame *frame = &frames[cur_frame_index];
+
+    if (!recording) {
+        return;
+    }
+    DASSERT(!timer_open);
+    frame->pending = frame->num_timers > 0;
+    recording = false;
+    cur_frame_index = (cur_frame_index + 1) % RENDER_GL_TIMER_FRAMES;
+}
+
+void gl_begin_timer(const char *name)
+{
+    static bool warned_max_timers = false;
+
+    struct timer_frame *frame = &frames[cur_frame_index];
+
+    DASSERT(name != NULL);
+    if (!recording) {
+        return;
+    }
+    ASSERT(!timer_open); /* Timers can't be nested */
+    if (frame->num_timers >= RENDER_GL_MAX_TIMERS) {
+        if (!warned_max_timers) {
+            LOG_WARNING("Maximum GPU timers per frame exceeded");
+            warned_max_timers = true;
+        }
+        return;
+    }
+    frame->names[frame->num_timers] = name;
+    pglBeginQuery(GL_TIME_ELAPSED, frame->queries[frame->num_timers]);
+    timer_open = true;
+}
+
+void gl_end_timer(void)
+{
+    if (!timer_open) {
+        return;
+    }
+    pglEndQuery(GL_TIME_ELAPSED);
+    ++frames[cur_frame_index].num_timers;
+    timer_open = false;
+}
+
+const struct gl_timer_stats *gl_get_timer_stats(int *out_count)
+{
+    DASSERT(out_count != NULL);
+    *out_count = num_stats;
+    return stats;
+}
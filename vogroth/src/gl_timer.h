@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2021 Marty Mills <daggerbot@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_GL_TIMER_H
+#define INCLUDED_GL_TIMER_H
+
+#include "gl_types.h"
+
+/*
+ * GPU timing of named sections of each frame using GL_TIME_ELAPSED queries.
+ * Results are read back RENDER_GL_TIMER_FRAMES frames later so that we never
+ * wait for the GPU to catch up. If the results still aren't ready by then,
+ * that frame isn't timed.
+ */
+#define RENDER_GL_TIMER_FRAMES 4 /* Frames of queries in flight */
+#define RENDER_GL_MAX_TIMERS 16  /* Timed sections per frame */
+
+struct gl_timer_stats {
+    const char *name;
+    uint64_t last_ns; /* Time of the most recent frame which has results */
+    uint64_t max_ns;
+    uint64_t total_ns;
+    uint64_t samples;
+};
+
+/* Must be called before gl_init_timers. Timers are disabled by default. */
+void gl_enable_timers(void);
+
+void gl_init_timers(void);
+void gl_fini_timers(void);
+void gl_timer_begin_frame(void);
+void gl_timer_end_frame(void);
+
+/*
+ * Starts/stops timing a section of the frame. Sections can't be nested, and
+ * the name must outlive the renderer (normally a string literal). Sections
+ * with the same name are reported together.
+ */
+void gl_begin_timer(const char *name);
+void gl_end_timer(void);
+
+/* Gets the stats of every section name seen so far. */
+const struct gl_timer_stats *gl_get_timer_stats(int *out_count);
+
+#endif /* INCLUDED_GL_TIMER_H */
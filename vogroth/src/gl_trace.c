@@ -0,0 +1,377 @@
+/*
+ * Copyright (c) 2021 Marty Mills <daggerbot@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "debug.h"
+#include "gl_trace.h"
+#include "system.h"
+
+/*
+ * Preprocessor helpers for turning the parameter type lists of
+ * FOREACH_GL_FUNCTION into parameter declarations (PARAMS) and argument lists
+ * (ARGS). A list consisting of only 'void' has no parameters.
+ */
+#define CAT(A, B) CAT_(A, B)
+#define CAT_(A, B) A##B
+#define SECOND(...) SECOND_(__VA_ARGS__)
+#define SECOND_(A, B, ...) B
+#define VOID_PROBE_void ~, 1
+#define IS_VOID(TYPE) SECOND(VOID_PROBE_##TYPE, 0, ~)
+#define IF(CONDITION) CAT(IF_, CONDITION)
+#define IF_0(THEN, ELSE) ELSE
+#define IF_1(THEN, ELSE) THEN
+#define COUNT(...) COUNT_(__VA_ARGS__, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, ~)
+#define COUNT_(A1, A2, A3, A4, A5, A6, A7, A8, A9, A10, A11, N, ...) N
+
+#define PARAMS(...) CAT(PARAMS_, COUNT(__VA_ARGS__))(__VA_ARGS__)
+#define PARAMS_1(T1) IF(IS_VOID(T1))(void, T1 a1)
+#define PARAMS_2(T1, T2) T1 a1, T2 a2
+#define PARAMS_3(T1, T2, T3) PARAMS_2(T1, T2), T3 a3
+#define PARAMS_4(T1, T2, T3, T4) PARAMS_3(T1, T2, T3), T4 a4
+#define PARAMS_5(T1, T2, T3, T4, T5) PARAMS_4(T1, T2, T3, T4), T5 a5
+#define PARAMS_6(T1, T2, T3, T4, T5, T6) PARAMS_5(T1, T2, T3, T4, T5), T6 a6
+#define PARAMS_7(T1, T2, T3, T4, T5, T6, T7) PARAMS_6(T1, T2, T3, T4, T5, T6), T7 a7
+#define PARAMS_8(T1, T2, T3, T4, T5, T6, T7, T8) PARAMS_7(T1, T2, T3, T4, T5, T6, T7), T8 a8
+#define PARAMS_9(T1, T2, T3, T4, T5, T6, T7, T8, T9) PARAMS_8(T1, T2, T3, T4, T5, T6, T7, T8), T9 a9
+#define PARAMS_10(T1, T2, T3, T4, T5, T6, T7, T8, T9, T10) \
+    PARAMS_9(T1, T2, T3, T4, T5, T6, T7, T8, T9), T10 a10
+#define PARAMS_11(T1, T2, T3, T4, T5, T6, T7, T8, T9, T10, T11) \
+    PARAMS_10(T1, T2, T3, T4, T5, T6, T7, T8, T9, T10), T11 a11
+
+#define ARGS(...) CAT(ARGS_, COUNT(__VA_ARGS__))(__VA_ARGS__)
+#define ARGS_1(T1) IF(IS_VOID(T1))(, a1)
+#define ARGS_2(T1, T2) a1, a2
+#define ARGS_3(T1, T2, T3) a1, a2, a3
+#define ARGS_4(T1, T2, T3, T4) a1, a2, a3, a4
+#define ARGS_5(T1, T2, T3, T4, T5) a1, a2, a3, a4, a5
+#define ARGS_6(T1, T2, T3, T4, T5, T6) a1, a2, a3, a4, a5, a6
+#define ARGS_7(T1, T2, T3, T4, T5, T6, T7) a1, a2, a3, a4, a5, a6, a7
+#define ARGS_8(T1, T2, T3, T4, T5, T6, T7, T8) a1, a2, a3, a4, a5, a6, a7, a8
+#define ARGS_9(T1, T2, T3, T4, T5, T6, T7, T8, T9) a1, a2, a3, a4, a5, a6, a7, a8, a9
+#define ARGS_10(T1, T2, T3, T4, T5, T6, T7, T8, T9, T10) a1, a2, a3, a4, a5, a6, a7, a8, a9, a10
+#define ARGS_11(T1, T2, T3, T4, T5, T6, T7, T8, T9, T10, T11) a1, a2, a3, a4, a5, a6, a7, a8, a9, a10, a11
+
+static const char *const function_names[GL_TRACE_NUM_FUNCTIONS] = {
+#define DO(RETURN, NAME, ...) "gl" #NAME,
+    FOREACH_GL_FUNCTION(DO)
+    FOREACH_GL_OPTIONAL_FUNCTION(DO)
+#undef DO
+};
+
+static bool timing = false;
+static struct gl_trace_stats cur_frame;
+static struct gl_trace_stats last_frame;
+static struct gl_trace_stats totals;
+
+/* Buffer bound to GL_PIXEL_UNPACK_BUFFER, so texture uploads read from it */
+static GLuint unpack_buffer;
+
+static inline uint64_t begin_call(void)
+{
+    return timing ? system_get_time_ns() : 0;
+}
+
+static inline void end_call(enum gl_trace_function function, uint64_t start_time)
+{
+    ++cur_frame.functions[function].calls;
+    if (timing) {
+        cur_frame.functions[function].time_ns += system_get_time_ns() - start_time;
+    }
+}
+
+/*
+ * Define a wrapper for each function, which calls the driver's function
+ * through real_glXxx.
+ */
+#define DO(RETURN, NAME, ...) \
+    static RETURN(GLAPIENTRY *real_gl##NAME)(__VA_ARGS__); \
+    static RETURN GLAPIENTRY trace_gl##NAME(PARAMS(__VA_ARGS__)) \
+    { \
+        uint64_t start_time = begin_call(); \
+        IF(IS_VOID(RETURN))( \
+            real_gl##NAME(ARGS(__VA_ARGS__)); \
+            end_call(GL_TRACE_##NAME, start_time);, \
+            RETURN result = real_gl##NAME(ARGS(__VA_ARGS__)); \
+            end_call(GL_TRACE_##NAME, start_time); \
+            return result;) \
+    }
+FOREACH_GL_FUNCTION(DO)
+FOREACH_GL_OPTIONAL_FUNCTION(DO)
+#undef DO
+
+/*
+ * Gets the size of pixel data passed to glTex(Sub)Image2D/3D. Row alignment
+ * and packed pixel types are ignored, so this is only an estimate.
+ */
+static uint64_t get_pixel_data_size(GLsizei width, GLsizei height, GLsizei depth, GLenum format, GLenum type)
+{
+    uint64_t channels;
+    uint64_t channel_size;
+
+    if (width <= 0 || height <= 0 || depth <= 0) {
+        return 0;
+    }
+    switch (format) {
+    case GL_ALPHA:
+    case GL_LUMINANCE:
+    case GL_RED:
+        channels = 1;
+        break;
+    case GL_LUMINANCE_ALPHA:
+        channels = 2;
+        break;
+    case GL_RGB:
+    case GL_BGR:
+        channels = 3;
+        break;
+    default:
+        channels = 4;
+        break;
+    }
+    switch (type) {
+    case GL_SHORT:
+    case GL_UNSIGNED_SHORT:
+        channel_size = 2;
+        break;
+    case GL_FLOAT:
+    case GL_INT:
+    case GL_UNSIGNED_INT:
+        channel_size = 4;
+        break;
+    default:
+        channel_size = 1;
+        break;
+    }
+    return (uint64_t)width * (uint64_t)height * (uint64_t)depth * channels * channel_size;
+}
+
+/*
+ * Checks whether a texture upload transfers pixel data. A NULL pointer only
+ * allocates storage, unless a pixel unpack buffer is bound, in which case it
+ * is an offset into that buffer.
+ */
+static inline bool is_upload(const GLvoid *pixels)
+{
+    return pixels || unpack_buffer;
+}
+
+/*
+ * Functions with extra stats. These are installed over the generic wrappers,
+ * which they call in turn.
+ */
+static void GLAPIENTRY trace_draw_arrays(GLenum mode, GLint first, GLsizei count)
+{
+    trace_glDrawArrays(mode, first, count);
+    ++cur_frame.draw_calls;
+    cur_frame.vertices += (uint64_t)(count > 0 ? count : 0);
+}
+
+static void GLAPIENTRY trace_tex_image_2d(GLenum target, GLint level, GLint internal_format,
+                                          GLsizei width, GLsizei height, GLint border,
+                                          GLenum format, GLenum type, const GLvoid *pixels)
+{
+    trace_glTexImage2D(target, level, internal_format, width, height, border, format, type, pixels);
+    if (is_upload(pixels)) {
+        cur_frame.upload_bytes += get_pixel_data_size(width, height, 1, format, type);
+    }
+}
+
+static void GLAPIENTRY trace_tex_sub_image_2d(GLenum target, GLint level, GLint xoffset, GLint yoffset,
+                                              GLsizei width, GLsizei height,
+                                              GLenum format, GLenum type, const GLvoid *pixels)
+{
+    trace_glTexSubImage2D(target, level, xoffset, yoffset, width, height, format, type, pixels);
+    if (is_upload(pixels)) {
+        cur_frame.upload_bytes += get_pixel_data_size(width, height, 1, format, type);
+    }
+}
+
+static void GLAPIENTRY trace_tex_image_3d(GLenum target, GLint level, GLint internal_format,
+                                          GLsizei width, GLsizei height, GLsizei depth, GLint border,
+                                          GLenum format, GLenum type, const GLvoid *pixels)
+{
+    trace_glTexImage3D(target, level, internal_format, width, height, depth, border, format, type, pixels);
+    if (is_upload(pixels)) {
+        cur_frame.upload_bytes += get_pixel_data_size(width, height, depth, format, type);
+    }
+}
+
+static void GLAPIENTRY trace_tex_sub_image_3d(GLenum target, GLint level, GLint xoffset, GLint yoffset,
+                                              GLint zoffset, GLsizei width, GLsizei height, GLsizei depth,
+                                              GLenum format, GLenum type, const GLvoid *pixels)
+{
+    trace_glTexSubImage3D(target, level, xoffset, yoffset, zoffset, width, height, depth, format, type, pixels);
+    if (is_upload(pixels)) {
+        cur_frame.upload_bytes += get_pixel_data_size(width, height, depth, format, type);
+    }
+}
+
+static void GLAPIENTRY trace_compressed_tex_image_2d(GLenum target, GLint level, GLenum internal_format,
+                                                     GLsizei width, GLsizei height, GLint border,
+                                                     GLsizei image_size, const GLvoid *data)
+{
+    trace_glCompressedTexImage2D(target, level, internal_format, width, height, border, image_size, data);
+    if (is_upload(data) && image_size > 0) {
+        cur_frame.upload_bytes += (uint64_t)image_size;
+    }
+}
+
+static void GLAPIENTRY trace_bind_buffer(GLenum target, GLuint buffer)
+{
+    trace_glBindBuffer(target, buffer);
+    if (target == GL_PIXEL_UNPACK_BUFFER) {
+        unpack_buffer = buffer;
+    }
+}
+
+static void GLAPIENTRY trace_buffer_data(GLenum target, GLsizeiptr size, const GLvoid *data, GLenum usage)
+{
+    trace_glBufferData(target, size, data, usage);
+    if (data && size > 0) {
+        cur_frame.upload_bytes += (uint64_t)size;
+    }
+}
+
+static void add_stats(struct gl_trace_stats *dest, const struct gl_trace_stats *src)
+{
+    int i;
+
+    dest->frames += src->frames;
+    dest->draw_calls += src->draw_calls;
+    dest->vertices += src->vertices;
+    dest->upload_bytes += src->upload_bytes;
+    for (i = 0; i < GL_TRACE_NUM_FUNCTIONS; ++i) {
+        dest->functions[i].calls += src->functions[i].calls;
+        dest->functions[i].time_ns += src->functions[i].time_ns;
+    }
+}
+
+/* qsort comparator which orders function indices by total call count, descending */
+static int compare_total_calls(const void *a, const void *b)
+{
+    uint64_t calls_a = totals.functions[*(const int *)a].calls;
+    uint64_t calls_b = totals.functions[*(const int *)b].calls;
+
+    return (calls_a < calls_b) - (calls_a > calls_b);
+}
+
+static void dump_totals(void)
+{
+    int order[GL_TRACE_NUM_FUNCTIONS];
+    double frames = (double)(totals.frames ? totals.frames : 1);
+    const struct gl_trace_call_stats *stats;
+    int i;
+
+    for (i = 0; i < GL_TRACE_NUM_FUNCTIONS; ++i) {
+        order[i] = i;
+    }
+    qsort(order, GL_TRACE_NUM_FUNCTIONS, sizeof(*order), compare_total_calls);
+
+    system_lock_console();
+    fprintf(stderr, "OpenGL trace: %" PRIu64 " frames\n", totals.frames);
+    fprintf(stderr, "  %-28s %14.1f per frame\n", "Draw calls", (double)totals.draw_calls / frames);
+    fprintf(stderr, "  %-28s %14.1f per frame\n", "Vertices", (double)totals.vertices / frames);
+    fprintf(stderr, "  %-28s %14.1f per frame\n", "Bytes uploaded", (double)totals.upload_bytes / frames);
+    fprintf(stderr, "  %-28s %14s %14s %12s\n", "Function", "Calls", "Per frame", timing ? "ns/call" : "");
+    for (i = 0; i < GL_TRACE_NUM_FUNCTIONS; ++i) {
+        stats = &totals.functions[order[i]];
+        if (!stats->calls) {
+            break;
+        }
+        fprintf(stderr, "  %-28s %14" PRIu64 " %14.1f", function_names[order[i]], stats->calls,
+                (double)stats->calls / frames);
+        if (timing) {
+            fprintf(stderr, " %12.1f", (double)stats->time_ns / (double)stats->calls);
+        }
+        fputc('\n', stderr);
+    }
+    fflush(stderr);
+    system_unlock_console();
+}
+
+void gl_trace_init(void)
+{
+#define DO(RETURN, NAME, ...) \
+    real_gl##NAME = pgl##NAME; \
+    if (pgl##NAME) { \
+        pgl##NAME = trace_gl##NAME; \
+    }
+    FOREACH_GL_FUNCTION(DO)
+    FOREACH_GL_OPTIONAL_FUNCTION(DO)
+#undef DO
+
+    pglDrawArrays = trace_draw_arrays;
+    pglTexImage2D = trace_tex_image_2d;
+    pglTexSubImage2D = trace_tex_sub_image_2d;
+    pglBufferData = trace_buffer_data;
+    pglCompressedTexImage2D = trace_compressed_tex_image_2d;
+    pglBindBuffer = trace_bind_buffer;
+    if (pglTexImage3D) {
+        pglTexImage3D = trace_tex_image_3d;
+    }
+    if (pglTexSubImage3D) {
+        pglTexSubImage3D = trace_tex_sub_image_3d;
+    }
+    unpack_buffer = 0;
+
+    cur_frame = (struct gl_trace_stats){0};
+    last_frame = (struct gl_trace_stats){0};
+    totals = (struct gl_trace_stats){0};
+    LOG_DEBUG("OpenGL call tracing is enabled%s", timing ? " with timing" : "");
+}
+
+void gl_trace_fini(void)
+{
+    /* Include calls made since the last frame, such as resource cleanup */
+    add_stats(&totals, &cur_frame);
+    dump_totals();
+
+#define DO(RETURN, NAME, ...) real_gl##NAME = NULL;
+    FOREACH_GL_FUNCTION(DO)
+    FOREACH_GL_OPTIONAL_FUNCTION(DO)
+#undef DO
+}
+
+void gl_trace_end_frame(void)
+{
+    cur_frame.frames = 1;
+    add_stats(&totals, &cur_frame);
+    last_frame = cur_frame;
+    cur_frame = (struct gl_trace_stats){0};
+}
+
+void gl_trace_set_timing(bool enable)
+{
+    timing = enable;
+}
+
+const char *gl_trace_get_function_name(enum gl_trace_function function)
+{
+    DASSERT(function >= 0 && function < GL_TRACE_NUM_FUNCTIONS);
+    return function_names[function];
+}
+
+const struct gl_trace_stats *gl_trace_get_last_frame(void)
+{
+    return &last_frame;
+}
+
+const struct gl_trace_stats *gl_trace_get_totals(void)
+{
+    return &totals;
+}
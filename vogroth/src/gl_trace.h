@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2021 Marty Mills <daggerbot@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_GL_TRACE_H
+#define INCLUDED_GL_TRACE_H
+
+#include "config.h"
+#include "gl_api.h"
+
+/*
+ * Optional instrumentation of OpenGL calls, enabled by configuring with
+ * -DVOGROTH_GL_TRACE=ON. When enabled, every 'pgl' function pointer is
+ * redirected through a wrapper which counts calls and, if timing is enabled,
+ * measures how long the driver took to return. Note that this is CPU time
+ * only; the GPU may do the actual work much later.
+ *
+ * When disabled, none of this is compiled and the functions below are no-ops.
+ */
+
+/* Indices of the traced functions */
+enum gl_trace_function {
+#define DO(RETURN, NAME, ...) GL_TRACE_##NAME,
+    FOREACH_GL_FUNCTION(DO)
+    FOREACH_GL_OPTIONAL_FUNCTION(DO)
+#undef DO
+    GL_TRACE_NUM_FUNCTIONS
+};
+
+struct gl_trace_call_stats {
+    uint64_t calls;
+    uint64_t time_ns; /* Only measured if timing is enabled */
+};
+
+struct gl_trace_stats {
+    uint64_t frames;
+    uint64_t draw_calls;
+    uint64_t vertices;     /* Vertices submitted by draw calls */
+    uint64_t upload_bytes; /* Bytes passed to texture and buffer uploads */
+    struct gl_trace_call_stats functions[GL_TRACE_NUM_FUNCTIONS];
+};
+
+#ifdef VOGROTH_GL_TRACE
+
+/*
+ * Called by gl_init_api after loading the function pointers, and by
+ * gl_fini_api before unloading them. The latter dumps the totals to stderr.
+ */
+void gl_trace_init(void);
+void gl_trace_fini(void);
+
+/* Called by render_end_frame */
+void gl_trace_end_frame(void);
+
+/* Timing is off by default, since reading the clock around every call has a cost of its own. */
+void gl_trace_set_timing(bool enable);
+
+const char *gl_trace_get_function_name(enum gl_trace_function function);
+
+/* Gets the stats of the last completed frame */
+const struct gl_trace_stats *gl_trace_get_last_frame(void);
+
+/* Gets the stats accumulated since gl_trace_init */
+const struct gl_trace_stats *gl_trace_get_totals(void);
+
+#else /* !defined(VOGROTH_GL_TRACE) */
+
+static inline void gl_trace_init(void) {}
+static inline void gl_trace_fini(void) {}
+static inline void gl_trace_end_frame(void) {}
+
+#endif /* !defined(VOGROTH_GL_TRACE) */
+
+#endif /* INCLUDED_GL_TRACE_H */
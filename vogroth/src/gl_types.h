@@ -17,6 +17,8 @@
 #ifndef INCLUDED_GL_TYPES_H
 #define INCLUDED_GL_TYPES_H
 
+#include <stdatomic.h>
+
 #include "pixbuf.h"
 
 /*
@@ -32,7 +34,9 @@ typedef unsigned int GLenum;
 typedef float GLfloat;
 typedef int GLint;
 typedef int GLsizei;
+typedef ptrdiff_t GLsizeiptr;
 typedef unsigned int GLuint;
+typedef uint64_t GLuint64;
 typedef void GLvoid;
 
 struct sprite_vertex {
@@ -45,13 +49,34 @@ struct sprite_vertex {
 struct sprite_batch {
     int num_sprites;
     int num_verts;
+    int capacity; /* In sprites */
     struct sprite_vertex *verts;
+
+    /* Set between sprite_batch_begin_fill and sprite_batch_end_fill */
+    bool filling;
+    atomic_int num_claimed;
+
+    /*
+     * Vertex buffer and vertex array object, which are only used if
+     * gl_caps.vertex_array_object is set. They're created on first use.
+     */
+    GLuint vbo;
+    GLuint vao;
+    bool dirty; /* verts have changed since they were uploaded to vbo */
+    unsigned depth_segment; /* Last segment of depth-tested passes which used the batch, in render.c */
 };
 
 struct texture {
-    GLuint id;
-    struct vec2i size;
+    GLuint id; /* 0 while evicted */
+    struct vec2i size; /* Of each layer, for arrays */
     enum pixel_format format;
+    int num_layers; /* 0 for a 2D texture, otherwise it's a GL_TEXTURE_2D_ARRAY */
+
+    /* Residency, which is managed on the main thread */
+    void(*restore)(struct texture *texture, void *data); /* Evictable if set */
+    void *restore_data;
+    unsigned last_used_frame;
+    struct texture *prev, *next; /* All textures, from least to most recently used */
 };
 
 #endif /* INCLUDED_GL_TYPES_H */
@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2021 Marty Mills <daggerbot@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_HASH_H
+#define INCLUDED_HASH_H
+
+#include <string.h>
+
+#include "types.h"
+
+/*
+ * 64-bit FNV-1a hash. Not cryptographically secure, but fast and good enough
+ * for cache keys. Pass HASH_INIT for the first block of data and the previous
+ * result for each subsequent block.
+ */
+#define HASH_INIT UINT64_C(0xCBF29CE484222325)
+#define HASH_PRIME UINT64_C(0x00000100000001B3)
+
+static inline uint64_t hash_bytes(uint64_t hash, size_t size, const void *data)
+{
+    const uint8_t *p = data;
+    size_t i;
+
+    for (i = 0; i < size; ++i) {
+        hash = (hash ^ p[i]) * HASH_PRIME;
+    }
+    return hash;
+}
+
+/* Hashes a string including its terminating null byte, so that concatenated strings hash differently. */
+static inline uint64_t hash_str(uint64_t hash, const char *str)
+{
+    return hash_bytes(hash, str ? strlen(str) + 1 : 0, str);
+}
+
+#endif /* INCLUDED_HASH_H */
@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2021 Marty Mills <daggerbot@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "assets.h"
+#include "debug.h"
+#include "hotreload.h"
+#include "memory.h"
+#include "redraw.h"
+#include "system.h"
+
+struct listener {
+    char *name;
+    hotreload_callback_t callback; /* NULL if it was unwatched while dispatching */
+    void *data;
+};
+
+static struct system_watch *watch = NULL;
+static struct listener *listeners = NULL;
+static int num_listeners = 0;
+static bool dispatching = false;
+
+/* Frees the listeners which were unwatched while dispatching. */
+static void remove_dead_listeners(void)
+{
+    int i, j = 0;
+
+    for (i = 0; i < num_listeners; ++i) {
+        if (listeners[i].callback) {
+            listeners[j++] = listeners[i];
+        } else {
+            mem_free(listeners[i].name);
+        }
+    }
+    num_listeners = j;
+}
+
+void hotreload_init(void)
+{
+    const char *dir = assets_get_dir();
+    char *err = NULL;
+
+    if (watch) {
+        return;
+    }
+    if (!dir) {
+        FATAL("Hot reloading requires a loose assets directory");
+    }
+    watch = system_watch_create(dir, &err);
+    if (!watch) {
+        FATAL("%s: %s", dir, err);
+    }
+    LOG_DEBUG("Watching for asset changes in: %s", dir);
+}
+
+void hotreload_fini(void)
+{
+    int i;
+
+    system_watch_destroy(watch);
+    watch = NULL;
+    for (i = 0; i < num_listeners; ++i) {
+        mem_free(listeners[i].name);
+    }
+    listeners = mem_free(listeners);
+    num_listeners = 0;
+}
+
+bool hotreload_enabled(void)
+{
+    return watch != NULL;
+}
+
+static void handle_change(const char *path, UNUSED void *data)
+{
+    int i;
+
+    LOG_DEBUG("Asset modified: %s", path);
+
+    /*
+     * Callbacks may watch, which appends, or unwatch, which only marks the
+     * listeners dead until the loop is done, so the indices stay valid.
+     */
+    dispatching = true;
+    for (i = 0; i < num_listeners; ++i) {
+        if (listeners[i].callback && !strcmp(listeners[i].name, path)) {
+            listeners[i].callback(path, listeners[i].data);
+            redraw_request();
+        }
+    }
+    dispatching = false;
+    remove_dead_listeners();
+}
+
+void hotreload_poll(void)
+{
+    if (watch) {
+        system_watch_poll(watch, &handle_change, NULL);
+    }
+}
+
+void hotreload_watch(const char *name, hotreload_callback_t callback, void *data)
+{
+    int i;
+
+    DASSERT(name && callback);
+    if (!watch) {
+        return;
+    }
+    for (i = 0; i < num_listeners; ++i) {
+        if (listeners[i].callback == callback && listeners[i].data == data && !strcmp(listeners[i].name, name)) {
+            return;
+        }
+    }
+    listeners = mem_realloc_array(listeners, (size_t)num_listeners + 1, sizeof(*listeners));
+    listeners[num_listeners++] = (struct listener) {
+        .name = str_clone(name),
+        .callback = callback,
+        .data = data,
+    };
+}
+
+void hotreload_unwatch(hotreload_callback_t callback, void *data)
+{
+    int i;
+
+    DASSERT(callback != NULL);
+    for (i = 0; i < num_listeners; ++i) {
+        if (listeners[i].callback == callback && listeners[i].data == data) {
+            listeners[i].callback = NULL;
+        }
+    }
+    if (!dispatching) {
+        remove_dead_listeners();
+    }
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2021 Marty Mills <daggerbot@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_HOTRELOAD_H
+#define INCLUDED_HOTRELOAD_H
+
+#include "types.h"
+
+/*
+ * Development mode which watches the loose assets directory and notifies the
+ * owners of modified assets so that they can reload them in place. Reloads
+ * only happen from hotreload_poll, which is called between frames.
+ */
+typedef void(*hotreload_callback_t)(const char *name, void *data);
+
+void hotreload_init(void);
+void hotreload_fini(void);
+bool hotreload_enabled(void);
+void hotreload_poll(void);
+
+/*
+ * Registers a callback for when the named asset is modified. Does nothing if
+ * hot reloading isn't enabled.
+ */
+void hotreload_watch(const char *name, hotreload_callback_t callback, void *data);
+void hotreload_unwatch(hotreload_callback_t callback, void *data);
+
+#endif /* INCLUDED_HOTRELOAD_H */
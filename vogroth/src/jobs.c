@@ -0,0 +1,407 @@
+/*
+ * Copyright (c) 2021 Marty Mills <daggerbot@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+
+#include <SDL_cpuinfo.h>
+#include <SDL_mutex.h>
+#include <SDL_thread.h>
+
+#include "cpu.h"
+#include "debug.h"
+#include "jobs.h"
+#include "math.h"
+#include "memory.h"
+#include "system.h"
+
+#ifdef CPU_X86
+# include <immintrin.h>
+#endif
+
+#define CACHE_LINE_SIZE 64
+#define WAIT_BACKOFF_ROUNDS 10 /* Of exponentially longer spins in jobs_wait before it yields instead */
+
+STATIC_ASSERT((JOBS_DEQUE_SIZE & (JOBS_DEQUE_SIZE - 1)) == 0);
+
+struct job {
+    job_fn_t fn;
+    void *data;
+    struct job_counter *counter;
+};
+
+/*
+ * A thief may read a slot while the owner is overwriting it, in which case it
+ * throws the job away, so the fields are relaxed atomics to make that well
+ * defined. They compile to plain loads and stores.
+ */
+struct deque_slot {
+    _Atomic(job_fn_t) fn;
+    _Atomic(void *) data;
+    _Atomic(struct job_counter *) counter;
+};
+
+/*
+ * Chase-Lev deque with a fixed-size ring, using the C11 memory orderings from
+ * "Correct and Efficient Work-Stealing for Weak Memory Models" (Lê et al.).
+ * top and bottom are kept on separate cache lines, since thieves hammer the
+ * former and the owner the latter.
+ */
+struct deque {
+    _Atomic int64_t top;
+    char pad0[CACHE_LINE_SIZE - sizeof(int64_t)];
+    _Atomic int64_t bottom;
+    char pad1[CACHE_LINE_SIZE - sizeof(int64_t)];
+    struct deque_slot slots[JOBS_DEQUE_SIZE];
+};
+
+static void write_slot(struct deque *deque, int64_t index, const struct job *job)
+{
+    struct deque_slot *slot = &deque->slots[index & (JOBS_DEQUE_SIZE - 1)];
+
+    atomic_store_explicit(&slot->fn, job->fn, memory_order_relaxed);
+    atomic_store_explicit(&slot->data, job->data, memory_order_relaxed);
+    atomic_store_explicit(&slot->counter, job->counter, memory_order_relaxed);
+}
+
+static void read_slot(struct deque *deque, int64_t index, struct job *out_job)
+{
+    struct deque_slot *slot = &deque->slots[index & (JOBS_DEQUE_SIZE - 1)];
+
+    out_job->fn = atomic_load_explicit(&slot->fn, memory_order_relaxed);
+    out_job->data = atomic_load_explicit(&slot->data, memory_order_relaxed);
+    out_job->counter = atomic_load_explicit(&slot->counter, memory_order_relaxed);
+}
+
+struct worker {
+    struct deque *deque;
+    SDL_Thread *thread; /* NULL for the main thread */
+    uint32_t random;    /* For picking victims to steal from */
+};
+
+static struct worker workers[JOBS_MAX_THREADS];
+static int num_threads = 0;
+static SDL_sem *wake_sem = NULL;
+static atomic_int num_sleeping;
+static atomic_bool quit;
+
+/* Index into workers of the current thread, or -1 if it isn't one of ours */
+static THREAD_LOCAL int worker_index = -1;
+
+/* Called only by the owner. Fails if the deque is full. */
+static bool deque_push(struct deque *deque, const struct job *job)
+{
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+
+    if (bottom - top >= JOBS_DEQUE_SIZE) {
+        return false;
+    }
+    write_slot(deque, bottom, job);
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_release);
+    return true;
+}
+
+/* Called only by the owner. Takes the most recently pushed job. */
+static bool deque_pop(struct deque *deque, struct job *out_job)
+{
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    int64_t top;
+    bool found = true;
+
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+    if (top > bottom) {
+        /* Empty */
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        return false;
+    }
+    read_slot(deque, bottom, out_job);
+    if (top == bottom) {
+        /* Last job, so race the thieves for it */
+        found = atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                                        memory_order_seq_cst, memory_order_relaxed);
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    }
+    return found;
+}
+
+/* Called by any other thread. Takes the oldest job. */
+static bool deque_steal(struct deque *deque, struct job *out_job)
+{
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    int64_t bottom;
+
+    atomic_thread_fence(memory_order_seq_cst);
+    bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+    if (top >= bottom) {
+        return false;
+    }
+
+    /*
+     * The owner can only overwrite this slot after top has moved on, in which
+     * case the copy is discarded because the exchange fails.
+     */
+    read_slot(deque, top, out_job);
+    return atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                                   memory_order_seq_cst, memory_order_relaxed);
+}
+
+static uint32_t next_random(uint32_t *state)
+{
+    /* xorshift32 */
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+static bool find_job(int index, struct job *out_job)
+{
+    struct worker *self = &workers[index];
+    int start, i, victim;
+
+    if (deque_pop(self->deque, out_job)) {
+        return true;
+    }
+    if (num_threads < 2) {
+        return false;
+    }
+    start = (int)(next_random(&self->random) % (uint32_t)num_threads);
+    for (i = 0; i < num_threads; ++i) {
+        victim = (start + i) % num_threads;
+        if (victim != index && deque_steal(workers[victim].deque, out_job)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void run_job(const struct job *job)
+{
+    job->fn(job->data);
+    atomic_fetch_sub_explicit(&job->counter->pending, 1, memory_order_release);
+}
+
+/* Hints to the CPU that we're spinning, which saves power and lets a sibling hyperthread run. */
+static void spin_pause(void)
+{
+#if defined(CPU_X86)
+    _mm_pause();
+#elif defined(__GNUC__) && (defined(__aarch64__) || defined(__arm__))
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/*
+ * Before sleeping, a worker announces it in num_sleeping and then looks for
+ * jobs once more. jobs_run pushes and then checks num_sleeping. With a
+ * seq_cst fence between the write and the read on both sides, at least one
+ * of them sees the other's write, so a job can't be pushed without either
+ * the worker finding it or jobs_run waking the worker. That lets idle
+ * workers sleep without a timeout.
+ */
+static int worker_main(void *data)
+{
+    struct job job;
+
+    worker_index = (int)(intptr_t)data;
+    while (!atomic_load_explicit(&quit, memory_order_acquire)) {
+        if (find_job(worker_index, &job)) {
+            run_job(&job);
+            continue;
+        }
+        atomic_fetch_add_explicit(&num_sleeping, 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (find_job(worker_index, &job)) {
+            atomic_fetch_sub_explicit(&num_sleeping, 1, memory_order_relaxed);
+            run_job(&job);
+            continue;
+        }
+        if (!atomic_load_explicit(&quit, memory_order_acquire)) {
+            SDL_SemWait(wake_sem);
+        }
+        atomic_fetch_sub_explicit(&num_sleeping, 1, memory_order_relaxed);
+    }
+    return 0;
+}
+
+void jobs_init(int count)
+{
+    char name[16];
+    int i;
+
+    ASSERT(!num_threads);
+    ASSERT(count >= 0);
+    if (!count) {
+        count = SDL_GetCPUCount();
+    }
+    num_threads = min_int(max_int(count, 1), JOBS_MAX_THREADS);
+
+    wake_sem = SDL_CreateSemaphore(0);
+    if (!wake_sem) {
+        FATAL("Can't create semaphore: %s", SDL_GetError());
+    }
+    atomic_init(&num_sleeping, 0);
+    atomic_init(&quit, false);
+
+    for (i = 0; i < num_threads; ++i) {
+        workers[i].deque = mem_alloc(sizeof(struct deque));
+        atomic_init(&workers[i].deque->top, 0);
+        atomic_init(&workers[i].deque->bottom, 0);
+        workers[i].thread = NULL;
+        workers[i].random = 0x9E3779B9u * (uint32_t)(i + 1);
+    }
+
+    worker_index = 0;
+    for (i = 1; i < num_threads; ++i) {
+        snprintf(name, sizeof(name), "jobs%d", i);
+        workers[i].thread = SDL_CreateThread(&worker_main, name, (void *)(intptr_t)i);
+        if (!workers[i].thread) {
+            FATAL("Can't create job thread: %s", SDL_GetError());
+        }
+    }
+    LOG_DEBUG("Started job system with %d threads", num_threads);
+}
+
+void jobs_fini(void)
+{
+    int i;
+
+    if (!num_threads) {
+        return;
+    }
+    atomic_store_explicit(&quit, true, memory_order_release);
+    for (i = 1; i < num_threads; ++i) {
+        SDL_SemPost(wake_sem);
+    }
+    for (i = 1; i < num_threads; ++i) {
+        SDL_WaitThread(workers[i].thread, NULL);
+    }
+    for (i = 0; i < num_threads; ++i) {
+        /* Jobs must always be waited for, so there can't be any left. */
+        DASSERT(atomic_load(&workers[i].deque->top) == atomic_load(&workers[i].deque->bottom));
+        workers[i].deque = mem_free(workers[i].deque);
+        workers[i].thread = NULL;
+    }
+    SDL_DestroySemaphore(wake_sem);
+    wake_sem = NULL;
+    worker_index = -1;
+    num_threads = 0;
+}
+
+int jobs_get_num_threads(void)
+{
+    return num_threads;
+}
+
+void jobs_run(job_fn_t fn, void *data, struct job_counter *counter)
+{
+    struct job job = {fn, data, counter};
+
+    DASSERT(fn && counter);
+    ASSERT(worker_index >= 0); /* Only the main thread and jobs can start jobs */
+
+    atomic_fetch_add_explicit(&counter->pending, 1, memory_order_relaxed);
+    if (num_threads < 2 || !deque_push(workers[worker_index].deque, &job)) {
+        run_job(&job);
+        return;
+    }
+    /* See worker_main */
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&num_sleeping, memory_order_relaxed) > 0) {
+        SDL_SemPost(wake_sem);
+    }
+}
+
+/*
+ * Helps with other jobs while waiting. When there are none, the remaining
+ * ones are usually about to finish, so spin for a little while before
+ * yielding the CPU.
+ */
+void jobs_wait(struct job_counter *counter)
+{
+    struct job job;
+    int backoff = 0;
+    int i;
+
+    DASSERT(counter != NULL);
+    ASSERT(worker_index >= 0);
+
+    while (atomic_load_explicit(&counter->pending, memory_order_acquire) > 0) {
+        if (find_job(worker_index, &job)) {
+            run_job(&job);
+            backoff = 0;
+        } else if (backoff < WAIT_BACKOFF_ROUNDS) {
+            for (i = 0; i < 1 << backoff; ++i) {
+                spin_pause();
+            }
+            ++backoff;
+        } else {
+            system_yield();
+        }
+    }
+}
+
+struct parallel_for {
+    job_range_fn_t fn;
+    void *data;
+    int count;
+    int grain;
+    _Atomic int64_t next; /* Start of the next range nobody has taken */
+};
+
+static void parallel_for_job(void *data)
+{
+    struct parallel_for *pf = data;
+    int64_t begin, end;
+
+    while ((begin = atomic_fetch_add_explicit(&pf->next, pf->grain, memory_order_relaxed)) < pf->count) {
+        end = begin + pf->grain;
+        pf->fn(pf->data, (int)begin, end < pf->count ? (int)end : pf->count);
+    }
+}
+
+void jobs_parallel_for(int count, int grain, job_range_fn_t fn, void *data)
+{
+    struct parallel_for pf;
+    struct job_counter counter = JOB_COUNTER_INIT;
+    int num_ranges, num_jobs, i;
+
+    DASSERT(count >= 0 && grain >= 0 && fn);
+    if (!count) {
+        return;
+    }
+    if (!grain) {
+        grain = max_int(1, count / (num_threads * 4));
+    }
+
+    pf.fn = fn;
+    pf.data = data;
+    pf.count = count;
+    pf.grain = grain;
+    atomic_init(&pf.next, 0);
+
+    /* The ranges are handed out dynamically, so one job per thread is enough. */
+    num_ranges = count / grain + (count % grain != 0);
+    num_jobs = min_int(num_ranges, num_threads);
+    for (i = 1; i < num_jobs; ++i) {
+        jobs_run(&parallel_for_job, &pf, &counter);
+    }
+    parallel_for_job(&pf);
+    jobs_wait(&counter);
+}
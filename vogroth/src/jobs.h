@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2021 Marty Mills <daggerbot@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_JOBS_H
+#define INCLUDED_JOBS_H
+
+#include <stdatomic.h>
+
+#include "types.h"
+
+/*
+ * Work-stealing job system. Each thread, including the main thread, has its
+ * own deque of jobs. Threads push and pop jobs at the bottom of their own
+ * deque, and steal from the top of the others' when theirs is empty.
+ *
+ * Jobs can only be started from the main thread or from other jobs. Every job
+ * belongs to a counter, which can be waited on to join everything started
+ * with it. Waiting threads run jobs in the meantime, so jobs can start and
+ * wait on jobs of their own without tying up a thread.
+ */
+#define JOBS_MAX_THREADS 64
+#define JOBS_DEQUE_SIZE 4096 /* Must be a power of 2. Jobs run immediately if the deque is full. */
+
+typedef void(*job_fn_t)(void *data);
+
+/* Runs the part of a parallel_for in [begin, end). */
+typedef void(*job_range_fn_t)(void *data, int begin, int end);
+
+struct job_counter {
+    atomic_int pending;
+};
+#define JOB_COUNTER_INIT {0}
+
+/*
+ * Starts the worker threads. num_threads includes the calling thread, which
+ * becomes the main thread. If it's 0, one thread per CPU core is used.
+ */
+void jobs_init(int num_threads);
+void jobs_fini(void);
+int jobs_get_num_threads(void);
+
+/* Starts a job, which may run on any thread. Increments counter until it has finished. */
+void jobs_run(job_fn_t fn, void *data, struct job_counter *counter);
+
+/* Runs other jobs until every job started with the counter has finished. */
+void jobs_wait(struct job_counter *counter);
+
+/*
+ * Calls fn for ranges of [0, count) in parallel, and waits for all of them.
+ * Each range is at most grain long, or if grain is 0, a few ranges are made
+ * for each thread.
+ */
+void jobs_parallel_for(int count, int grain, job_range_fn_t fn, void *data);
+
+#endif /* INCLUDED_JOBS_H */
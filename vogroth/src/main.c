@@ -14,6 +14,8 @@
  * this program. If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #ifdef _WIN32
 # include <windows.h>
@@ -22,14 +24,34 @@
 #include <SDL_events.h>
 
 #include "assets.h"
+#include "benchmark.h"
+#include "cpu.h"
 #include "debug.h"
+#include "gl_trace.h"
+#include "hotreload.h"
+#include "jobs.h"
+#include "memory.h"
+#include "pacing.h"
+#include "pixbuf.h"
+#include "png.h"
+#include "redraw.h"
 #include "render.h"
+#include "render_thread.h"
 #include "sandbox.h"
+#include "sim.h"
 #include "system.h"
+#include "texture.h"
 #include "unicode.h"
 #include "video.h"
 
+#define DEFAULT_HEADLESS_WIDTH 640
+#define DEFAULT_HEADLESS_HEIGHT 480
+#define DEFAULT_HEADLESS_FRAMES 1
+#define DEFAULT_BENCHMARK_FRAMES 1000
+#define HOTRELOAD_POLL_INTERVAL_MS 100
+
 static bool quit_requested = false;
+static bool continuous = false; /* Redraw every frame even if nothing changed */
 
 static void handle_window_event(const SDL_WindowEvent *event)
 {
@@ -39,6 +61,8 @@ static void handle_window_event(const SDL_WindowEvent *event)
         break;
 
     default:
+        /* Resizes, exposes, etc. may all need the window contents to be redrawn. */
+        redraw_request();
         break;
     }
 }
@@ -54,16 +78,73 @@ static void handle_event(const SDL_Event *event)
         handle_window_event(&event->window);
         break;
 
+    case SDL_KEYDOWN:
+    case SDL_KEYUP:
+    case SDL_MOUSEBUTTONDOWN:
+    case SDL_MOUSEBUTTONUP:
+    case SDL_MOUSEMOTION:
+    case SDL_MOUSEWHEEL:
+        redraw_request();
+        break;
+
     default:
         break;
     }
 }
 
+static void render_frame(void)
+{
+    redraw_begin_frame();
+    texture_begin_frame();
+    render_begin_frame();
+    sandbox_render();
+    render_end_frame();
+    render_present();
+}
+
+/* Pacing happens when presenting, which may be on the render thread. */
+static void reset_pacing(UNUSED void *data)
+{
+    pacing_reset();
+}
+
+/*
+ * Blocks until an event arrives or the next scheduled redraw is due, and
+ * handles the event if there was one. Hot reloading needs to be polled, so it
+ * limits how long we can wait.
+ */
+static void wait_for_redraw(void)
+{
+    SDL_Event event;
+    int timeout = redraw_get_timeout_ms();
+    bool idle = timeout < 0; /* Nothing is animating */
+
+    if (hotreload_enabled() && (timeout < 0 || timeout > HOTRELOAD_POLL_INTERVAL_MS)) {
+        timeout = HOTRELOAD_POLL_INTERVAL_MS;
+    }
+    if (SDL_WaitEventTimeout(&event, timeout)) {
+        handle_event(&event);
+    }
+
+    /*
+     * If nothing was animating, don't count the time we spent idle against the
+     * frame limiter, and don't make the simulation catch up on it either. A
+     * wait for a scheduled redraw is part of normal pacing and is left alone.
+     */
+    if (idle) {
+        render_thread_run(&reset_pacing, NULL);
+        sim_resync();
+    }
+}
+
 static void main_loop(void)
 {
     SDL_Event event;
 
     while (!quit_requested) {
+        if (!continuous && !redraw_is_due()) {
+            wait_for_redraw();
+        }
         while (SDL_PollEvent(&event)) {
             handle_event(&event);
             if (quit_requested) {
@@ -71,19 +152,76 @@ static void main_loop(void)
             }
         }
 
-        render_begin_frame();
-        sandbox_render();
-        render_end_frame();
-        video_swap_buffers();
+        hotreload_poll();
+        sim_advance();
+        if (continuous || redraw_is_due()) {
+            render_frame();
+        }
     }
 }
 
+/*
+ * Renders a fixed number of frames offscreen, reports how long that took, and
+ * optionally saves the last frame so that it can be compared with a golden
+ * image (see tools/imgdiff.py).
+ */
+static void headless_loop(int num_frames, const char *capture_path)
+{
+    struct pixbuf frame = PIXBUF_INIT;
+    uint64_t start_time, elapsed;
+    char *err = NULL;
+    int i;
+
+    start_time = system_get_time_ns();
+    for (i = 0; i < num_frames; ++i) {
+        /* One tick per frame, so that captures don't depend on timing. */
+        sim_step();
+        render_frame();
+    }
+    render_finish();
+    elapsed = system_get_time_ns() - start_time;
+    printf("Rendered %d frames in %.3f ms (%.3f ms/frame)\n",
+           num_frames, (double)elapsed / 1e6, (double)elapsed / 1e6 / num_frames);
+
+    if (capture_path) {
+        render_read_frame(&frame);
+        if (!png_save(&frame, capture_path, &err)) {
+            FATAL("Can't save %s: %s", capture_path, err);
+        }
+        pixbuf_fini(&frame);
+    }
+}
+
+static int parse_int_arg(const char *option, const char *arg, int min)
+{
+    char *end;
+    long value;
+
+    value = strtol(arg, &end, 10);
+    if (end == arg || *end || value < min || value > INT_MAX) {
+        FATAL("Invalid argument for %s: %s", option, arg);
+    }
+    return (int)value;
+}
+
 /*
  * Common main function used on all platforms.
  */
 static int vogroth_main(int argc, char **argv)
 {
     const char *assets_path = NULL;
+    bool hotreload = false;
+    bool gpu_timers = false;
+    bool render_thread = false;
+    bool depth_passes = false;
+    bool headless = false;
+    struct vec2i headless_size = {DEFAULT_HEADLESS_WIDTH, DEFAULT_HEADLESS_HEIGHT};
+    int num_frames = 0;
+    int fps_limit = -1;
+    int num_threads = 0;
+    int texture_budget_mb = -1;
+    const char *capture_path = NULL;
+    const char *benchmark_scene = NULL;
     int i;
 
     system_init_console();
@@ -94,6 +232,66 @@ static int vogroth_main(int argc, char **argv)
                 FATAL("Missing argument for %s", argv[i]);
             }
             assets_path = argv[++i];
+        } else if (!strcmp(argv[i], "-hotreload")) {
+            hotreload = true;
+        } else if (!strcmp(argv[i], "-continuous")) {
+            continuous = true;
+        } else if (!strcmp(argv[i], "-headless")) {
+            headless = true;
+        } else if (!strcmp(argv[i], "-benchmark")) {
+            if (i + 1 >= argc) {
+                FATAL("Missing argument for %s", argv[i]);
+            }
+            benchmark_scene = argv[++i];
+        } else if (!strcmp(argv[i], "-size")) {
+            if (i + 1 >= argc) {
+                FATAL("Missing argument for %s", argv[i]);
+            }
+            if (sscanf(argv[i + 1], "%dx%d", &headless_size.x, &headless_size.y) != 2
+                || headless_size.x <= 0 || headless_size.y <= 0)
+            {
+                FATAL("Invalid argument for %s: %s", argv[i], argv[i + 1]);
+            }
+            ++i;
+        } else if (!strcmp(argv[i], "-frames")) {
+            if (i + 1 >= argc) {
+                FATAL("Missing argument for %s", argv[i]);
+            }
+            num_frames = parse_int_arg(argv[i], argv[i + 1], 1);
+            ++i;
+        } else if (!strcmp(argv[i], "-fps")) {
+            if (i + 1 >= argc) {
+                FATAL("Missing argument for %s", argv[i]);
+            }
+            fps_limit = parse_int_arg(argv[i], argv[i + 1], 0);
+            ++i;
+        } else if (!strcmp(argv[i], "-threads")) {
+            if (i + 1 >= argc) {
+                FATAL("Missing argument for %s", argv[i]);
+            }
+            num_threads = parse_int_arg(argv[i], argv[i + 1], 1);
+            ++i;
+        } else if (!strcmp(argv[i], "-texture-budget")) {
+            if (i + 1 >= argc) {
+                FATAL("Missing argument for %s", argv[i]);
+            }
+            texture_budget_mb = parse_int_arg(argv[i], argv[i + 1], 0);
+            ++i;
+        } else if (!strcmp(argv[i], "-capture")) {
+            if (i + 1 >= argc) {
+                FATAL("Missing argument for %s", argv[i]);
+            }
+            capture_path = argv[++i];
+        } else if (!strcmp(argv[i], "-gpu-timers")) {
+            gpu_timers = true;
+        } else if (!strcmp(argv[i], "-render-thread")) {
+            render_thread = true;
+        } else if (!strcmp(argv[i], "-depth-passes")) {
+            depth_passes = true;
+#ifdef VOGROTH_GL_TRACE
+        } else if (!strcmp(argv[i], "-gl-timing")) {
+            gl_trace_set_timing(true);
+#endif
         } else if (argv[i][0] == '-') {
             FATAL("Invalid option: %s", argv[i]);
         } else {
@@ -101,19 +299,63 @@ static int vogroth_main(int argc, char **argv)
         }
     }
 
+    if (capture_path && (!headless || benchmark_scene)) {
+        FATAL("-capture requires -headless and can't be used with -benchmark");
+    }
+    if (!num_frames) {
+        num_frames = benchmark_scene ? DEFAULT_BENCHMARK_FRAMES : DEFAULT_HEADLESS_FRAMES;
+    }
+
     LOG_DEBUG("Initializing...");
+    cpu_init();
     assets_init(assets_path);
+    jobs_init(num_threads);
+    if (hotreload) {
+        hotreload_init();
+    }
+    if (headless) {
+        video_set_headless(headless_size);
+    }
+    if (benchmark_scene) {
+        video_disable_throttling();
+    }
+    if (fps_limit >= 0) {
+        video_set_fps_limit(fps_limit);
+    }
+    if (depth_passes) {
+        render_enable_depth_passes();
+    }
     video_init();
+    if (gpu_timers) {
+        render_enable_gpu_timers();
+    }
+    if (render_thread) {
+        render_enable_thread();
+    }
     render_init();
+    if (texture_budget_mb >= 0) {
+        texture_set_memory_budget((size_t)texture_budget_mb << 20, TEXTURE_DEFAULT_EVICT_FRAMES);
+    }
     sandbox_init();
+    sim_init(sandbox_update);
 
     LOG_DEBUG("Game started!");
-    main_loop();
+    if (benchmark_scene) {
+        benchmark_run(benchmark_scene, num_frames);
+    } else if (headless) {
+        headless_loop(num_frames, capture_path);
+    } else {
+        main_loop();
+    }
 
     LOG_DEBUG("Shutting down...");
+    sim_fini();
     sandbox_fini();
+    texture_fini();
     render_fini();
     video_fini();
+    hotreload_fini();
+    jobs_fini();
     assets_fini();
     system_fini_paths();
     system_fini_console();
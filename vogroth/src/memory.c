@@ -14,6 +14,7 @@
  * this program. If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -25,6 +26,11 @@
 #include "memory.h"
 #include "system.h"
 
+/* Any thread can allocate, so these are atomic. Relaxed order is enough for counting. */
+static atomic_uint_least64_t num_allocs = 0;
+static atomic_uint_least64_t num_reallocs = 0;
+static atomic_uint_least64_t num_frees = 0;
+
 static NORETURN void alloc_failed(void)
 {
     system_show_error_native(OSSTR "Allocation failed");
@@ -46,8 +52,10 @@ void *mem_realloc(void *mem, size_t size)
     if (size) {
         if (mem) {
             mem = realloc(mem, size);
+            atomic_fetch_add_explicit(&num_reallocs, 1, memory_order_relaxed);
         } else {
             mem = malloc(size);
+            atomic_fetch_add_explicit(&num_allocs, 1, memory_order_relaxed);
         }
         if (!mem) {
             alloc_failed();
@@ -70,10 +78,20 @@ void *mem_free(void *mem)
 {
     if (mem) {
         free(mem);
+        atomic_fetch_add_explicit(&num_frees, 1, memory_order_relaxed);
     }
     return NULL;
 }
 
+struct mem_stats mem_get_stats(void)
+{
+    return (struct mem_stats) {
+        .allocs = atomic_load_explicit(&num_allocs, memory_order_relaxed),
+        .reallocs = atomic_load_explicit(&num_reallocs, memory_order_relaxed),
+        .frees = atomic_load_explicit(&num_frees, memory_order_relaxed),
+    };
+}
+
 void buf_alloc(struct buf *buf, size_t size)
 {
     DASSERT(buf != NULL);
@@ -28,12 +28,24 @@ struct buf {
 #define BUF_INIT {0}
 #define BUF_NULL ((struct buf)BUF_INIT)
 
+/* Counts of heap operations since startup, used by benchmarks */
+struct mem_stats {
+    uint64_t allocs;
+    uint64_t reallocs;
+    uint64_t frees;
+};
+#define MEM_STATS_INIT {0}
+#define MEM_STATS_NULL ((struct mem_stats)MEM_STATS_INIT)
+
 void *mem_alloc(size_t size);
 void *mem_alloc_array(size_t n, size_t size);
 void *mem_realloc(void *mem, size_t size);
 void *mem_realloc_array(void *mem, size_t n, size_t size);
 void *mem_free(void *mem);
 
+/* Gets the counts so far, from all threads. */
+struct mem_stats mem_get_stats(void);
+
 void buf_alloc(struct buf *buf, size_t size);
 void buf_fini(struct buf *buf);
 /* Ensure a terminating null byte (does not contribute to len) */
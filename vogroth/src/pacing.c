@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2021 Marty Mills <daggerbot@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "debug.h"
+#include "pacing.h"
+#include "system.h"
+
+#define INITIAL_SLEEP_MARGIN_NS 1000000u /* 1 ms */
+#define MIN_SLEEP_MARGIN_NS 100000u      /* 0.1 ms */
+
+static uint64_t period_ns = 0; /* 0 if disabled */
+static uint64_t next_deadline = 0;
+static uint64_t last_frame_end = 0;
+static struct pacing_stats stats;
+
+static void record_frame(uint64_t frame_ns)
+{
+    uint64_t bucket = frame_ns / (PACING_HISTOGRAM_BUCKET_US * 1000u);
+
+    if (bucket >= PACING_HISTOGRAM_BUCKETS) {
+        bucket = PACING_HISTOGRAM_BUCKETS - 1;
+    }
+    ++stats.histogram[bucket];
+    if (!stats.frames || frame_ns < stats.min_frame_ns) {
+        stats.min_frame_ns = frame_ns;
+    }
+    if (frame_ns > stats.max_frame_ns) {
+        stats.max_frame_ns = frame_ns;
+    }
+    stats.total_frame_ns += frame_ns;
+    ++stats.frames;
+}
+
+/*
+ * Sleeps until roughly sleep_margin_ns before the deadline, and adjusts the
+ * margin to cover how much the sleep overshot. The margin decays slowly so
+ * that one bad wakeup doesn't make us spin for the rest of the session.
+ */
+static void sleep_until(uint64_t deadline)
+{
+    uint64_t now = system_get_time_ns();
+    uint64_t request, overshoot;
+
+    while (now + stats.sleep_margin_ns < deadline) {
+        request = deadline - stats.sleep_margin_ns - now;
+        system_sleep_ns(request);
+        overshoot = system_get_time_ns() - now;
+        overshoot = overshoot > request ? overshoot - request : 0;
+        now += request + overshoot;
+
+        if (overshoot + MIN_SLEEP_MARGIN_NS > stats.sleep_margin_ns) {
+            stats.sleep_margin_ns = overshoot + MIN_SLEEP_MARGIN_NS;
+        } else {
+            stats.sleep_margin_ns -= (stats.sleep_margin_ns - MIN_SLEEP_MARGIN_NS) / 64;
+        }
+    }
+}
+
+void pacing_init(int target_fps)
+{
+    ASSERT(target_fps >= 0);
+    period_ns = target_fps ? 1000000000u / (uint64_t)target_fps : 0;
+    next_deadline = 0;
+    last_frame_end = 0;
+    stats = (struct pacing_stats){.sleep_margin_ns = INITIAL_SLEEP_MARGIN_NS};
+    if (period_ns) {
+        LOG_DEBUG("Limiting frame rate to %d FPS", target_fps);
+    }
+}
+
+void pacing_fini(void)
+{
+    if (stats.frames) {
+        LOG_DEBUG("Frame pacing: %" PRIu64 " frames, %.3f ms average, %.3f-%.3f ms range, %" PRIu64
+                  " missed deadlines", stats.frames, (double)stats.total_frame_ns / (double)stats.frames / 1e6,
+                  (double)stats.min_frame_ns / 1e6, (double)stats.max_frame_ns / 1e6, stats.missed_deadlines);
+    }
+    period_ns = 0;
+}
+
+bool pacing_enabled(void)
+{
+    return period_ns != 0;
+}
+
+void pacing_wait(void)
+{
+    uint64_t now;
+
+    if (!period_ns) {
+        return;
+    }
+
+    now = system_get_time_ns();
+    if (!next_deadline) {
+        /* First frame: nothing to pace against yet */
+        next_deadline = now + period_ns;
+        last_frame_end = now;
+        return;
+    }
+
+    if (now < next_deadline) {
+        sleep_until(next_deadline);
+        do {
+            now = system_get_time_ns();
+        } while (now < next_deadline);
+        next_deadline += period_ns;
+    } else {
+        ++stats.missed_deadlines;
+        /*
+         * If we've fallen more than a frame behind, start a new schedule
+         * rather than rushing through frames to catch up.
+         */
+        next_deadline += period_ns;
+        if (next_deadline <= now) {
+            next_deadline = now + period_ns;
+        }
+    }
+
+    record_frame(now - last_frame_end);
+    last_frame_end = now;
+}
+
+void pacing_reset(void)
+{
+    next_deadline = 0;
+}
+
+const struct pacing_stats *pacing_get_stats(void)
+{
+    return &stats;
+}
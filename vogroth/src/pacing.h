@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2021 Marty Mills <daggerbot@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_PACING_H
+#define INCLUDED_PACING_H
+
+#include "types.h"
+
+/*
+ * Frame rate limiter for when vsync isn't available or a lower frame rate is
+ * wanted. Each frame is scheduled at a fixed period after the previous
+ * deadline rather than after the previous frame, so sleep errors don't
+ * accumulate. Most of the wait is spent sleeping. The last stretch, which is
+ * about as long as the scheduler has recently overslept, is spent spinning on
+ * the clock.
+ */
+#define PACING_HISTOGRAM_BUCKET_US 500
+#define PACING_HISTOGRAM_BUCKETS 100 /* The last bucket also counts longer frames */
+
+struct pacing_stats {
+    uint64_t frames;
+    uint64_t missed_deadlines; /* Frames which took too long to be paced */
+    uint64_t min_frame_ns;
+    uint64_t max_frame_ns;
+    uint64_t total_frame_ns;
+    uint64_t sleep_margin_ns;  /* Current estimate of the scheduler's oversleep */
+    uint64_t histogram[PACING_HISTOGRAM_BUCKETS]; /* Frame times */
+};
+
+/* Starts limiting the frame rate. A target of 0 disables the limiter. */
+void pacing_init(int target_fps);
+void pacing_fini(void);
+bool pacing_enabled(void);
+
+/* Waits until it's time to start the next frame. Called after presenting each frame. */
+void pacing_wait(void);
+
+/*
+ * Starts a new schedule with the next frame. Call this after the game has
+ * been idle, so the pause isn't counted as a missed deadline.
+ */
+void pacing_reset(void);
+
+const struct pacing_stats *pacing_get_stats(void);
+
+#endif /* INCLUDED_PACING_H */
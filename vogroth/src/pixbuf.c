@@ -33,6 +33,7 @@ int pixbuf_get_bytes_per_pixel(enum pixel_format format)
     case PIXEL_FORMAT_RGB_888:
         return 3;
     case PIXEL_FORMAT_RGBA_8888:
+    case PIXEL_FORMAT_BGRA_8888:
         return 4;
     default:
         FATAL("Invalid pixel format 0x%04" PRIu32, (uint32_t)format);
@@ -97,3 +98,51 @@ bool pixbuf_is_ideal(const struct pixbuf *pixbuf)
            && pixbuf->row_pitch == pixbuf_get_ideal_row_pitch(pixbuf->format, pixbuf->size.x)
            && (uintptr_t)pixbuf->buf % ROW_ALIGN == 0;
 }
+
+uint8_t *pixbuf_get_row(const struct pixbuf *pixbuf, int y)
+{
+    DASSERT(pixbuf && pixbuf->buf && y >= 0 && y < pixbuf->size.y);
+    if (pixbuf->row_pitch >= 0) {
+        return pixbuf->buf + (size_t)y * (size_t)pixbuf->row_pitch;
+    }
+    return pixbuf->buf + (size_t)(pixbuf->size.y - 1 - y) * (size_t)-pixbuf->row_pitch;
+}
+
+struct pixview pixbuf_get_view(const struct pixbuf *pixbuf)
+{
+    struct pixview view;
+
+    DASSERT(pixbuf && pixbuf->buf);
+    view.size = pixbuf->size;
+    view.format = pixbuf->format;
+    view.row_pitch = pixbuf->row_pitch;
+    view.origin = pixbuf_get_row(pixbuf, 0);
+    return view;
+}
+
+struct pixview pixview_get_sub(const struct pixview *view, struct rect2i rect)
+{
+    struct pixview sub = *view;
+
+    DASSERT(view && view->origin);
+    ASSERT(rect.a.x >= 0 && rect.a.y >= 0 && rect.a.x < rect.b.x && rect.a.y < rect.b.y);
+    ASSERT(rect.b.x <= view->size.x && rect.b.y <= view->size.y);
+    sub.size = (struct vec2i) {rect.b.x - rect.a.x, rect.b.y - rect.a.y};
+    sub.origin = pixview_get_row(view, rect.a.y)
+                 + (size_t)rect.a.x * (size_t)pixbuf_get_bytes_per_pixel(view->format);
+    return sub;
+}
+
+const uint8_t *pixview_get_row(const struct pixview *view, int y)
+{
+    DASSERT(view && view->origin && y >= 0 && y < view->size.y);
+    return view->origin + (ptrdiff_t)y * view->row_pitch;
+}
+
+bool pixview_is_ideal(const struct pixview *view)
+{
+    DASSERT(view != NULL);
+    return view->origin
+           && view->row_pitch == pixbuf_get_ideal_row_pitch(view->format, view->size.x)
+           && (uintptr_t)view->origin % ROW_ALIGN == 0;
+}
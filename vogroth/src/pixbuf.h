@@ -28,18 +28,36 @@ enum pixel_format {
     PIXEL_FORMAT_ALPHA_8 = 0x1906,
     PIXEL_FORMAT_LUMINANCE_8 = 0x1909,
     PIXEL_FORMAT_LUMINANCE_ALPHA_88 = 0x190A,
+    PIXEL_FORMAT_BGRA_8888 = 0x80E1,
+
+    /* Block compressed formats (see dxt.h), which pixbufs can't hold */
+    PIXEL_FORMAT_DXT1 = 0x83F1,
+    PIXEL_FORMAT_DXT5 = 0x83F3,
 };
 
 struct pixbuf {
     struct vec2i size;
     enum pixel_format format;
-    int row_pitch;
+    int row_pitch; /* Negative if the rows are stored bottom-up */
     size_t buf_size;
     uint8_t *buf;
 };
 #define PIXBUF_INIT {0}
 #define PIXBUF_NULL ((struct pixbuf)PIXBUF_INIT)
 
+/*
+ * Non-owning view of pixels in a pixbuf or any other buffer, which may be a
+ * sub-rectangle of it. Row y starts at origin + y * row_pitch.
+ */
+struct pixview {
+    struct vec2i size;
+    enum pixel_format format;
+    int row_pitch; /* Negative if the rows are stored bottom-up */
+    const uint8_t *origin; /* Start of the top row */
+};
+#define PIXVIEW_INIT {0}
+#define PIXVIEW_NULL ((struct pixview)PIXVIEW_INIT)
+
 int pixbuf_get_bytes_per_pixel(enum pixel_format format);
 /* Gets the most convenient pitch for use with the underlying render API. */
 int pixbuf_get_ideal_row_pitch(enum pixel_format format, int width);
@@ -53,4 +71,15 @@ void pixbuf_fini(struct pixbuf *pixbuf);
 
 bool pixbuf_is_ideal(const struct pixbuf *pixbuf);
 
+/* Gets a pointer to the start of row y, counting from the top. */
+uint8_t *pixbuf_get_row(const struct pixbuf *pixbuf, int y);
+
+/* Gets a view of the whole pixbuf, which is valid until it's reallocated or freed. */
+struct pixview pixbuf_get_view(const struct pixbuf *pixbuf);
+/* Gets a view of part of another view. rect must be within it and not empty. */
+struct pixview pixview_get_sub(const struct pixview *view, struct rect2i rect);
+const uint8_t *pixview_get_row(const struct pixview *view, int y);
+/* Checks whether the rows are packed as they would be in an ideal pixbuf. */
+bool pixview_is_ideal(const struct pixview *view);
+
 #endif /* INCLUDED_PIXBUF_H */
@@ -0,0 +1,529 @@
+/*
+ * Copyright (c) 2021 Marty Mills <daggerbot@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "cpu.h"
+#include "debug.h"
+#include "jobs.h"
+#include "pixconv.h"
+
+#ifdef CPU_X86
+# include <immintrin.h>
+#endif
+
+/* Images with fewer pixels than this aren't worth splitting between threads */
+#define PARALLEL_MIN_PIXELS (256 * 256)
+
+/*
+ * Converts one row of width pixels. Kernels which don't change the pixel size
+ * also work in place. The SIMD kernels leave the last few pixels, which
+ * don't fill a whole vector, to the narrower kernels.
+ */
+typedef void(*row_kernel_t)(uint8_t *dst, const uint8_t *src, int width);
+
+struct kernels {
+    row_kernel_t scalar;
+    row_kernel_t sse;
+    unsigned sse_features; /* Required by sse */
+    row_kernel_t avx2;
+};
+
+/******************************************************************************/
+
+static void rgb_to_rgba_scalar(uint8_t *dst, const uint8_t *src, int width)
+{
+    int i;
+
+    for (i = 0; i < width; ++i) {
+        dst[4 * i + 0] = src[3 * i + 0];
+        dst[4 * i + 1] = src[3 * i + 1];
+        dst[4 * i + 2] = src[3 * i + 2];
+        dst[4 * i + 3] = 255;
+    }
+}
+
+static void rgba_to_rgb_scalar(uint8_t *dst, const uint8_t *src, int width)
+{
+    int i;
+
+    for (i = 0; i < width; ++i) {
+        dst[3 * i + 0] = src[4 * i + 0];
+        dst[3 * i + 1] = src[4 * i + 1];
+        dst[3 * i + 2] = src[4 * i + 2];
+    }
+}
+
+static void swap_red_blue_scalar(uint8_t *dst, const uint8_t *src, int width)
+{
+    uint8_t red;
+    int i;
+
+    for (i = 0; i < width; ++i) {
+        red = src[4 * i + 0];
+        dst[4 * i + 0] = src[4 * i + 2];
+        dst[4 * i + 1] = src[4 * i + 1];
+        dst[4 * i + 2] = red;
+        dst[4 * i + 3] = src[4 * i + 3];
+    }
+}
+
+static void extract_alpha_scalar(uint8_t *dst, const uint8_t *src, int width)
+{
+    int i;
+
+    for (i = 0; i < width; ++i) {
+        dst[i] = src[4 * i + 3];
+    }
+}
+
+/* Computes c * a / 255, rounded to nearest, exactly */
+static inline uint8_t mul_div_255(unsigned c, unsigned a)
+{
+    unsigned t = c * a + 128;
+
+    return (uint8_t)((t + (t >> 8)) >> 8);
+}
+
+static void premultiply_scalar(uint8_t *dst, const uint8_t *src, int width)
+{
+    unsigned alpha;
+    int i;
+
+    for (i = 0; i < width; ++i) {
+        alpha = src[4 * i + 3];
+        dst[4 * i + 0] = mul_div_255(src[4 * i + 0], alpha);
+        dst[4 * i + 1] = mul_div_255(src[4 * i + 1], alpha);
+        dst[4 * i + 2] = mul_div_255(src[4 * i + 2], alpha);
+        dst[4 * i + 3] = (uint8_t)alpha;
+    }
+}
+
+/*
+ * Computes c * 255 / a, rounded to nearest and clamped. This is done in
+ * single precision, exactly as the SIMD kernels do it, so that they all give
+ * the same results. Transparent pixels become transparent black.
+ */
+static inline uint8_t unpremultiply_channel(uint8_t c, uint8_t a)
+{
+    float value;
+
+    if (!a) {
+        return 0;
+    }
+    value = (float)c * 255.0f / (float)a + 0.5f;
+    return value >= 255.0f ? 255 : (uint8_t)value;
+}
+
+static void unpremultiply_scalar(uint8_t *dst, const uint8_t *src, int width)
+{
+    uint8_t alpha;
+    int i;
+
+    for (i = 0; i < width; ++i) {
+        alpha = src[4 * i + 3];
+        dst[4 * i + 0] = unpremultiply_channel(src[4 * i + 0], alpha);
+        dst[4 * i + 1] = unpremultiply_channel(src[4 * i + 1], alpha);
+        dst[4 * i + 2] = unpremultiply_channel(src[4 * i + 2], alpha);
+        dst[4 * i + 3] = alpha;
+    }
+}
+
+/******************************************************************************/
+
+#ifdef CPU_X86
+#define ALPHA_BYTES (-0x01000000) /* 0xFF000000 in each 32-bit pixel */
+
+static TARGET("ssse3") void rgb_to_rgba_ssse3(uint8_t *dst, const uint8_t *src, int width)
+{
+    const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -128, 3, 4, 5, -128, 6, 7, 8, -128, 9, 10, 11, -128);
+    const __m128i alpha = _mm_set1_epi32(ALPHA_BYTES);
+    __m128i x;
+    int i;
+
+    /* Each load reads 16 bytes, but only uses 12 of them */
+    for (i = 0; i + 6 <= width; i += 4) {
+        x = _mm_loadu_si128((const __m128i *)(src + 3 * i));
+        _mm_storeu_si128((__m128i *)(dst + 4 * i), _mm_or_si128(_mm_shuffle_epi8(x, shuffle), alpha));
+    }
+    rgb_to_rgba_scalar(dst + 4 * i, src + 3 * i, width - i);
+}
+
+static TARGET("avx2") void rgb_to_rgba_avx2(uint8_t *dst, const uint8_t *src, int width)
+{
+    const __m256i shuffle = _mm256_setr_epi8(0, 1, 2, -128, 3, 4, 5, -128, 6, 7, 8, -128, 9, 10, 11, -128,
+                                             0, 1, 2, -128, 3, 4, 5, -128, 6, 7, 8, -128, 9, 10, 11, -128);
+    const __m256i alpha = _mm256_set1_epi32(ALPHA_BYTES);
+    __m256i x;
+    int i;
+
+    for (i = 0; i + 10 <= width; i += 8) {
+        x = _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(src + 3 * i)));
+        x = _mm256_inserti128_si256(x, _mm_loadu_si128((const __m128i *)(src + 3 * i + 12)), 1);
+        _mm256_storeu_si256((__m256i *)(dst + 4 * i), _mm256_or_si256(_mm256_shuffle_epi8(x, shuffle), alpha));
+    }
+    rgb_to_rgba_ssse3(dst + 4 * i, src + 3 * i, width - i);
+}
+
+static TARGET("ssse3") void rgba_to_rgb_ssse3(uint8_t *dst, const uint8_t *src, int width)
+{
+    const __m128i shuffle = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -128, -128, -128, -128);
+    __m128i x;
+    int i;
+
+    /* Each store writes 16 bytes, but only 12 of them are kept */
+    for (i = 0; i + 6 <= width; i += 4) {
+        x = _mm_loadu_si128((const __m128i *)(src + 4 * i));
+        _mm_storeu_si128((__m128i *)(dst + 3 * i), _mm_shuffle_epi8(x, shuffle));
+    }
+    rgba_to_rgb_scalar(dst + 3 * i, src + 4 * i, width - i);
+}
+
+static TARGET("avx2") void rgba_to_rgb_avx2(uint8_t *dst, const uint8_t *src, int width)
+{
+    const __m256i shuffle = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -128, -128, -128, -128,
+                                             0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -128, -128, -128, -128);
+    const __m256i compact = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+    __m256i x;
+    int i;
+
+    for (i = 0; i + 11 <= width; i += 8) {
+        x = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(src + 4 * i)), shuffle);
+        _mm256_storeu_si256((__m256i *)(dst + 3 * i), _mm256_permutevar8x32_epi32(x, compact));
+    }
+    rgba_to_rgb_ssse3(dst + 3 * i, src + 4 * i, width - i);
+}
+
+static TARGET("ssse3") void swap_red_blue_ssse3(uint8_t *dst, const uint8_t *src, int width)
+{
+    const __m128i shuffle = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    __m128i x;
+    int i;
+
+    for (i = 0; i + 4 <= width; i += 4) {
+        x = _mm_loadu_si128((const __m128i *)(src + 4 * i));
+        _mm_storeu_si128((__m128i *)(dst + 4 * i), _mm_shuffle_epi8(x, shuffle));
+    }
+    swap_red_blue_scalar(dst + 4 * i, src + 4 * i, width - i);
+}
+
+static TARGET("avx2") void swap_red_blue_avx2(uint8_t *dst, const uint8_t *src, int width)
+{
+    const __m256i shuffle = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+                                             2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    __m256i x;
+    int i;
+
+    for (i = 0; i + 8 <= width; i += 8) {
+        x = _mm256_loadu_si256((const __m256i *)(src + 4 * i));
+        _mm256_storeu_si256((__m256i *)(dst + 4 * i), _mm256_shuffle_epi8(x, shuffle));
+    }
+    swap_red_blue_ssse3(dst + 4 * i, src + 4 * i, width - i);
+}
+
+static TARGET("sse2") void extract_alpha_sse2(uint8_t *dst, const uint8_t *src, int width)
+{
+    __m128i a0, a1, a2, a3;
+    int i;
+
+    for (i = 0; i + 16 <= width; i += 16) {
+        a0 = _mm_srli_epi32(_mm_loadu_si128((const __m128i *)(src + 4 * i)), 24);
+        a1 = _mm_srli_epi32(_mm_loadu_si128((const __m128i *)(src + 4 * i + 16)), 24);
+        a2 = _mm_srli_epi32(_mm_loadu_si128((const __m128i *)(src + 4 * i + 32)), 24);
+        a3 = _mm_srli_epi32(_mm_loadu_si128((const __m128i *)(src + 4 * i + 48)), 24);
+        _mm_storeu_si128((__m128i *)(dst + i),
+                         _mm_packus_epi16(_mm_packs_epi32(a0, a1), _mm_packs_epi32(a2, a3)));
+    }
+    extract_alpha_scalar(dst + i, src + 4 * i, width - i);
+}
+
+/*
+ * Packing 32-bit values down to bytes in 256-bit registers works within each
+ * 128-bit lane, which leaves groups of four bytes in this order.
+ */
+#define AVX2_UNPACK_ORDER 0, 4, 1, 5, 2, 6, 3, 7
+
+static TARGET("avx2") void extract_alpha_avx2(uint8_t *dst, const uint8_t *src, int width)
+{
+    const __m256i order = _mm256_setr_epi32(AVX2_UNPACK_ORDER);
+    __m256i a0, a1, a2, a3, x;
+    int i;
+
+    for (i = 0; i + 32 <= width; i += 32) {
+        a0 = _mm256_srli_epi32(_mm256_loadu_si256((const __m256i *)(src + 4 * i)), 24);
+        a1 = _mm256_srli_epi32(_mm256_loadu_si256((const __m256i *)(src + 4 * i + 32)), 24);
+        a2 = _mm256_srli_epi32(_mm256_loadu_si256((const __m256i *)(src + 4 * i + 64)), 24);
+        a3 = _mm256_srli_epi32(_mm256_loadu_si256((const __m256i *)(src + 4 * i + 96)), 24);
+        x = _mm256_packus_epi16(_mm256_packs_epi32(a0, a1), _mm256_packs_epi32(a2, a3));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_permutevar8x32_epi32(x, order));
+    }
+    extract_alpha_sse2(dst + i, src + 4 * i, width - i);
+}
+
+/* Uses the same exact rounding as mul_div_255, on 16-bit values */
+static TARGET("ssse3") void premultiply_ssse3(uint8_t *dst, const uint8_t *src, int width)
+{
+    const __m128i alpha_lo = _mm_setr_epi8(3, -128, 3, -128, 3, -128, 3, -128, 7, -128, 7, -128, 7, -128, 7, -128);
+    const __m128i alpha_hi = _mm_setr_epi8(11, -128, 11, -128, 11, -128, 11, -128,
+                                           15, -128, 15, -128, 15, -128, 15, -128);
+    const __m128i alpha_bytes = _mm_set1_epi32(ALPHA_BYTES);
+    const __m128i round = _mm_set1_epi16(128);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i x, lo, hi;
+    int i;
+
+    for (i = 0; i + 4 <= width; i += 4) {
+        x = _mm_loadu_si128((const __m128i *)(src + 4 * i));
+        lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(x, zero), _mm_shuffle_epi8(x, alpha_lo)), round);
+        hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(x, zero), _mm_shuffle_epi8(x, alpha_hi)), round);
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+        x = _mm_or_si128(_mm_andnot_si128(alpha_bytes, _mm_packus_epi16(lo, hi)), _mm_and_si128(alpha_bytes, x));
+        _mm_storeu_si128((__m128i *)(dst + 4 * i), x);
+    }
+    premultiply_scalar(dst + 4 * i, src + 4 * i, width - i);
+}
+
+static TARGET("avx2") void premultiply_avx2(uint8_t *dst, const uint8_t *src, int width)
+{
+    const __m256i alpha_lo = _mm256_setr_epi8(3, -128, 3, -128, 3, -128, 3, -128, 7, -128, 7, -128, 7, -128, 7, -128,
+                                              3, -128, 3, -128, 3, -128, 3, -128, 7, -128, 7, -128, 7, -128, 7, -128);
+    const __m256i alpha_hi = _mm256_setr_epi8(11, -128, 11, -128, 11, -128, 11, -128,
+                                              15, -128, 15, -128, 15, -128, 15, -128,
+                                              11, -128, 11, -128, 11, -128, 11, -128,
+                                              15, -128, 15, -128, 15, -128, 15, -128);
+    const __m256i alpha_bytes = _mm256_set1_epi32(ALPHA_BYTES);
+    const __m256i round = _mm256_set1_epi16(128);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i x, lo, hi;
+    int i;
+
+    for (i = 0; i + 8 <= width; i += 8) {
+        x = _mm256_loadu_si256((const __m256i *)(src + 4 * i));
+        lo = _mm256_mullo_epi16(_mm256_unpacklo_epi8(x, zero), _mm256_shuffle_epi8(x, alpha_lo));
+        hi = _mm256_mullo_epi16(_mm256_unpackhi_epi8(x, zero), _mm256_shuffle_epi8(x, alpha_hi));
+        lo = _mm256_add_epi16(lo, round);
+        hi = _mm256_add_epi16(hi, round);
+        lo = _mm256_srli_epi16(_mm256_add_epi16(lo, _mm256_srli_epi16(lo, 8)), 8);
+        hi = _mm256_srli_epi16(_mm256_add_epi16(hi, _mm256_srli_epi16(hi, 8)), 8);
+        x = _mm256_or_si256(_mm256_andnot_si256(alpha_bytes, _mm256_packus_epi16(lo, hi)),
+                            _mm256_and_si256(alpha_bytes, x));
+        _mm256_storeu_si256((__m256i *)(dst + 4 * i), x);
+    }
+    premultiply_ssse3(dst + 4 * i, src + 4 * i, width - i);
+}
+
+/* Does unpremultiply_channel for the four channels of a pixel, as 32-bit values */
+static TARGET("sse2") __m128i unpremultiply_pixel_sse2(__m128i pixel)
+{
+    __m128 value = _mm_cvtepi32_ps(pixel);
+    __m128 alpha = _mm_shuffle_ps(value, value, 0xFF);
+
+    value = _mm_div_ps(_mm_mul_ps(value, _mm_set1_ps(255.0f)), alpha);
+    value = _mm_and_ps(value, _mm_cmpneq_ps(alpha, _mm_setzero_ps()));
+    return _mm_cvttps_epi32(_mm_add_ps(value, _mm_set1_ps(0.5f)));
+}
+
+static TARGET("sse2") void unpremultiply_sse2(uint8_t *dst, const uint8_t *src, int width)
+{
+    const __m128i alpha_bytes = _mm_set1_epi32(ALPHA_BYTES);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i x, lo, hi, p0, p1, p2, p3;
+    int i;
+
+    for (i = 0; i + 4 <= width; i += 4) {
+        x = _mm_loadu_si128((const __m128i *)(src + 4 * i));
+        lo = _mm_unpacklo_epi8(x, zero);
+        hi = _mm_unpackhi_epi8(x, zero);
+        p0 = unpremultiply_pixel_sse2(_mm_unpacklo_epi16(lo, zero));
+        p1 = unpremultiply_pixel_sse2(_mm_unpackhi_epi16(lo, zero));
+        p2 = unpremultiply_pixel_sse2(_mm_unpacklo_epi16(hi, zero));
+        p3 = unpremultiply_pixel_sse2(_mm_unpackhi_epi16(hi, zero));
+
+        /* Saturating packs clamp the results to 255 */
+        lo = _mm_packus_epi16(_mm_packs_epi32(p0, p1), _mm_packs_epi32(p2, p3));
+        x = _mm_or_si128(_mm_andnot_si128(alpha_bytes, lo), _mm_and_si128(alpha_bytes, x));
+        _mm_storeu_si128((__m128i *)(dst + 4 * i), x);
+    }
+    unpremultiply_scalar(dst + 4 * i, src + 4 * i, width - i);
+}
+
+/* Two pixels at a time, one in each lane */
+static TARGET("avx2") __m256i unpremultiply_pixels_avx2(const uint8_t *src)
+{
+    __m256 value = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)src)));
+    __m256 alpha = _mm256_shuffle_ps(value, value, 0xFF);
+
+    value = _mm256_div_ps(_mm256_mul_ps(value, _mm256_set1_ps(255.0f)), alpha);
+    value = _mm256_and_ps(value, _mm256_cmp_ps(alpha, _mm256_setzero_ps(), _CMP_NEQ_UQ));
+    return _mm256_cvttps_epi32(_mm256_add_ps(value, _mm256_set1_ps(0.5f)));
+}
+
+static TARGET("avx2") void unpremultiply_avx2(uint8_t *dst, const uint8_t *src, int width)
+{
+    const __m256i alpha_bytes = _mm256_set1_epi32(ALPHA_BYTES);
+    const __m256i order = _mm256_setr_epi32(AVX2_UNPACK_ORDER);
+    __m256i x, p0, p1, p2, p3;
+    int i;
+
+    for (i = 0; i + 8 <= width; i += 8) {
+        x = _mm256_loadu_si256((const __m256i *)(src + 4 * i));
+        p0 = unpremultiply_pixels_avx2(src + 4 * i);
+        p1 = unpremultiply_pixels_avx2(src + 4 * i + 8);
+        p2 = unpremultiply_pixels_avx2(src + 4 * i + 16);
+        p3 = unpremultiply_pixels_avx2(src + 4 * i + 24);
+        p0 = _mm256_packus_epi16(_mm256_packs_epi32(p0, p1), _mm256_packs_epi32(p2, p3));
+        p0 = _mm256_permutevar8x32_epi32(p0, order);
+        x = _mm256_or_si256(_mm256_andnot_si256(alpha_bytes, p0), _mm256_and_si256(alpha_bytes, x));
+        _mm256_storeu_si256((__m256i *)(dst + 4 * i), x);
+    }
+    unpremultiply_sse2(dst + 4 * i, src + 4 * i, width - i);
+}
+#else /* !defined(CPU_X86) */
+# define rgb_to_rgba_ssse3 NULL
+# define rgb_to_rgba_avx2 NULL
+# define rgba_to_rgb_ssse3 NULL
+# define rgba_to_rgb_avx2 NULL
+# define swap_red_blue_ssse3 NULL
+# define swap_red_blue_avx2 NULL
+# define extract_alpha_sse2 NULL
+# define extract_alpha_avx2 NULL
+# define premultiply_ssse3 NULL
+# define premultiply_avx2 NULL
+# define unpremultiply_sse2 NULL
+# define unpremultiply_avx2 NULL
+#endif /* !defined(CPU_X86) */
+
+/******************************************************************************/
+
+static const struct kernels rgb_to_rgba = {
+    &rgb_to_rgba_scalar, rgb_to_rgba_ssse3, CPU_FEATURE_SSSE3, rgb_to_rgba_avx2
+};
+static const struct kernels rgba_to_rgb = {
+    &rgba_to_rgb_scalar, rgba_to_rgb_ssse3, CPU_FEATURE_SSSE3, rgba_to_rgb_avx2
+};
+static const struct kernels swap_red_blue = {
+    &swap_red_blue_scalar, swap_red_blue_ssse3, CPU_FEATURE_SSSE3, swap_red_blue_avx2
+};
+static const struct kernels extract_alpha = {
+    &extract_alpha_scalar, extract_alpha_sse2, CPU_FEATURE_SSE2, extract_alpha_avx2
+};
+static const struct kernels premultiply = {
+    &premultiply_scalar, premultiply_ssse3, CPU_FEATURE_SSSE3, premultiply_avx2
+};
+static const struct kernels unpremultiply = {
+    &unpremultiply_scalar, unpremultiply_sse2, CPU_FEATURE_SSE2, unpremultiply_avx2
+};
+
+static row_kernel_t select_kernel(const struct kernels *kernels)
+{
+    /* The AVX2 kernels fall back to the SSE ones for the last few pixels */
+    if (kernels->avx2 && cpu_has(CPU_FEATURE_AVX2 | kernels->sse_features)) {
+        return kernels->avx2;
+    }
+    if (kernels->sse && cpu_has(kernels->sse_features)) {
+        return kernels->sse;
+    }
+    return kernels->scalar;
+}
+
+struct conversion {
+    row_kernel_t kernel; /* NULL to copy rows */
+    const struct pixbuf *src;
+    const struct pixbuf *dst;
+    size_t row_size;     /* For copying */
+};
+
+static void convert_rows(void *data, int begin, int end)
+{
+    const struct conversion *conversion = data;
+    int y;
+
+    for (y = begin; y < end; ++y) {
+        if (conversion->kernel) {
+            conversion->kernel(pixbuf_get_row(conversion->dst, y), pixbuf_get_row(conversion->src, y),
+                               conversion->src->size.x);
+        } else {
+            memcpy(pixbuf_get_row(conversion->dst, y), pixbuf_get_row(conversion->src, y),
+                   conversion->row_size);
+        }
+    }
+}
+
+static void run_conversion(const struct conversion *conversion)
+{
+    struct vec2i size = conversion->src->size;
+
+    if ((int64_t)size.x * size.y >= PARALLEL_MIN_PIXELS && jobs_get_num_threads() > 1) {
+        jobs_parallel_for(size.y, 0, &convert_rows, (void *)conversion);
+    } else {
+        convert_rows((void *)conversion, 0, size.y);
+    }
+}
+
+static const struct kernels *find_kernels(enum pixel_format src, enum pixel_format dst)
+{
+    bool src_rgba = src == PIXEL_FORMAT_RGBA_8888 || src == PIXEL_FORMAT_BGRA_8888;
+
+    if (src == PIXEL_FORMAT_RGB_888 && dst == PIXEL_FORMAT_RGBA_8888) {
+        return &rgb_to_rgba;
+    }
+    if (src == PIXEL_FORMAT_RGBA_8888 && dst == PIXEL_FORMAT_RGB_888) {
+        return &rgba_to_rgb;
+    }
+    if (src_rgba && (dst == PIXEL_FORMAT_RGBA_8888 || dst == PIXEL_FORMAT_BGRA_8888)) {
+        return &swap_red_blue;
+    }
+    if (src_rgba && dst == PIXEL_FORMAT_ALPHA_8) {
+        return &extract_alpha;
+    }
+    FATAL("Can't convert pixel format 0x%04" PRIx32 " to 0x%04" PRIx32, (uint32_t)src, (uint32_t)dst);
+}
+
+void pixconv_convert(const struct pixbuf *src, struct pixbuf *dst)
+{
+    struct conversion conversion = {NULL, src, dst, 0};
+
+    DASSERT(src && src->buf && dst && dst != src);
+    dst->size = src->size;
+    pixbuf_alloc(dst);
+
+    if (src->format == dst->format) {
+        conversion.row_size = (size_t)src->size.x * (size_t)pixbuf_get_bytes_per_pixel(src->format);
+    } else {
+        conversion.kernel = select_kernel(find_kernels(src->format, dst->format));
+    }
+    run_conversion(&conversion);
+}
+
+static void convert_in_place(struct pixbuf *pixbuf, const struct kernels *kernels)
+{
+    struct conversion conversion = {select_kernel(kernels), pixbuf, pixbuf, 0};
+
+    DASSERT(pixbuf && pixbuf->buf);
+    ASSERT(pixbuf->format == PIXEL_FORMAT_RGBA_8888 || pixbuf->format == PIXEL_FORMAT_BGRA_8888);
+    run_conversion(&conversion);
+}
+
+void pixconv_premultiply(struct pixbuf *pixbuf)
+{
+    convert_in_place(pixbuf, &premultiply);
+}
+
+void pixconv_unpremultiply(struct pixbuf *pixbuf)
+{
+    convert_in_place(pixbuf, &unpremultiply);
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2021 Marty Mills <daggerbot@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_PIXCONV_H
+#define INCLUDED_PIXCONV_H
+
+#include "pixbuf.h"
+
+/*
+ * Pixel format conversions, using SSE2, SSSE3 or AVX2 if the CPU has them.
+ * Either pixbuf may have any row pitch, including a negative one. Large
+ * images are split into bands of rows which are converted in parallel by the
+ * job system, so those must be converted on the main thread or in a job.
+ */
+
+/*
+ * Converts src into dst. dst->format and dst->row_pitch (0 for ideal) must be
+ * set. dst is resized to match src and reallocated. Supported conversions are
+ * RGB_888 to RGBA_8888, RGBA_8888 to RGB_888, swapping between RGBA_8888 and
+ * BGRA_8888, extracting ALPHA_8 from either of those, and copying between
+ * pixbufs of the same format.
+ */
+void pixconv_convert(const struct pixbuf *src, struct pixbuf *dst);
+
+/* Multiplies or divides the color channels of an RGBA_8888 or BGRA_8888 pixbuf by alpha, in place. */
+void pixconv_premultiply(struct pixbuf *pixbuf);
+void pixconv_unpremultiply(struct pixbuf *pixbuf);
+
+#endif /* INCLUDED_PIXCONV_H */
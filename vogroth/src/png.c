@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) 2021 Marty Mills <daggerbot@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "debug.h"
+#include "memory.h"
+#include "pixbuf.h"
+#include "png.h"
+#include "rw.h"
+
+#define MAX_STORED_BLOCK_SIZE 65535
+
+/* PNG color types */
+#define COLOR_TYPE_GRAY 0
+#define COLOR_TYPE_RGB 2
+#define COLOR_TYPE_GRAY_ALPHA 4
+#define COLOR_TYPE_RGBA 6
+
+static const uint8_t png_signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+
+static uint32_t crc_table[256];
+static bool crc_table_ready = false;
+
+static void init_crc_table(void)
+{
+    uint32_t c;
+    int i, k;
+
+    for (i = 0; i < 256; ++i) {
+        c = (uint32_t)i;
+        for (k = 0; k < 8; ++k) {
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        crc_table[i] = c;
+    }
+    crc_table_ready = true;
+}
+
+static uint32_t update_crc(uint32_t crc, size_t size, const uint8_t *data)
+{
+    size_t i;
+
+    for (i = 0; i < size; ++i) {
+        crc = crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+static uint32_t update_adler32(uint32_t adler, size_t size, const uint8_t *data)
+{
+    uint32_t a = adler & 0xFFFF;
+    uint32_t b = adler >> 16;
+    size_t i;
+
+    for (i = 0; i < size; ++i) {
+        a = (a + data[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    return (b << 16) | a;
+}
+
+static void append_u8(struct buf *out, uint8_t value)
+{
+    buf_append(out, 1, &value);
+}
+
+static void append_u16le(struct buf *out, uint16_t value)
+{
+    uint8_t bytes[2] = {(uint8_t)value, (uint8_t)(value >> 8)};
+
+    buf_append(out, sizeof(bytes), bytes);
+}
+
+static void append_u32be(struct buf *out, uint32_t value)
+{
+    uint8_t bytes[4] = {(uint8_t)(value >> 24), (uint8_t)(value >> 16), (uint8_t)(value >> 8), (uint8_t)value};
+
+    buf_append(out, sizeof(bytes), bytes);
+}
+
+static void append_chunk(struct buf *out, const char *type, size_t size, const void *data)
+{
+    uint32_t crc;
+
+    ASSERT(size <= INT32_MAX);
+    append_u32be(out, (uint32_t)size);
+    buf_append(out, 4, type);
+    buf_append(out, size, data);
+    crc = update_crc(0xFFFFFFFFu, 4, (const uint8_t *)type);
+    crc = update_crc(crc, size, data);
+    append_u32be(out, crc ^ 0xFFFFFFFFu);
+}
+
+static uint8_t get_color_type(enum pixel_format format)
+{
+    switch (format) {
+    case PIXEL_FORMAT_ALPHA_8:
+    case PIXEL_FORMAT_LUMINANCE_8:
+    case PIXEL_FORMAT_RED_8:
+        return COLOR_TYPE_GRAY;
+    case PIXEL_FORMAT_LUMINANCE_ALPHA_88:
+        return COLOR_TYPE_GRAY_ALPHA;
+    case PIXEL_FORMAT_RGB_888:
+        return COLOR_TYPE_RGB;
+    case PIXEL_FORMAT_RGBA_8888:
+        return COLOR_TYPE_RGBA;
+    default:
+        FATAL("Unsupported pixel format for PNG: 0x%04" PRIu32, (uint32_t)format);
+    }
+}
+
+void png_encode(const struct pixbuf *pixbuf, struct buf *out)
+{
+    struct buf scanlines = BUF_INIT;
+    struct buf zdata = BUF_INIT;
+    struct buf header = BUF_INIT;
+    size_t row_size;
+    size_t offset, block_size;
+    uint32_t adler = 1;
+    int y;
+
+    DASSERT(pixbuf && pixbuf->buf && out);
+    ASSERT(pixbuf->row_pitch > 0);
+    if (!crc_table_ready) {
+        init_crc_table();
+    }
+    row_size = (size_t)pixbuf->size.x * (size_t)pixbuf_get_bytes_per_pixel(pixbuf->format);
+
+    /* Each scanline is preceded by its filter type, which is always 0 (none) */
+    for (y = 0; y < pixbuf->size.y; ++y) {
+        append_u8(&scanlines, 0);
+        buf_append(&scanlines, row_size, pixbuf->buf + (size_t)y * (size_t)pixbuf->row_pitch);
+    }
+
+    /* Wrap the scanlines in a zlib stream made of uncompressed deflate blocks */
+    append_u8(&zdata, 0x78); /* CM = deflate, CINFO = 32K window */
+    append_u8(&zdata, 0x01); /* No dictionary, fastest compression, FCHECK */
+    offset = 0;
+    do {
+        block_size = scanlines.len - offset;
+        if (block_size > MAX_STORED_BLOCK_SIZE) {
+            block_size = MAX_STORED_BLOCK_SIZE;
+        }
+        append_u8(&zdata, offset + block_size == scanlines.len); /* BFINAL, BTYPE = stored */
+        append_u16le(&zdata, (uint16_t)block_size);
+        append_u16le(&zdata, (uint16_t)~block_size);
+        buf_append(&zdata, block_size, scanlines.data + offset);
+        offset += block_size;
+    } while (offset < scanlines.len);
+    adler = update_adler32(adler, scanlines.len, (const uint8_t *)scanlines.data);
+    append_u32be(&zdata, adler);
+
+    /* IHDR: width, height, bit depth, color type, compression, filter, interlace */
+    append_u32be(&header, (uint32_t)pixbuf->size.x);
+    append_u32be(&header, (uint32_t)pixbuf->size.y);
+    append_u8(&header, 8);
+    append_u8(&header, get_color_type(pixbuf->format));
+    append_u8(&header, 0);
+    append_u8(&header, 0);
+    append_u8(&header, 0);
+
+    buf_append(out, sizeof(png_signature), png_signature);
+    append_chunk(out, "IHDR", header.len, header.data);
+    append_chunk(out, "IDAT", zdata.len, zdata.data);
+    append_chunk(out, "IEND", 0, NULL);
+
+    buf_fini(&header);
+    buf_fini(&zdata);
+    buf_fini(&scanlines);
+}
+
+bool png_save(const struct pixbuf *pixbuf, const char *path, char **out_err)
+{
+    struct buf data = BUF_INIT;
+    struct rw *rw;
+    bool ok;
+
+    rw = rw_fopen(path, "wb", out_err);
+    if (!rw) {
+        return false;
+    }
+    png_encode(pixbuf, &data);
+    ok = rw_write(rw, data.len, data.data) == data.len;
+    if (!ok) {
+        str_put(out_err, rw->error ? rw->error : "Write failed");
+    }
+    buf_fini(&data);
+    if (rw_close(rw, ok ? out_err : NULL) && ok) {
+        ok = false;
+    }
+    return ok;
+}
@@ -14,17 +14,21 @@
  * this program. If not, see <https://www.gnu.org/licenses/>.
  */
 
-#version 110
+#ifndef INCLUDED_PNG_H
+#define INCLUDED_PNG_H
 
-uniform sampler2D uni_Texture;
+#include "types.h"
 
-varying vec2 var_TextureCoord;
-varying vec4 var_Color;
+struct buf;
+struct pixbuf;
 
-void main()
-{
-    gl_FragColor = vec4(1.0, 1.0, 1.0, texture2D(uni_Texture, var_TextureCoord).a) * var_Color;
-    if (gl_FragColor.a <= 0.0) {
-        discard;
-    }
-}
+/*
+ * Minimal PNG encoder for screenshots and test output. The image data is
+ * stored uncompressed (deflate "stored" blocks), so files are large but
+ * encoding is trivial and exact. Supports 8-bit luminance, luminance+alpha,
+ * RGB and RGBA pixbufs with a positive row pitch.
+ */
+void png_encode(const struct pixbuf *pixbuf, struct buf *out);
+bool png_save(const struct pixbuf *pixbuf, const char *path, char **out_err);
+
+#endif /* INCLUDED_PNG_H */
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2021 Marty Mills <daggerbot@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "redraw.h"
+#include "system.h"
+
+static bool requested = true; /* Always draw the first frame */
+static uint64_t deadline = 0; /* 0 if no redraw is scheduled */
+
+void redraw_request(void)
+{
+    requested = true;
+}
+
+void redraw_schedule(uint64_t delay_ns)
+{
+    uint64_t time = system_get_time_ns() + delay_ns;
+
+    if (!deadline || time < deadline) {
+        deadline = time;
+    }
+}
+
+bool redraw_is_due(void)
+{
+    return requested || (deadline && system_get_time_ns() >= deadline);
+}
+
+int redraw_get_timeout_ms(void)
+{
+    uint64_t now;
+    uint64_t ms;
+
+    if (requested) {
+        return 0;
+    } else if (!deadline) {
+        return -1;
+    }
+    now = system_get_time_ns();
+    if (now >= deadline) {
+        return 0;
+    }
+    /* Round up, or we'd wake up just before the deadline and have to wait again */
+    ms = (deadline - now + 999999u) / 1000000u;
+    return ms > INT_MAX ? INT_MAX : (int)ms;
+}
+
+void redraw_begin_frame(void)
+{
+    requested = false;
+    deadline = 0;
+}
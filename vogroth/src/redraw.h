@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2021 Marty Mills <daggerbot@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_REDRAW_H
+#define INCLUDED_REDRAW_H
+
+#include "types.h"
+
+/*
+ * Tracks whether the screen needs to be redrawn, so that the main loop can
+ * sleep while nothing changes. Anything which changes what's on screen should
+ * call redraw_request. Animations should call redraw_schedule while rendering
+ * each frame to ask for their next frame.
+ */
+void redraw_request(void);
+void redraw_schedule(uint64_t delay_ns);
+
+/* Checks whether a redraw has been requested or a scheduled one is due. */
+bool redraw_is_due(void);
+
+/*
+ * Gets how long the main loop may wait for events before the next scheduled
+ * redraw, in milliseconds. Returns -1 if nothing is scheduled.
+ */
+int redraw_get_timeout_ms(void);
+
+/* Clears requests. Called just before rendering a frame. */
+void redraw_begin_frame(void);
+
+#endif /* INCLUDED_REDRAW_H */
@@ -14,120 +14,304 @@
  * this program. If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <string.h>
+
 #include "debug.h"
 #include "gl_api.h"
+#include "gl_framebuffer.h"
 #include "gl_shaders.h"
 #include "gl_state.h"
+#include "gl_timer.h"
+#include "gl_trace.h"
+#include "memory.h"
 #include "render.h"
+#include "render_thread.h"
+#include "texture.h"
 #include "vector_math.h"
 #include "video.h"
 
-void render_init(void)
+/*
+ * With a render thread, the render functions record commands which are
+ * replayed on it once the frame is presented. The main thread records into
+ * one list while the render thread replays the other. The depth-tested passes
+ * reorder sprite draws, so they record commands even without a render thread.
+ */
+enum render_cmd_type {
+    RENDER_CMD_BEGIN_FRAME,
+    RENDER_CMD_END_FRAME,
+    RENDER_CMD_PRESENT,
+    RENDER_CMD_CLEAR,
+    RENDER_CMD_USE_TRANSFORM,
+    RENDER_CMD_USE_TEXTURE,
+    RENDER_CMD_USE_PALETTE,
+    RENDER_CMD_BEGIN_SPRITES,
+    RENDER_CMD_DRAW_SPRITES,
+    RENDER_CMD_BEGIN_TIMER,
+    RENDER_CMD_END_TIMER,
+    RENDER_CMD_DRAW_TEXTURE,
+};
+
+struct render_cmd {
+    enum render_cmd_type type;
+    union {
+        struct vec2i surface_size;
+        struct vec4f color;
+        struct mat4f transform;
+        struct texture *texture; /* Or palette */
+        struct {
+            struct sprite_batch *batch;
+            enum sprite_mode mode;
+            bool upload;
+            int num_verts;
+            size_t first_vert; /* Copy of the batch's verts in render_cmd_list.verts */
+        } begin_sprites;
+        struct {
+            int first;
+            int count;
+            bool opaque; /* Can go in the opaque depth pass, see is_opaque_draw */
+        } draw_sprites;
+        const char *timer_name;
+        struct {
+            struct texture *texture;
+            struct vec2i pos;
+        } draw_texture;
+    } u;
+};
+
+struct render_cmd_list {
+    struct render_cmd *cmds;
+    size_t num_cmds;
+    size_t cmds_capacity;
+
+    /* Sprite batches are copied when they change, since the caller can change them again during replay */
+    struct sprite_vertex *verts;
+    size_t num_verts;
+    size_t verts_capacity;
+};
+#define RENDER_CMD_LIST_INIT {0}
+
+/*
+ * Number of depths that sprite draws can be given before the depth buffer has
+ * to be cleared. A 24-bit depth buffer is requested, but init_depth_passes
+ * accepts 16 bits, so the depths are spaced for that: 2 steps of a 16-bit
+ * buffer apart, or 512 of a 24-bit one.
+ */
+#define DEPTH_STEPS 32768
+
+/* A sprite draw in a depth-tested segment, with the state it was recorded under */
+struct depth_draw {
+    const struct mat4f *transform;
+    struct texture *texture;
+    struct texture *palette;
+    const struct render_cmd *begin; /* RENDER_CMD_BEGIN_SPRITES */
+    int first;
+    int count;
+    bool opaque;
+    int depth_step;
+};
+
+static bool use_thread = false;
+static bool use_depth_passes = false;
+static struct render_cmd_list cmd_lists[2] = {RENDER_CMD_LIST_INIT, RENDER_CMD_LIST_INIT};
+static struct render_cmd_list *recording = NULL; /* NULL unless there's a render thread or depth passes */
+static enum sprite_mode sprite_batch_mode = SPRITE_MODE_NONE; /* Of gl_state.sprite_batch */
+
+/* Replay state for the depth-tested passes, which belongs to the render thread */
+static struct depth_draw *depth_draws = NULL;
+static size_t depth_draws_capacity = 0;
+static unsigned depth_segment = 0; /* Incremented for each segment, skipping 0 */
+static int next_depth_step = 0; /* Since the depth buffer was last cleared */
+static const struct render_cmd *depth_begin = NULL; /* Last RENDER_CMD_BEGIN_SPRITES replayed */
+
+static struct render_cmd *record(enum render_cmd_type type)
+{
+    struct render_cmd_list *list = recording;
+
+    if (list->num_cmds == list->cmds_capacity) {
+        list->cmds_capacity = list->cmds_capacity ? list->cmds_capacity * 2 : 256;
+        list->cmds = mem_realloc_array(list->cmds, list->cmds_capacity, sizeof(*list->cmds));
+    }
+    list->cmds[list->num_cmds].type = type;
+    return &list->cmds[list->num_cmds++];
+}
+
+static size_t record_verts(const struct sprite_vertex *verts, int num_verts)
+{
+    struct render_cmd_list *list = recording;
+    size_t first = list->num_verts;
+
+    DASSERT(num_verts >= 0);
+    if ((size_t)num_verts > list->verts_capacity - list->num_verts) {
+        while ((size_t)num_verts > list->verts_capacity - list->num_verts) {
+            list->verts_capacity = list->verts_capacity ? list->verts_capacity * 2 : 4096;
+        }
+        list->verts = mem_realloc_array(list->verts, list->verts_capacity, sizeof(*list->verts));
+    }
+    memcpy(list->verts + first, verts, (size_t)num_verts * sizeof(*verts));
+    list->num_verts += (size_t)num_verts;
+    return first;
+}
+
+static void record_begin_sprites(struct sprite_batch *batch, enum sprite_mode mode, bool upload)
+{
+    struct render_cmd *cmd = record(RENDER_CMD_BEGIN_SPRITES);
+
+    cmd->u.begin_sprites.batch = batch;
+    cmd->u.begin_sprites.mode = mode;
+    cmd->u.begin_sprites.upload = upload;
+    cmd->u.begin_sprites.num_verts = batch->num_verts;
+    cmd->u.begin_sprites.first_vert = upload ? record_verts(batch->verts, batch->num_verts) : 0;
+}
+
+static void fini_cmd_list(struct render_cmd_list *list)
+{
+    mem_free(list->cmds);
+    mem_free(list->verts);
+    *list = (struct render_cmd_list)RENDER_CMD_LIST_INIT;
+}
+
+static void init_depth_passes(void)
+{
+    GLint depth_bits = 0;
+
+    pglGetIntegerv(GL_DEPTH_BITS, &depth_bits);
+    if (depth_bits < 16) {
+        LOG_WARNING("Depth buffer has %d bits; drawing sprites in submission order instead", (int)depth_bits);
+        use_depth_passes = false;
+        return;
+    }
+    pglDepthFunc(GL_LEQUAL);
+}
+
+static void init_gl(UNUSED void *data)
 {
     gl_init_api();
     gl_init_shaders();
+    gl_init_timers();
+    if (video_is_headless()) {
+        gl_init_offscreen(video_get_surface_size(), use_depth_passes);
+    }
+    if (use_depth_passes) {
+        init_depth_passes();
+    }
 }
 
-void render_fini(void)
+static void fini_gl(UNUSED void *data)
 {
+    mem_free(depth_draws);
+    depth_draws = NULL;
+    depth_draws_capacity = 0;
+    depth_begin = NULL;
+    gl_fini_offscreen();
+    gl_fini_timers();
     gl_fini_shaders();
     gl_fini_api();
     gl_state = RENDER_GL_STATE_NULL;
+    gl_frame_stats = RENDER_GL_FRAME_STATS_NULL;
+    gl_last_frame_stats = RENDER_GL_FRAME_STATS_NULL;
 }
 
-void render_begin_frame(void)
+/* The functions below make the actual GL calls, either directly or when replaying commands. */
+static void begin_frame(struct vec2i surface_size)
 {
-    struct vec2i surface_size = video_get_surface_size();
-
     pglViewport(0, 0, surface_size.x, surface_size.y);
+    if (use_depth_passes) {
+        pglClear(GL_DEPTH_BUFFER_BIT);
+        next_depth_step = 0;
+    }
+    gl_timer_begin_frame();
 }
 
-void render_end_frame(void)
+static void end_frame(void)
 {
+    gl_timer_end_frame();
     gl_flush_errors();
+    gl_trace_end_frame();
+    gl_last_frame_stats = gl_frame_stats;
+    gl_frame_stats = RENDER_GL_FRAME_STATS_NULL;
 }
 
-void render_use_ui_transform(struct rect2i *out_bounds)
+static void clear(struct vec4f color)
 {
-    struct vec2i surface_size = video_get_surface_size();
-
-    gl_use_transform(mat4f_ortho((struct vec3f) {0.0f, (float)surface_size.y, -1.0f},
-                                 (struct vec3f) {(float)surface_size.x, 0.0f, 1.0f}));
-
-    if (out_bounds) {
-        *out_bounds = (struct rect2i) {{0, 0}, surface_size};
+    pglClearColor(color.x, color.y, color.z, color.w);
+    if (use_depth_passes) {
+        pglClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        next_depth_step = 0;
+    } else {
+        pglClear(GL_COLOR_BUFFER_BIT);
     }
 }
 
-void render_use_texture(struct texture *texture)
+static GLenum get_texture_target(const struct texture *texture)
 {
+    return texture && texture->num_layers ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
+}
+
+static void use_texture(struct texture *texture)
+{
+    GLenum target = get_texture_target(texture);
+
     if (texture == gl_state.texture) {
         return;
     }
     pglActiveTexture(GL_TEXTURE0 + RENDER_GL_TEXTURE_UNIT_TEXTURE);
-    pglBindTexture(GL_TEXTURE_2D, texture ? texture->id : 0);
+    /* Arrays and 2D textures are bound separately, so don't leave the other kind bound */
+    if (gl_state.texture && get_texture_target(gl_state.texture) != target) {
+        pglBindTexture(get_texture_target(gl_state.texture), 0);
+    }
+    pglBindTexture(target, texture ? texture->id : 0);
     gl_state.texture = texture;
+    gl_update_texture_size_uniform();
+}
 
-    if (texture && gl_state.program && gl_state.program->uni_texture_size >= 0) {
-        pglUniform2f(gl_state.program->uni_texture_size, (float)texture->size.x, (float)texture->size.y);
+static void use_palette(struct texture *palette)
+{
+    if (palette == gl_state.palette) {
+        return;
     }
+    pglActiveTexture(GL_TEXTURE0 + RENDER_GL_TEXTURE_UNIT_PALETTE);
+    pglBindTexture(GL_TEXTURE_2D, palette ? palette->id : 0);
+    gl_state.palette = palette;
 }
 
-void render_begin_sprites(struct sprite_batch *batch, enum sprite_mode mode)
+static unsigned get_sprite_features(enum sprite_mode mode)
 {
-    DASSERT(batch && batch->num_sprites && !gl_state.sprite_batch);
-
     switch (mode) {
     case SPRITE_MODE_MASK:
-        gl_use_program(&gl_program_alpha_sprites);
-        break;
+        return GL_SPRITE_TEXTURE_ALPHA;
     case SPRITE_MODE_RGB:
-        gl_use_program(&gl_program_rgb_sprites);
-        break;
+        return GL_SPRITE_TEXTURE_RGB;
     case SPRITE_MODE_RGB_MASK:
-        gl_use_program(&gl_program_rgba_sprites);
-        break;
+        return GL_SPRITE_TEXTURE_RGB | GL_SPRITE_TEXTURE_ALPHA;
+    case SPRITE_MODE_INDEXED:
+        return GL_SPRITE_TEXTURE_RGB | GL_SPRITE_TEXTURE_ALPHA | GL_SPRITE_TEXTURE_INDEXED;
     default:
         FATAL("Invalid sprite_mode");
     }
-
-    gl_use_sprite_vertex_ptr(batch->verts);
-    gl_state.sprite_batch = batch;
 }
 
-void render_draw_sprites(int first, int count)
+static void begin_sprites(struct sprite_batch *batch, unsigned features,
+                          const struct sprite_vertex *verts, int num_verts)
 {
-    if (!count) {
-        return;
+    if (gl_state.texture && gl_state.texture->num_layers) {
+        features |= GL_SPRITE_TEXTURE_ARRAY;
     }
-    DASSERT(gl_state.sprite_batch != NULL);
-    DASSERT(first >= 0 && first <= gl_state.sprite_batch->num_sprites);
-    DASSERT(count >= 0 && count <= gl_state.sprite_batch->num_sprites - first);
-    pglDrawArrays(GL_QUADS, first * RENDER_VERTS_PER_SPRITE, count * RENDER_VERTS_PER_SPRITE);
+    gl_use_program(gl_get_sprite_program(features));
+    gl_use_sprite_batch(batch, verts, num_verts);
 }
 
-void render_end_sprites(void)
+static void draw_sprites(int first, int count)
 {
-    DASSERT(gl_state.sprite_batch != NULL);
-    gl_state.sprite_batch = NULL;
-}
-
-void render_draw_sprites_now(struct sprite_batch *batch, enum sprite_mode mode,
-                             int first, int count)
-{
-    render_begin_sprites(batch, mode);
-    render_draw_sprites(first, count);
-    render_end_sprites();
+    pglDrawArrays(GL_QUADS, first * RENDER_VERTS_PER_SPRITE, count * RENDER_VERTS_PER_SPRITE);
+    ++gl_frame_stats.draw_calls;
+    gl_frame_stats.vertices += (unsigned)(count * RENDER_VERTS_PER_SPRITE);
 }
 
-void render_draw_texture(struct texture *texture, struct vec2i pos)
+static void draw_texture(struct texture *texture, struct vec2i pos)
 {
     struct sprite_vertex quad[4];
 
-    if (!texture) {
-        return;
-    }
-
+    ASSERT(!texture->num_layers);
     quad[0] = (struct sprite_vertex) {
         .position = pos,
         .texture_coord = {0, 0},
@@ -151,16 +335,543 @@ void render_draw_texture(struct texture *texture, struct vec2i pos)
 
     switch (texture->format) {
     case PIXEL_FORMAT_RGB_888:
-        gl_use_program(&gl_program_rgb_sprites);
+    case PIXEL_FORMAT_LUMINANCE_8:
+        gl_use_program(gl_get_sprite_program(GL_SPRITE_TEXTURE_RGB));
+        break;
+    case PIXEL_FORMAT_ALPHA_8:
+        /* White, masked by the texture, as in SPRITE_MODE_MASK */
+        gl_use_program(gl_get_sprite_program(GL_SPRITE_TEXTURE_ALPHA));
         break;
     case PIXEL_FORMAT_RGBA_8888:
-        gl_use_program(&gl_program_rgba_sprites);
+    case PIXEL_FORMAT_BGRA_8888: /* Stored as GL_RGBA */
+    case PIXEL_FORMAT_LUMINANCE_ALPHA_88:
+    case PIXEL_FORMAT_DXT1:
+    case PIXEL_FORMAT_DXT5:
+        gl_use_program(gl_get_sprite_program(GL_SPRITE_TEXTURE_RGB | GL_SPRITE_TEXTURE_ALPHA));
         break;
     default:
         FATAL("Unimplemented texture format");
     }
 
-    render_use_texture(texture);
+    use_texture(texture);
     gl_use_sprite_vertex_ptr(quad);
     pglDrawArrays(GL_QUADS, 0, 4);
+    ++gl_frame_stats.draw_calls;
+    gl_frame_stats.vertices += 4;
+}
+
+static const struct sprite_vertex *get_recorded_verts(const struct render_cmd_list *list,
+                                                     const struct render_cmd *begin)
+{
+    return begin->u.begin_sprites.upload ? list->verts + begin->u.begin_sprites.first_vert : NULL;
+}
+
+static void replay_cmd(const struct render_cmd_list *list, const struct render_cmd *cmd)
+{
+    switch (cmd->type) {
+    case RENDER_CMD_BEGIN_FRAME:
+        begin_frame(cmd->u.surface_size);
+        break;
+    case RENDER_CMD_END_FRAME:
+        end_frame();
+        break;
+    case RENDER_CMD_PRESENT:
+        video_swap_buffers();
+        break;
+    case RENDER_CMD_CLEAR:
+        clear(cmd->u.color);
+        break;
+    case RENDER_CMD_USE_TRANSFORM:
+        gl_use_transform(cmd->u.transform);
+        break;
+    case RENDER_CMD_USE_TEXTURE:
+        use_texture(cmd->u.texture);
+        break;
+    case RENDER_CMD_USE_PALETTE:
+        use_palette(cmd->u.texture);
+        break;
+    case RENDER_CMD_BEGIN_SPRITES:
+        begin_sprites(cmd->u.begin_sprites.batch, get_sprite_features(cmd->u.begin_sprites.mode),
+                      get_recorded_verts(list, cmd), cmd->u.begin_sprites.num_verts);
+        break;
+    case RENDER_CMD_DRAW_SPRITES:
+        draw_sprites(cmd->u.draw_sprites.first, cmd->u.draw_sprites.count);
+        break;
+    case RENDER_CMD_BEGIN_TIMER:
+        gl_begin_timer(cmd->u.timer_name);
+        break;
+    case RENDER_CMD_END_TIMER:
+        gl_end_timer();
+        break;
+    case RENDER_CMD_DRAW_TEXTURE:
+        draw_texture(cmd->u.draw_texture.texture, cmd->u.draw_texture.pos);
+        break;
+    }
+}
+
+static bool is_sprite_cmd(enum render_cmd_type type)
+{
+    switch (type) {
+    case RENDER_CMD_USE_TRANSFORM:
+    case RENDER_CMD_USE_TEXTURE:
+    case RENDER_CMD_USE_PALETTE:
+    case RENDER_CMD_BEGIN_SPRITES:
+    case RENDER_CMD_DRAW_SPRITES:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static struct depth_draw *add_depth_draw(size_t index)
+{
+    if (index == depth_draws_capacity) {
+        depth_draws_capacity = depth_draws_capacity ? depth_draws_capacity * 2 : 256;
+        depth_draws = mem_realloc_array(depth_draws, depth_draws_capacity, sizeof(*depth_draws));
+    }
+    return &depth_draws[index];
+}
+
+static void draw_depth_draw(const struct render_cmd_list *list, const struct depth_draw *draw)
+{
+    const struct render_cmd *begin = draw->begin;
+    unsigned features = get_sprite_features(begin->u.begin_sprites.mode);
+
+    if (draw->opaque) {
+        features |= GL_SPRITE_OPAQUE;
+    }
+    gl_use_transform(*draw->transform);
+    use_texture(draw->texture);
+    use_palette(draw->palette);
+    /* The vertices were uploaded before the passes began, unless they're never kept on the GPU */
+    begin_sprites(begin->u.begin_sprites.batch, features,
+                  gl_caps.vertex_array_object ? NULL : get_recorded_verts(list, begin),
+                  begin->u.begin_sprites.num_verts);
+    /* Later draws are nearer, so that they still cover earlier ones */
+    gl_state.depth = 1.0f - 2.0f * (float)(draw->depth_step + 1) / (float)DEPTH_STEPS;
+    gl_update_depth_uniform();
+    draw_sprites(draw->first, draw->count);
+}
+
+/*
+ * Replays a segment of sprite commands starting at list->cmds[start], and
+ * returns the index of the first command after the segment. Opaque draws are
+ * made first, front to back with depth writes so that the GPU can skip
+ * hidden fragments. The other draws are then made back to front, in the order
+ * they were recorded, and depth tested against the opaque ones. Like the
+ * default path, they discard but don't blend, so the image is the same.
+ *
+ * Segments end at anything other than sprite commands, since those don't use
+ * the depth buffer. They also end where a batch is uploaded again after being
+ * drawn from, since all of a segment's uploads happen before its draws.
+ */
+static size_t replay_depth_passes(const struct render_cmd_list *list, size_t start)
+{
+    const struct render_cmd *cmd;
+    struct mat4f start_transform = gl_state.transform;
+    const struct mat4f *transform = &start_transform;
+    struct texture *texture = gl_state.texture;
+    struct texture *palette = gl_state.palette;
+    const struct render_cmd *begin = depth_begin;
+    struct sprite_batch *batch;
+    struct depth_draw *draw;
+    size_t num_draws = 0;
+    size_t num_opaque = 0;
+    size_t end, i;
+
+    if (!++depth_segment) {
+        depth_segment = 1;
+    }
+
+    /* Collect the draws along with their state */
+    for (end = start; end < list->num_cmds && is_sprite_cmd(list->cmds[end].type); ++end) {
+        cmd = &list->cmds[end];
+        if (cmd->type == RENDER_CMD_USE_TRANSFORM) {
+            transform = &cmd->u.transform;
+        } else if (cmd->type == RENDER_CMD_USE_TEXTURE) {
+            texture = cmd->u.texture;
+        } else if (cmd->type == RENDER_CMD_USE_PALETTE) {
+            palette = cmd->u.texture;
+        } else if (cmd->type == RENDER_CMD_BEGIN_SPRITES) {
+            /* Drawing from the batch earlier in the segment would see these vertices instead */
+            batch = cmd->u.begin_sprites.batch;
+            if (batch->depth_segment == depth_segment && cmd->u.begin_sprites.upload
+                && gl_caps.vertex_array_object)
+            {
+                break;
+            }
+            begin = cmd;
+        } else {
+            if (num_draws == DEPTH_STEPS) {
+                break;
+            }
+            DASSERT(begin != NULL);
+            begin->u.begin_sprites.batch->depth_segment = depth_segment;
+            draw = add_depth_draw(num_draws++);
+            draw->transform = transform;
+            draw->texture = texture;
+            draw->palette = palette;
+            draw->begin = begin;
+            draw->first = cmd->u.draw_sprites.first;
+            draw->count = cmd->u.draw_sprites.count;
+            draw->opaque = cmd->u.draw_sprites.opaque;
+            if (draw->opaque) {
+                ++num_opaque;
+            }
+        }
+    }
+
+    if (num_draws > (size_t)(DEPTH_STEPS - next_depth_step)) {
+        pglClear(GL_DEPTH_BUFFER_BIT);
+        next_depth_step = 0;
+    }
+    for (i = 0; i < num_draws; ++i) {
+        depth_draws[i].depth_step = next_depth_step++;
+    }
+
+    /* Upload vertices in advance, including those of batches which were begun without drawing anything */
+    if (gl_caps.vertex_array_object) {
+        for (i = start; i < end; ++i) {
+            cmd = &list->cmds[i];
+            if (cmd->type == RENDER_CMD_BEGIN_SPRITES && cmd->u.begin_sprites.upload) {
+                gl_use_sprite_batch(cmd->u.begin_sprites.batch, get_recorded_verts(list, cmd),
+                                    cmd->u.begin_sprites.num_verts);
+            }
+        }
+    }
+
+    if (num_draws) {
+        pglEnable(GL_DEPTH_TEST);
+        for (i = num_draws; i-- > 0;) {
+            if (depth_draws[i].opaque) {
+                draw_depth_draw(list, &depth_draws[i]);
+            }
+        }
+        if (num_opaque < num_draws) {
+            pglDepthMask(GL_FALSE);
+            for (i = 0; i < num_draws; ++i) {
+                if (!depth_draws[i].opaque) {
+                    draw_depth_draw(list, &depth_draws[i]);
+                }
+            }
+            pglDepthMask(GL_TRUE);
+        }
+        pglDisable(GL_DEPTH_TEST);
+    }
+
+    /* Leave the state as if the commands had been replayed in order */
+    gl_use_transform(*transform);
+    use_texture(texture);
+    use_palette(palette);
+    depth_begin = begin;
+    return end;
+}
+
+/* Runs on the render thread */
+static void replay(void *data)
+{
+    const struct render_cmd_list *list = data;
+    size_t i = 0;
+
+    depth_begin = NULL;
+    while (i < list->num_cmds) {
+        if (use_depth_passes && is_sprite_cmd(list->cmds[i].type)) {
+            i = replay_depth_passes(list, i);
+        } else {
+            replay_cmd(list, &list->cmds[i++]);
+        }
+    }
+}
+
+/*
+ * Hands the recorded commands over to the render thread, or replays them now
+ * if there isn't one, and starts recording into the other list. That one is
+ * free, since render_thread_post waits for the previous job.
+ */
+static void flush(void)
+{
+    if (!recording || !recording->num_cmds) {
+        return;
+    }
+    render_thread_post(&replay, recording);
+    recording = recording == &cmd_lists[0] ? &cmd_lists[1] : &cmd_lists[0];
+    recording->num_cmds = 0;
+    recording->num_verts = 0;
+
+    /*
+     * The depth passes replay each list on its own, so a batch which is still
+     * begun has to be begun again. Its vertices are already on the GPU if they
+     * can be kept there.
+     */
+    if (gl_state.sprite_batch) {
+        record_begin_sprites(gl_state.sprite_batch, sprite_batch_mode, !gl_caps.vertex_array_object);
+    }
+}
+
+void render_run(render_thread_fn_t fn, void *data)
+{
+    flush();
+    render_thread_run(fn, data);
+}
+
+void render_enable_gpu_timers(void)
+{
+    gl_enable_timers();
+}
+
+void render_enable_thread(void)
+{
+    use_thread = true;
+}
+
+void render_enable_depth_passes(void)
+{
+    use_depth_passes = true;
+    video_request_depth_buffer();
+}
+
+void render_init(void)
+{
+    if (use_thread) {
+        render_thread_start();
+    }
+    /* This turns the depth passes back off if we didn't get a depth buffer */
+    render_thread_run(&init_gl, NULL);
+    if (use_thread || use_depth_passes) {
+        recording = &cmd_lists[0];
+    }
+}
+
+void render_fini(void)
+{
+    flush();
+    recording = NULL;
+    render_thread_run(&fini_gl, NULL);
+    render_thread_stop();
+    fini_cmd_list(&cmd_lists[0]);
+    fini_cmd_list(&cmd_lists[1]);
+}
+
+void render_begin_frame(void)
+{
+    struct vec2i surface_size = video_get_surface_size();
+
+    if (recording) {
+        record(RENDER_CMD_BEGIN_FRAME)->u.surface_size = surface_size;
+    } else {
+        begin_frame(surface_size);
+    }
+}
+
+void render_end_frame(void)
+{
+    if (recording) {
+        record(RENDER_CMD_END_FRAME);
+    } else {
+        end_frame();
+    }
+}
+
+void render_present(void)
+{
+    if (recording) {
+        record(RENDER_CMD_PRESENT);
+        flush();
+    } else {
+        video_swap_buffers();
+    }
+}
+
+static void finish(UNUSED void *data)
+{
+    pglFinish();
+}
+
+void render_finish(void)
+{
+    flush();
+    render_thread_run(&finish, NULL);
+}
+
+struct read_frame_params {
+    struct vec2i size;
+    struct pixbuf *out;
+};
+
+static void read_frame(void *data)
+{
+    const struct read_frame_params *params = data;
+
+    gl_read_frame(params->size, params->out);
+}
+
+void render_read_frame(struct pixbuf *out)
+{
+    struct read_frame_params params = {video_get_surface_size(), out};
+
+    flush();
+    render_thread_run(&read_frame, &params);
+}
+
+void render_clear(struct vec4f color)
+{
+    if (recording) {
+        record(RENDER_CMD_CLEAR)->u.color = color;
+    } else {
+        clear(color);
+    }
+}
+
+void render_use_ui_transform(struct rect2i *out_bounds)
+{
+    struct vec2i surface_size = video_get_surface_size();
+    struct mat4f transform = mat4f_ortho((struct vec3f) {0.0f, (float)surface_size.y, -1.0f},
+                                         (struct vec3f) {(float)surface_size.x, 0.0f, 1.0f});
+
+    if (recording) {
+        record(RENDER_CMD_USE_TRANSFORM)->u.transform = transform;
+    } else {
+        gl_use_transform(transform);
+    }
+
+    if (out_bounds) {
+        *out_bounds = (struct rect2i) {{0, 0}, surface_size};
+    }
+}
+
+void render_use_texture(struct texture *texture)
+{
+    if (texture) {
+        texture_touch(texture);
+    }
+    if (recording) {
+        record(RENDER_CMD_USE_TEXTURE)->u.texture = texture;
+    } else {
+        use_texture(texture);
+    }
+}
+
+void render_use_palette(struct texture *palette)
+{
+    if (palette) {
+        ASSERT(palette->size.x == 256 && palette->size.y == 1 && palette->format == PIXEL_FORMAT_RGBA_8888);
+        texture_touch(palette);
+    }
+    if (recording) {
+        record(RENDER_CMD_USE_PALETTE)->u.texture = palette;
+    } else {
+        use_palette(palette);
+    }
+}
+
+void render_begin_sprites(struct sprite_batch *batch, enum sprite_mode mode)
+{
+    bool upload;
+
+    DASSERT(batch && batch->num_sprites && !batch->filling && !gl_state.sprite_batch);
+
+    /* Without vertex array objects, the vertices are never kept on the GPU */
+    upload = batch->dirty || !gl_caps.vertex_array_object;
+
+    if (recording) {
+        record_begin_sprites(batch, mode, upload);
+    } else {
+        begin_sprites(batch, get_sprite_features(mode), upload ? batch->verts : NULL, batch->num_verts);
+    }
+    batch->dirty = false;
+    gl_state.sprite_batch = batch;
+    sprite_batch_mode = mode;
+}
+
+/*
+ * Whether sprites draw the same in the opaque depth pass, which neither
+ * discards nor keeps their alpha. Only SPRITE_MODE_RGB ignores the texture's
+ * alpha, and only vertex colors with full alpha can't be discarded.
+ */
+static bool is_opaque_draw(const struct sprite_batch *batch, enum sprite_mode mode, int first, int count)
+{
+    const struct sprite_vertex *vert = &batch->verts[(size_t)first * RENDER_VERTS_PER_SPRITE];
+    const struct sprite_vertex *end = &batch->verts[(size_t)(first + count) * RENDER_VERTS_PER_SPRITE];
+
+    if (mode != SPRITE_MODE_RGB) {
+        return false;
+    }
+    for (; vert < end; ++vert) {
+        if (vert->color.w != 1.0f) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void render_draw_sprites(int first, int count)
+{
+    struct render_cmd *cmd;
+
+    if (!count) {
+        return;
+    }
+    DASSERT(gl_state.sprite_batch != NULL);
+    DASSERT(first >= 0 && first <= gl_state.sprite_batch->num_sprites);
+    DASSERT(count >= 0 && count <= gl_state.sprite_batch->num_sprites - first);
+
+    if (recording) {
+        cmd = record(RENDER_CMD_DRAW_SPRITES);
+        cmd->u.draw_sprites.first = first;
+        cmd->u.draw_sprites.count = count;
+        cmd->u.draw_sprites.opaque = use_depth_passes
+                                     && is_opaque_draw(gl_state.sprite_batch, sprite_batch_mode, first, count);
+    } else {
+        draw_sprites(first, count);
+    }
+}
+
+void render_end_sprites(void)
+{
+    DASSERT(gl_state.sprite_batch != NULL);
+    gl_state.sprite_batch = NULL;
+}
+
+void render_draw_sprites_now(struct sprite_batch *batch, enum sprite_mode mode,
+                             int first, int count)
+{
+    render_begin_sprites(batch, mode);
+    render_draw_sprites(first, count);
+    render_end_sprites();
+}
+
+void render_begin_timer(const char *name)
+{
+    if (recording) {
+        record(RENDER_CMD_BEGIN_TIMER)->u.timer_name = name;
+    } else {
+        gl_begin_timer(name);
+    }
+}
+
+void render_end_timer(void)
+{
+    if (recording) {
+        record(RENDER_CMD_END_TIMER);
+    } else {
+        gl_end_timer();
+    }
+}
+
+void render_draw_texture(struct texture *texture, struct vec2i pos)
+{
+    struct render_cmd *cmd;
+
+    if (!texture) {
+        return;
+    }
+
+    texture_touch(texture);
+    if (recording) {
+        cmd = record(RENDER_CMD_DRAW_TEXTURE);
+        cmd->u.draw_texture.texture = texture;
+        cmd->u.draw_texture.pos = pos;
+    } else {
+        draw_texture(texture, pos);
+    }
 }
@@ -17,8 +17,10 @@
 #ifndef INCLUDED_RENDER_H
 #define INCLUDED_RENDER_H
 
+#include "render_thread.h"
 #include "types.h"
 
+struct pixbuf;
 struct sprite_batch;
 struct texture;
 
@@ -27,16 +29,70 @@ enum sprite_mode {
     SPRITE_MODE_MASK,
     SPRITE_MODE_RGB,
     SPRITE_MODE_RGB_MASK,
+    SPRITE_MODE_INDEXED, /* Color and alpha from the palette, indexed by the texture's alpha channel */
 };
 
+/* Enables GPU timers. Must be called before render_init. */
+void render_enable_gpu_timers(void);
+
+/*
+ * Moves all GL work to a separate thread, which must be done before
+ * render_init. The render functions then record commands, which the render
+ * thread replays while the next frame is being prepared. Creating, uploading
+ * and destroying textures and sprite batches waits for the render thread to
+ * replay what has been recorded so far (see render_run).
+ */
+void render_enable_thread(void);
+
+/*
+ * Draws sprites in depth-tested passes, which must be enabled before
+ * video_init so that there is a depth buffer. Draws of SPRITE_MODE_RGB
+ * sprites whose vertex colors all have an alpha of 1 are opaque. They're
+ * drawn first, front to back and without discarding, so that the GPU can skip
+ * shading whatever they hide. Other draws are then made over them, back to
+ * front. Each draw call gets its own depth, so sprites within one still
+ * overlap in painter's order. Like the render thread, this defers sprite
+ * drawing until render_present.
+ */
+void render_enable_depth_passes(void);
+
 void render_init(void);
 void render_fini(void);
+
+/*
+ * Runs fn with the GL context and waits for it to finish, after replaying the
+ * commands recorded so far. GL work outside of the render functions, such as
+ * creating, uploading and destroying textures and sprite batches, goes
+ * through this so that it happens in order with drawing.
+ */
+void render_run(render_thread_fn_t fn, void *data);
 void render_begin_frame(void);
 void render_end_frame(void);
 
+/* Swaps buffers, or hands the frame over to the render thread to do so. */
+void render_present(void);
+
+/* Blocks until the GPU has finished all rendering commands. */
+void render_finish(void);
+
+/* Reads back the current frame as RGB, top row first. */
+void render_read_frame(struct pixbuf *out);
+
+void render_clear(struct vec4f color);
+
 /* Sets the transform to world coordinates = screen coordinates */
 void render_use_ui_transform(struct rect2i *out_bounds);
+/*
+ * Sets the texture for sprites. Switching between 2D and array textures
+ * switches programs, so it has to happen before render_begin_sprites.
+ */
 void render_use_texture(struct texture *texture);
+/*
+ * Sets the palette for SPRITE_MODE_INDEXED, which must be a 256x1 RGBA_8888
+ * texture. Index textures are ALPHA_8, which takes a quarter of the memory
+ * and upload bandwidth of RGBA_8888, and switching palettes recolors them.
+ */
+void render_use_palette(struct texture *palette);
 
 void render_begin_sprites(struct sprite_batch *batch, enum sprite_mode mode);
 void render_draw_sprites(int first, int count);
@@ -45,6 +101,14 @@ void render_end_sprites(void);
 void render_draw_sprites_now(struct sprite_batch *batch, enum sprite_mode mode,
                              int first, int count);
 
+/*
+ * Measures the GPU time of a section of the frame, such as a group of
+ * render_begin_sprites calls, if GPU timers are enabled and supported.
+ * Sections can't be nested. The name must be a string literal.
+ */
+void render_begin_timer(const char *name);
+void render_end_timer(void);
+
 /* Functions for debugging purposes, not optimized */
 void render_draw_texture(struct texture *texture, struct vec2i pos);
 
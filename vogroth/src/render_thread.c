@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2021 Marty Mills <daggerbot@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <SDL_mutex.h>
+#include <SDL_thread.h>
+
+#include "debug.h"
+#include "render_thread.h"
+#include "video.h"
+
+static SDL_Thread *thread = NULL;
+static SDL_threadID thread_id = 0;
+static SDL_mutex *mutex = NULL;
+static SDL_cond *cond = NULL; /* Signalled whenever busy or quit changes */
+
+/* Protected by mutex */
+static render_thread_fn_t job_fn = NULL;
+static void *job_data = NULL;
+static bool busy = false; /* A job has been posted and hasn't finished yet */
+static bool quit = false;
+
+static int thread_main(UNUSED void *data)
+{
+    render_thread_fn_t fn;
+    void *fn_data;
+
+    video_make_gl_context_current();
+
+    SDL_LockMutex(mutex);
+    for (;;) {
+        while (!busy && !quit) {
+            SDL_CondWait(cond, mutex);
+        }
+        if (!busy) {
+            break;
+        }
+        fn = job_fn;
+        fn_data = job_data;
+        SDL_UnlockMutex(mutex);
+
+        fn(fn_data);
+
+        SDL_LockMutex(mutex);
+        busy = false;
+        SDL_CondBroadcast(cond);
+    }
+    SDL_UnlockMutex(mutex);
+
+    video_release_gl_context();
+    return 0;
+}
+
+void render_thread_start(void)
+{
+    ASSERT(!thread);
+
+    mutex = SDL_CreateMutex();
+    cond = SDL_CreateCond();
+    if (!mutex || !cond) {
+        FATAL("Can't create render thread: %s", SDL_GetError());
+    }
+    busy = false;
+    quit = false;
+
+    video_release_gl_context();
+    thread = SDL_CreateThread(&thread_main, "render", NULL);
+    if (!thread) {
+        FATAL("Can't create render thread: %s", SDL_GetError());
+    }
+    thread_id = SDL_GetThreadID(thread);
+    LOG_DEBUG("Started render thread");
+}
+
+void render_thread_stop(void)
+{
+    if (!thread) {
+        return;
+    }
+
+    SDL_LockMutex(mutex);
+    while (busy) {
+        SDL_CondWait(cond, mutex);
+    }
+    quit = true;
+    SDL_CondBroadcast(cond);
+    SDL_UnlockMutex(mutex);
+
+    SDL_WaitThread(thread, NULL);
+    thread = NULL;
+    thread_id = 0;
+    SDL_DestroyCond(cond);
+    SDL_DestroyMutex(mutex);
+    cond = NULL;
+    mutex = NULL;
+
+    video_make_gl_context_current();
+}
+
+bool render_thread_running(void)
+{
+    return thread != NULL;
+}
+
+void render_thread_post(render_thread_fn_t fn, void *data)
+{
+    DASSERT(fn != NULL);
+
+    /* Also avoid deadlocking if a job ends up calling back into us. */
+    if (!thread || SDL_ThreadID() == thread_id) {
+        fn(data);
+        return;
+    }
+
+    SDL_LockMutex(mutex);
+    while (busy) {
+        SDL_CondWait(cond, mutex);
+    }
+    job_fn = fn;
+    job_data = data;
+    busy = true;
+    SDL_CondBroadcast(cond);
+    SDL_UnlockMutex(mutex);
+}
+
+void render_thread_run(render_thread_fn_t fn, void *data)
+{
+    render_thread_post(fn, data);
+    if (!thread || SDL_ThreadID() == thread_id) {
+        return;
+    }
+
+    SDL_LockMutex(mutex);
+    while (busy) {
+        SDL_CondWait(cond, mutex);
+    }
+    SDL_UnlockMutex(mutex);
+}
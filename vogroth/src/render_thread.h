@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2021 Marty Mills <daggerbot@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_RENDER_THREAD_H
+#define INCLUDED_RENDER_THREAD_H
+
+#include "types.h"
+
+/*
+ * Optional thread which owns the GL context, so that the main thread can get
+ * on with the next frame while the last one is being submitted. While it's
+ * running, all GL calls must be made through render_thread_post or
+ * render_thread_run. When it isn't, they just call the function.
+ */
+typedef void(*render_thread_fn_t)(void *data);
+
+/* Starts the thread and moves the GL context created by video_init to it. */
+void render_thread_start(void);
+
+/* Waits for the thread to finish its work, and moves the GL context back. */
+void render_thread_stop(void);
+bool render_thread_running(void);
+
+/*
+ * Runs fn on the render thread as soon as it has finished its previous job,
+ * without waiting for fn to finish. data must stay valid until it has, which
+ * is guaranteed once the next render_thread_post or render_thread_run returns.
+ */
+void render_thread_post(render_thread_fn_t fn, void *data);
+
+/* Runs fn on the render thread and waits for it to finish. */
+void render_thread_run(render_thread_fn_t fn, void *data);
+
+#endif /* INCLUDED_RENDER_THREAD_H */
@@ -14,7 +14,6 @@
  * this program. If not, see <https://www.gnu.org/licenses/>.
  */
 
-#include "gl_api.h"
 #include "render.h"
 
 void sandbox_init(void)
@@ -25,11 +24,19 @@ void sandbox_fini(void)
 {
 }
 
+void sandbox_update(void)
+{
+}
+
 void sandbox_render(void)
 {
     struct rect2i bounds;
 
-    pglClearColor(0.1f, 0.1f, 0.1f, 0.0f);
-    pglClear(GL_COLOR_BUFFER_BIT);
+    render_begin_timer("clear");
+    render_clear((struct vec4f) {0.1f, 0.1f, 0.1f, 0.0f});
+    render_end_timer();
+
+    render_begin_timer("ui");
     render_use_ui_transform(&bounds);
+    render_end_timer();
 }
@@ -21,6 +21,9 @@
 
 void sandbox_init(void);
 void sandbox_fini(void);
+
+/* Advances the game by one fixed simulation tick (see sim.h). */
+void sandbox_update(void);
 void sandbox_render(void);
 
 #endif /* INCLUDED_SANDBOX_H */
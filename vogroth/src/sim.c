@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2021 Marty Mills <daggerbot@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "debug.h"
+#include "sim.h"
+#include "system.h"
+
+static sim_tick_callback_t tick_callback = NULL;
+static uint64_t last_time = 0;
+static uint64_t accumulator = 0; /* Simulation time owed, in ns */
+static struct sim_stats stats;
+
+static void run_tick(void)
+{
+    uint64_t start_time = system_get_time_ns();
+    uint64_t tick_ns;
+
+    if (tick_callback) {
+        tick_callback();
+    }
+    tick_ns = system_get_time_ns() - start_time;
+    stats.last_tick_ns = tick_ns;
+    if (tick_ns > stats.max_tick_ns) {
+        stats.max_tick_ns = tick_ns;
+    }
+    stats.total_tick_ns += tick_ns;
+    ++stats.ticks;
+}
+
+void sim_init(sim_tick_callback_t tick)
+{
+    tick_callback = tick;
+    stats = (struct sim_stats){0};
+    sim_resync();
+}
+
+void sim_fini(void)
+{
+    if (stats.ticks) {
+        LOG_DEBUG("Simulation: %" PRIu64 " ticks, %.3f ms average, %.3f ms max, "
+                  "%d max backlog, %" PRIu64 " dropped", stats.ticks,
+                  (double)stats.total_tick_ns / (double)stats.ticks / 1e6,
+                  (double)stats.max_tick_ns / 1e6, stats.max_backlog, stats.dropped_ticks);
+    }
+    tick_callback = NULL;
+}
+
+void sim_advance(void)
+{
+    uint64_t now = system_get_time_ns();
+    uint64_t num_ticks;
+    int i;
+
+    accumulator += now - last_time;
+    last_time = now;
+
+    num_ticks = accumulator / SIM_TICK_NS;
+    if (num_ticks > SIM_MAX_TICKS_PER_FRAME) {
+        stats.dropped_ticks += num_ticks - SIM_MAX_TICKS_PER_FRAME;
+        accumulator -= (num_ticks - SIM_MAX_TICKS_PER_FRAME) * SIM_TICK_NS;
+        num_ticks = SIM_MAX_TICKS_PER_FRAME;
+    }
+    for (i = 0; i < (int)num_ticks; ++i) {
+        run_tick();
+        accumulator -= SIM_TICK_NS;
+    }
+
+    stats.backlog = (int)num_ticks;
+    if (stats.backlog > stats.max_backlog) {
+        stats.max_backlog = stats.backlog;
+    }
+}
+
+void sim_step(void)
+{
+    run_tick();
+    accumulator = 0;
+    last_time = system_get_time_ns();
+}
+
+void sim_resync(void)
+{
+    last_time = system_get_time_ns();
+    accumulator = 0;
+}
+
+float sim_get_alpha(void)
+{
+    return (float)accumulator / (float)SIM_TICK_NS;
+}
+
+uint64_t sim_get_tick_count(void)
+{
+    return stats.ticks;
+}
+
+const struct sim_stats *sim_get_stats(void)
+{
+    return &stats;
+}
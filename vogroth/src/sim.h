@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2021 Marty Mills <daggerbot@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_SIM_H
+#define INCLUDED_SIM_H
+
+#include "types.h"
+
+/*
+ * Fixed-timestep simulation clock. Game logic runs in ticks of exactly
+ * SIM_TICK_NS, however fast frames are rendered. Rendering happens between
+ * ticks, so renderers should interpolate between the previous and current
+ * tick's state using sim_get_alpha.
+ */
+#define SIM_TICK_RATE 60
+#define SIM_TICK_NS (1000000000u / SIM_TICK_RATE)
+
+/*
+ * If we fall further behind than this, the excess is dropped and the game
+ * slows down, rather than running ever more ticks to catch up.
+ */
+#define SIM_MAX_TICKS_PER_FRAME 8
+
+typedef void(*sim_tick_callback_t)(void);
+
+struct sim_stats {
+    uint64_t ticks;
+    uint64_t dropped_ticks;
+    uint64_t last_tick_ns; /* CPU time spent in the most recent tick */
+    uint64_t max_tick_ns;
+    uint64_t total_tick_ns;
+    int backlog;           /* Ticks run by the most recent sim_advance */
+    int max_backlog;
+};
+
+void sim_init(sim_tick_callback_t tick);
+void sim_fini(void);
+
+/* Runs as many ticks as the time since the last call calls for. */
+void sim_advance(void);
+
+/* Runs exactly one tick, regardless of the clock. Used for deterministic runs. */
+void sim_step(void);
+
+/*
+ * Forgets time which has passed since the last tick, such as while the game
+ * was idle with nothing to simulate.
+ */
+void sim_resync(void);
+
+/* Gets how far we are between the current tick and the next, in [0, 1). */
+float sim_get_alpha(void);
+uint64_t sim_get_tick_count(void);
+const struct sim_stats *sim_get_stats(void);
+
+#endif /* INCLUDED_SIM_H */
@@ -14,14 +14,28 @@
  * this program. If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <stddef.h>
 #include <string.h>
 
+#include "cpu.h"
 #include "debug.h"
 #include "gl_state.h"
 #include "memory.h"
+#include "render.h"
 #include "sprites.h"
 #include "texture.h"
 
+#ifdef CPU_X86
+# include <immintrin.h>
+#endif
+
+#define MAX_SPRITES (INT_MAX / RENDER_VERTS_PER_SPRITE)
+
+static void fini_gl_sprite_batch(void *data)
+{
+    gl_fini_sprite_batch(data);
+}
+
 struct sprite_batch *sprite_batch_create(void)
 {
     struct sprite_batch *batch;
@@ -37,10 +51,29 @@ void sprite_batch_destroy(struct sprite_batch *batch)
         return;
     }
     ASSERT(batch != gl_state.sprite_batch); /* Don't delete the active sprite batch */
+    render_run(&fini_gl_sprite_batch, batch);
     mem_free(batch->verts);
     mem_free(batch);
 }
 
+/* Grows the vertex storage geometrically, so that appending one sprite at a time is cheap. */
+static void reserve(struct sprite_batch *batch, int num_sprites)
+{
+    int capacity;
+
+    ASSERT(num_sprites >= 0 && num_sprites <= MAX_SPRITES);
+    if (num_sprites <= batch->capacity) {
+        return;
+    }
+    capacity = batch->capacity <= MAX_SPRITES / 2 ? batch->capacity * 2 : MAX_SPRITES;
+    if (capacity < num_sprites) {
+        capacity = num_sprites;
+    }
+    batch->verts = mem_realloc_array(batch->verts, (size_t)capacity * RENDER_VERTS_PER_SPRITE,
+                                     sizeof(*batch->verts));
+    batch->capacity = capacity;
+}
+
 void sprite_batch_resize(struct sprite_batch *batch, int num_sprites)
 {
     int old_size;
@@ -50,15 +83,16 @@ void sprite_batch_resize(struct sprite_batch *batch, int num_sprites)
         return;
     }
     ASSERT(batch != gl_state.sprite_batch); /* Don't resize the active sprite batch */
-    ASSERT(num_sprites >= 0 && num_sprites <= INT_MAX / RENDER_VERTS_PER_SPRITE);
+    ASSERT(!batch->filling);
+    reserve(batch, num_sprites);
     old_size = batch->num_sprites;
     batch->num_sprites = num_sprites;
     batch->num_verts = num_sprites * RENDER_VERTS_PER_SPRITE;
-    batch->verts = mem_realloc_array(batch->verts, (size_t)batch->num_verts, sizeof(*batch->verts));
     if (num_sprites > old_size) {
         memset(batch->verts + old_size * RENDER_VERTS_PER_SPRITE, 0,
                (size_t)(num_sprites - old_size) * sizeof(struct sprite_vertex) * RENDER_VERTS_PER_SPRITE);
     }
+    batch->dirty = true;
 }
 
 int sprite_batch_append(struct sprite_batch *batch, int num_sprites)
@@ -72,15 +106,11 @@ int sprite_batch_append(struct sprite_batch *batch, int num_sprites)
     return index;
 }
 
-void sprite_batch_put(struct sprite_batch *batch, int index, struct rect2i src_rect,
-                      struct vec2i pos, struct vec4f color)
+static inline void write_sprite(struct sprite_vertex *verts, struct rect2i src_rect,
+                                struct vec2i pos, struct vec4f color)
 {
-    struct sprite_vertex *verts;
     struct vec2i size = {src_rect.b.x - src_rect.a.x, src_rect.b.y - src_rect.a.y};
 
-    DASSERT(batch && index >= 0 && index < batch->num_sprites);
-    verts = batch->verts + index * RENDER_VERTS_PER_SPRITE;
-
     verts[0] = (struct sprite_vertex) {
         .position = {pos.x, pos.y},
         .texture_coord = {src_rect.a.x, src_rect.a.y},
@@ -102,3 +132,184 @@ void sprite_batch_put(struct sprite_batch *batch, int index, struct rect2i src_r
         .color = color,
     };
 }
+
+void sprite_batch_put(struct sprite_batch *batch, int index, struct rect2i src_rect,
+                      struct vec2i pos, struct vec4f color)
+{
+    DASSERT(batch && index >= 0 && index < (batch->filling ? batch->capacity : batch->num_sprites));
+
+    /* While filling, this may be running on several threads, and begin_fill has already set dirty. */
+    if (!batch->filling) {
+        batch->dirty = true;
+    }
+    write_sprite(batch->verts + index * RENDER_VERTS_PER_SPRITE, src_rect, pos, color);
+}
+
+/*
+ * The kernels below write count sprites to verts. Each vertex starts with its
+ * position and texture coordinate, which are built from the sprite's position
+ * and source rectangle as one 128-bit vector:
+ *
+ *   0: (x,     y,     a.x, a.y)  = lo
+ *   1: (x,     y + h, a.x, b.y)  = odd lanes from hi
+ *   2: (x + w, y + h, b.x, b.y)  = hi
+ *   3: (x + w, y,     b.x, a.y)  = odd lanes from lo
+ *
+ * The color fills the other 128 bits.
+ */
+STATIC_ASSERT(sizeof(struct sprite_vertex) == 32);
+STATIC_ASSERT(offsetof(struct sprite_vertex, texture_coord) == 8);
+STATIC_ASSERT(offsetof(struct sprite_vertex, color) == 16);
+STATIC_ASSERT(sizeof(struct rect2i) == 16);
+STATIC_ASSERT(sizeof(struct vec2i) == 8);
+
+static void put_many_scalar(struct sprite_vertex *verts, int count, const struct vec2i *positions,
+                            const struct rect2i *src_rects, const struct vec4f *colors)
+{
+    static const struct vec4f white = {1.0f, 1.0f, 1.0f, 1.0f};
+    int i;
+
+    for (i = 0; i < count; ++i) {
+        write_sprite(verts + i * RENDER_VERTS_PER_SPRITE, src_rects[i], positions[i],
+                     colors ? colors[i] : white);
+    }
+}
+
+#ifdef CPU_X86
+static TARGET("sse2") void put_many_sse2(struct sprite_vertex *verts, int count,
+                                         const struct vec2i *positions,
+                                         const struct rect2i *src_rects, const struct vec4f *colors)
+{
+    const __m128i odd = _mm_set_epi32(-1, 0, -1, 0);
+    const __m128 white = _mm_set1_ps(1.0f);
+    __m128i rect, pos, b, size, lo, hi, v1, v3;
+    __m128 color;
+    __m128i *out;
+    int i;
+
+    for (i = 0; i < count; ++i) {
+        rect = _mm_loadu_si128((const __m128i *)&src_rects[i]);
+        pos = _mm_loadl_epi64((const __m128i *)&positions[i]);
+        b = _mm_unpackhi_epi64(rect, rect);
+        size = _mm_sub_epi32(b, rect);
+        lo = _mm_unpacklo_epi64(pos, rect);
+        hi = _mm_unpacklo_epi64(_mm_add_epi32(pos, size), b);
+        v1 = _mm_or_si128(_mm_andnot_si128(odd, lo), _mm_and_si128(odd, hi));
+        v3 = _mm_or_si128(_mm_andnot_si128(odd, hi), _mm_and_si128(odd, lo));
+        color = colors ? _mm_loadu_ps(&colors[i].x) : white;
+
+        out = (__m128i *)(verts + i * RENDER_VERTS_PER_SPRITE);
+        _mm_storeu_si128(out + 0, lo);
+        _mm_storeu_ps((float *)(out + 1), color);
+        _mm_storeu_si128(out + 2, v1);
+        _mm_storeu_ps((float *)(out + 3), color);
+        _mm_storeu_si128(out + 4, hi);
+        _mm_storeu_ps((float *)(out + 5), color);
+        _mm_storeu_si128(out + 6, v3);
+        _mm_storeu_ps((float *)(out + 7), color);
+    }
+}
+
+/* Same as the SSE2 kernel, but for two sprites at a time, one in each 128-bit lane */
+static TARGET("avx2") void put_many_avx2(struct sprite_vertex *verts, int count,
+                                         const struct vec2i *positions,
+                                         const struct rect2i *src_rects, const struct vec4f *colors)
+{
+    const __m256i white = _mm256_castps_si256(_mm256_set1_ps(1.0f));
+    __m256i rect, pos, b, size, lo, hi, v1, v3, color;
+    __m256i *out;
+    int i;
+
+    for (i = 0; i + 2 <= count; i += 2) {
+        rect = _mm256_loadu_si256((const __m256i *)&src_rects[i]);
+        pos = _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)&positions[i]));
+        pos = _mm256_permute4x64_epi64(pos, 0x50); /* p0 p0 | p1 p1 */
+        b = _mm256_unpackhi_epi64(rect, rect);
+        size = _mm256_sub_epi32(b, rect);
+        lo = _mm256_unpacklo_epi64(pos, rect);
+        hi = _mm256_unpacklo_epi64(_mm256_add_epi32(pos, size), b);
+        v1 = _mm256_blend_epi32(lo, hi, 0xAA);
+        v3 = _mm256_blend_epi32(hi, lo, 0xAA);
+        color = colors ? _mm256_loadu_si256((const __m256i *)&colors[i]) : white;
+
+        /* Pair each sprite's half of the vertex with its color */
+        out = (__m256i *)(verts + i * RENDER_VERTS_PER_SPRITE);
+        _mm256_storeu_si256(out + 0, _mm256_permute2x128_si256(lo, color, 0x20));
+        _mm256_storeu_si256(out + 1, _mm256_permute2x128_si256(v1, color, 0x20));
+        _mm256_storeu_si256(out + 2, _mm256_permute2x128_si256(hi, color, 0x20));
+        _mm256_storeu_si256(out + 3, _mm256_permute2x128_si256(v3, color, 0x20));
+        _mm256_storeu_si256(out + 4, _mm256_permute2x128_si256(lo, color, 0x31));
+        _mm256_storeu_si256(out + 5, _mm256_permute2x128_si256(v1, color, 0x31));
+        _mm256_storeu_si256(out + 6, _mm256_permute2x128_si256(hi, color, 0x31));
+        _mm256_storeu_si256(out + 7, _mm256_permute2x128_si256(v3, color, 0x31));
+    }
+    if (i < count) {
+        put_many_sse2(verts + i * RENDER_VERTS_PER_SPRITE, count - i, positions + i, src_rects + i,
+                      colors ? colors + i : NULL);
+    }
+}
+#endif /* CPU_X86 */
+
+void sprite_batch_put_many(struct sprite_batch *batch, int index, int count,
+                           const struct vec2i *positions, const struct rect2i *src_rects,
+                           const struct vec4f *colors)
+{
+    struct sprite_vertex *verts;
+
+    DASSERT(batch && positions && src_rects && index >= 0 && count >= 0);
+    DASSERT(count <= (batch->filling ? batch->capacity : batch->num_sprites) - index);
+    if (!count) {
+        return;
+    }
+    verts = batch->verts + index * RENDER_VERTS_PER_SPRITE;
+    if (!batch->filling) {
+        batch->dirty = true;
+    }
+
+#ifdef CPU_X86
+    if (cpu_has(CPU_FEATURE_AVX2)) {
+        put_many_avx2(verts, count, positions, src_rects, colors);
+        return;
+    }
+    if (cpu_has(CPU_FEATURE_SSE2)) {
+        put_many_sse2(verts, count, positions, src_rects, colors);
+        return;
+    }
+#endif
+    put_many_scalar(verts, count, positions, src_rects, colors);
+}
+
+void sprite_batch_begin_fill(struct sprite_batch *batch, int max_sprites)
+{
+    DASSERT(batch != NULL);
+    ASSERT(batch != gl_state.sprite_batch);
+    ASSERT(!batch->filling);
+    reserve(batch, max_sprites);
+    atomic_store_explicit(&batch->num_claimed, 0, memory_order_relaxed);
+    batch->filling = true;
+    batch->dirty = true;
+}
+
+int sprite_batch_claim(struct sprite_batch *batch, int num_sprites)
+{
+    int first;
+
+    DASSERT(batch && batch->filling && num_sprites >= 0);
+    first = atomic_fetch_add_explicit(&batch->num_claimed, num_sprites, memory_order_relaxed);
+    ASSERT(first <= batch->capacity - num_sprites); /* Claimed more than begin_fill made room for */
+    return first;
+}
+
+void sprite_batch_end_fill(struct sprite_batch *batch, int num_sprites)
+{
+    DASSERT(batch && batch->filling);
+
+    /* The threads which filled the batch must have been joined, which orders their writes before this. */
+    if (num_sprites == SPRITE_BATCH_NUM_CLAIMED) {
+        num_sprites = atomic_load_explicit(&batch->num_claimed, memory_order_relaxed);
+    }
+    ASSERT(num_sprites >= 0 && num_sprites <= batch->capacity);
+    batch->filling = false;
+    batch->num_sprites = num_sprites;
+    batch->num_verts = batch->num_sprites * RENDER_VERTS_PER_SPRITE;
+}
@@ -30,4 +30,32 @@ int sprite_batch_append(struct sprite_batch *batch, int num_sprites);
 void sprite_batch_put(struct sprite_batch *batch, int index, struct rect2i src_rect,
                       struct vec2i pos, struct vec4f color);
 
+/*
+ * Puts count sprites starting at index, taking each one's position, source
+ * rectangle and color from the arrays. colors may be NULL for opaque white.
+ * Uses SSE2 or AVX2 if the CPU has them.
+ */
+void sprite_batch_put_many(struct sprite_batch *batch, int index, int count,
+                           const struct vec2i *positions, const struct rect2i *src_rects,
+                           const struct vec4f *colors);
+
+/*
+ * Fills a batch from several threads at once. sprite_batch_begin_fill makes
+ * room for up to max_sprites. Then any thread may claim a range of sprites
+ * with one atomic increment and sprite_batch_put them, as long as no two
+ * threads put the same sprite. sprite_batch_end_fill(batch,
+ * SPRITE_BATCH_NUM_CLAIMED) then sets the batch's size to the number of
+ * sprites claimed.
+ *
+ * Ranges are claimed in whatever order the threads get there. If the draw
+ * order matters and the number of sprites each thread puts is known up front,
+ * put sprites at precomputed indices instead of claiming, and pass the total
+ * to sprite_batch_end_fill.
+ */
+#define SPRITE_BATCH_NUM_CLAIMED (-1)
+void sprite_batch_begin_fill(struct sprite_batch *batch, int max_sprites);
+/* Returns the index of the first claimed sprite. */
+int sprite_batch_claim(struct sprite_batch *batch, int num_sprites);
+void sprite_batch_end_fill(struct sprite_batch *batch, int num_sprites);
+
 #endif /* INCLUDED_SPRITES_H */
@@ -84,5 +84,42 @@ void system_set_console_color(enum console_color color);
 
 void system_fini_paths(void);
 const char *system_get_default_assets_path(void);
+/*
+ * Gets the directory for per-user cache files, creating it if necessary.
+ * Returns null if there is no usable cache directory.
+ */
+const char *system_get_cache_dir(void);
+bool system_is_dir(const char *path);
+
+/*
+ * Renames a file, replacing the destination if it exists. This is atomic on
+ * the same file system, so readers see either the old file or the new one.
+ */
+bool system_replace_file(const char *from, const char *to, char **out_err);
+
+/* Gets the value of a monotonic clock in nanoseconds. */
+uint64_t system_get_time_ns(void);
+
+/*
+ * Sleeps for at least the given time. The actual time may be considerably
+ * longer depending on the scheduler's timer resolution.
+ */
+void system_sleep_ns(uint64_t ns);
+
+/* Gives up the rest of the calling thread's time slice. */
+void system_yield(void);
+
+/*
+ * Watches a directory tree for files that have been written or replaced.
+ * Paths passed to the callback are relative to the watched directory and use
+ * '/' as the separator. Each modified path is reported once per poll.
+ * system_watch_create returns null if the platform can't watch the directory.
+ */
+struct system_watch;
+typedef void(*system_watch_callback_t)(const char *path, void *data);
+
+struct system_watch *system_watch_create(const char *path, char **out_err);
+void system_watch_destroy(struct system_watch *watch);
+void system_watch_poll(struct system_watch *watch, system_watch_callback_t callback, void *data);
 
 #endif /* INCLUDED_SYSTEM_H */
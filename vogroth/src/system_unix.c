@@ -14,19 +14,35 @@
  * this program. If not, see <https://www.gnu.org/licenses/>.
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "config.h"
 
+#include <dirent.h>
 #include <errno.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+# include <sys/inotify.h>
+#endif
 
+#include "debug.h"
 #include "game_defs.h"
+#include "memory.h"
 #include "system.h"
 
 static pthread_mutex_t console_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+static char *cache_dir = NULL;
+static bool cache_dir_failed = false;
+
 void system_show_error_dialog(UNUSED const char *msg)
 {
 }
@@ -122,9 +138,292 @@ void system_set_console_color(enum console_color color)
 
 void system_fini_paths(void)
 {
+    cache_dir = mem_free(cache_dir);
+    cache_dir_failed = false;
 }
 
 const char *system_get_default_assets_path(void)
 {
     return DATADIR "/games/" GAME_ID "/" ASSETS_PACKAGE_NAME;
 }
+
+static bool make_dir(const char *path)
+{
+    if (!mkdir(path, 0755) || (errno == EEXIST && system_is_dir(path))) {
+        return true;
+    }
+    LOG_WARNING("%s: %s", path, strerror(errno));
+    return false;
+}
+
+const char *system_get_cache_dir(void)
+{
+    const char *base;
+    char *parent = NULL;
+
+    if (cache_dir || cache_dir_failed) {
+        return cache_dir;
+    }
+
+    /* Use $XDG_CACHE_HOME, or ~/.cache if it's not set. */
+    base = getenv("XDG_CACHE_HOME");
+    if (!base || base[0] != '/') {
+        base = getenv("HOME");
+        if (!base || !base[0]) {
+            cache_dir_failed = true;
+            return NULL;
+        }
+        parent = str_printf("%s/.cache", base);
+        if (!make_dir(parent)) {
+            mem_free(parent);
+            cache_dir_failed = true;
+            return NULL;
+        }
+        base = parent;
+    }
+
+    cache_dir = str_printf("%s/" GAME_ID, base);
+    mem_free(parent);
+    if (!make_dir(cache_dir)) {
+        cache_dir = mem_free(cache_dir);
+        cache_dir_failed = true;
+    }
+    return cache_dir;
+}
+
+uint64_t system_get_time_ns(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts)) {
+        FATAL("clock_gettime: %s", strerror(errno));
+    }
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+void system_sleep_ns(uint64_t ns)
+{
+    struct timespec ts = {(time_t)(ns / 1000000000u), (long)(ns % 1000000000u)};
+
+    /* Resume after signals until the full time has elapsed */
+    while (nanosleep(&ts, &ts) && errno == EINTR) {
+    }
+}
+
+void system_yield(void)
+{
+    sched_yield();
+}
+
+bool system_is_dir(const char *path)
+{
+    struct stat st;
+
+    return !stat(path, &st) && S_ISDIR(st.st_mode);
+}
+
+bool system_replace_file(const char *from, const char *to, char **out_err)
+{
+    if (rename(from, to)) {
+        str_put(out_err, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+/******************************************************************************/
+
+#ifdef __linux__
+
+struct watch_dir {
+    int wd;
+    char *rel_path; /* "" for the root directory */
+};
+
+struct system_watch {
+    int fd;
+    char *root;
+    int num_dirs;
+    struct watch_dir *dirs;
+};
+
+/*
+ * Adds an inotify watch for a directory and all of its subdirectories, since
+ * inotify watches aren't recursive.
+ */
+static void watch_add_tree(struct system_watch *watch, const char *rel_path)
+{
+    char *full_path;
+    char *child_rel;
+    char *child_full;
+    DIR *dir;
+    struct dirent *ent;
+    int wd;
+    int i;
+
+    full_path = rel_path[0] ? str_printf("%s/%s", watch->root, rel_path) : str_clone(watch->root);
+    wd = inotify_add_watch(watch->fd, full_path,
+                           IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR);
+    if (wd < 0) {
+        LOG_WARNING("%s: inotify_add_watch: %s", full_path, strerror(errno));
+        mem_free(full_path);
+        return;
+    }
+
+    /* The same directory may be reported twice if it's created while we're scanning. */
+    for (i = 0; i < watch->num_dirs; ++i) {
+        if (watch->dirs[i].wd == wd) {
+            mem_free(full_path);
+            return;
+        }
+    }
+    watch->dirs = mem_realloc_array(watch->dirs, (size_t)watch->num_dirs + 1, sizeof(*watch->dirs));
+    watch->dirs[watch->num_dirs++] = (struct watch_dir) {
+        .wd = wd,
+        .rel_path = str_clone(rel_path),
+    };
+
+    dir = opendir(full_path);
+    if (!dir) {
+        mem_free(full_path);
+        return;
+    }
+    while ((ent = readdir(dir))) {
+        if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, "..")) {
+            continue;
+        }
+        child_full = str_printf("%s/%s", full_path, ent->d_name);
+        if (system_is_dir(child_full)) {
+            child_rel = rel_path[0] ? str_printf("%s/%s", rel_path, ent->d_name) : str_clone(ent->d_name);
+            watch_add_tree(watch, child_rel);
+            mem_free(child_rel);
+        }
+        mem_free(child_full);
+    }
+    closedir(dir);
+    mem_free(full_path);
+}
+
+struct system_watch *system_watch_create(const char *path, char **out_err)
+{
+    struct system_watch *watch;
+    int fd;
+
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+        str_putf(out_err, "inotify_init1: %s", strerror(errno));
+        return NULL;
+    }
+
+    watch = mem_alloc(sizeof(*watch));
+    *watch = (struct system_watch) {
+        .fd = fd,
+        .root = str_clone(path),
+    };
+    watch_add_tree(watch, "");
+    return watch;
+}
+
+void system_watch_destroy(struct system_watch *watch)
+{
+    int i;
+
+    if (!watch) {
+        return;
+    }
+    close(watch->fd);
+    for (i = 0; i < watch->num_dirs; ++i) {
+        mem_free(watch->dirs[i].rel_path);
+    }
+    mem_free(watch->dirs);
+    mem_free(watch->root);
+    mem_free(watch);
+}
+
+void system_watch_poll(struct system_watch *watch, system_watch_callback_t callback, void *data)
+{
+    _Alignas(struct inotify_event) char events[4096];
+    const struct inotify_event *event;
+    char **changed = NULL;
+    int num_changed = 0;
+    const char *dir_path;
+    char *path;
+    ssize_t len;
+    ssize_t pos;
+    int i;
+
+    DASSERT(watch && callback);
+
+    /* Gather all pending events first so that each path is only reported once. */
+    while ((len = read(watch->fd, events, sizeof(events))) > 0) {
+        for (pos = 0; pos < len; pos += (ssize_t)sizeof(*event) + event->len) {
+            event = (const struct inotify_event *)(events + pos);
+            if (!event->len) {
+                continue;
+            }
+
+            dir_path = NULL;
+            for (i = 0; i < watch->num_dirs; ++i) {
+                if (watch->dirs[i].wd == event->wd) {
+                    dir_path = watch->dirs[i].rel_path;
+                    break;
+                }
+            }
+            if (!dir_path) {
+                continue;
+            }
+            path = dir_path[0] ? str_printf("%s/%s", dir_path, event->name) : str_clone(event->name);
+
+            if (event->mask & IN_ISDIR) {
+                if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    watch_add_tree(watch, path);
+                }
+                mem_free(path);
+                continue;
+            } else if (!(event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))) {
+                mem_free(path);
+                continue;
+            }
+
+            for (i = 0; i < num_changed; ++i) {
+                if (!strcmp(changed[i], path)) {
+                    break;
+                }
+            }
+            if (i < num_changed) {
+                mem_free(path);
+            } else {
+                changed = mem_realloc_array(changed, (size_t)num_changed + 1, sizeof(*changed));
+                changed[num_changed++] = path;
+            }
+        }
+    }
+    if (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        LOG_ERROR("inotify read: %s", strerror(errno));
+    }
+
+    for (i = 0; i < num_changed; ++i) {
+        callback(changed[i], data);
+        mem_free(changed[i]);
+    }
+    mem_free(changed);
+}
+
+#else /* !defined(__linux__) */
+
+struct system_watch *system_watch_create(UNUSED const char *path, char **out_err)
+{
+    str_put(out_err, "Watching directories is not supported on this platform");
+    return NULL;
+}
+
+void system_watch_destroy(UNUSED struct system_watch *watch)
+{
+}
+
+void system_watch_poll(UNUSED struct system_watch *watch, UNUSED system_watch_callback_t callback,
+                       UNUSED void *data)
+{
+}
+
+#endif /* !defined(__linux__) */
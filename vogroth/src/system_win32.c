@@ -17,7 +17,9 @@
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <windows.h>
+#include <mmsystem.h>
 
 #include "debug.h"
 #include "game_defs.h"
@@ -30,6 +32,16 @@ static HANDLE hConsoleMutex = NULL;
 
 static char *exe_dir = NULL;
 static char *default_assets_path = NULL;
+static char *cache_dir = NULL;
+static bool cache_dir_failed = false;
+
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+# define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+/* Per-thread timer for system_sleep_ns, which the OS closes when we exit */
+static THREAD_LOCAL HANDLE sleep_timer = NULL;
+static THREAD_LOCAL bool sleep_timer_failed = false;
 
 static char *win32_strerror_alloc(uint32_t errcode)
 {
@@ -197,6 +209,8 @@ void system_fini_paths(void)
 {
     exe_dir = mem_free(exe_dir);
     default_assets_path = mem_free(default_assets_path);
+    cache_dir = mem_free(cache_dir);
+    cache_dir_failed = false;
 }
 
 const char *system_get_default_assets_path(void)
@@ -206,3 +220,252 @@ const char *system_get_default_assets_path(void)
     }
     return default_assets_path;
 }
+
+const char *system_get_cache_dir(void)
+{
+    const wchar_t *wbase;
+    wchar_t *wpath;
+    char *base;
+    DWORD errcode;
+
+    if (cache_dir || cache_dir_failed) {
+        return cache_dir;
+    }
+
+    wbase = _wgetenv(L"LOCALAPPDATA");
+    if (!wbase || !wbase[0]) {
+        cache_dir_failed = true;
+        return NULL;
+    }
+    base = wide_to_utf8(-1, wbase, NULL);
+    cache_dir = str_printf("%s\\" GAME_ID, base);
+    mem_free(base);
+
+    wpath = utf8_to_wide(-1, cache_dir, NULL);
+    if (!CreateDirectoryW(wpath, NULL) && (errcode = GetLastError()) != ERROR_ALREADY_EXISTS) {
+        base = win32_strerror_alloc(errcode);
+        LOG_WARNING("%s: %s", cache_dir, base);
+        mem_free(base);
+        cache_dir = mem_free(cache_dir);
+        cache_dir_failed = true;
+    }
+    mem_free(wpath);
+    return cache_dir;
+}
+
+uint64_t system_get_time_ns(void)
+{
+    static LARGE_INTEGER freq = {0};
+    LARGE_INTEGER count;
+
+    if (!freq.QuadPart) {
+        QueryPerformanceFrequency(&freq);
+    }
+    QueryPerformanceCounter(&count);
+    return (uint64_t)(count.QuadPart / freq.QuadPart) * 1000000000u
+           + (uint64_t)(count.QuadPart % freq.QuadPart) * 1000000000u / (uint64_t)freq.QuadPart;
+}
+
+/*
+ * Sleep() wakes up on the system timer tick, which is 15.6 ms by default, so
+ * frame pacing would have to spin for most of each frame. High resolution
+ * waitable timers (Windows 10 1803 and later) wake up within about 0.5 ms
+ * without changing the tick for the whole system. On older versions, the
+ * tick is raised to 1 ms for the duration of the sleep instead.
+ */
+void system_sleep_ns(uint64_t ns)
+{
+    LARGE_INTEGER due;
+    uint64_t ms;
+
+    if (!sleep_timer && !sleep_timer_failed) {
+        sleep_timer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION,
+                                             TIMER_ALL_ACCESS);
+        sleep_timer_failed = !sleep_timer;
+    }
+    if (sleep_timer) {
+        /* Negative due times are relative, in 100 ns units */
+        due.QuadPart = -(LONGLONG)(ns / 100u + 1u);
+        if (SetWaitableTimer(sleep_timer, &due, 0, NULL, NULL, FALSE)
+            && WaitForSingleObject(sleep_timer, INFINITE) == WAIT_OBJECT_0)
+        {
+            return;
+        }
+    }
+
+    /* Sleep has millisecond granularity at best, so round up */
+    ms = (ns + 999999u) / 1000000u;
+    timeBeginPeriod(1);
+    Sleep(ms > INFINITE - 1 ? INFINITE - 1 : (DWORD)ms);
+    timeEndPeriod(1);
+}
+
+void system_yield(void)
+{
+    SwitchToThread();
+}
+
+bool system_is_dir(const char *path)
+{
+    wchar_t *wpath;
+    DWORD attrs;
+
+    wpath = utf8_to_wide(-1, path, NULL);
+    attrs = GetFileAttributesW(wpath);
+    mem_free(wpath);
+    return attrs != INVALID_FILE_ATTRIBUTES && (attrs & FILE_ATTRIBUTE_DIRECTORY);
+}
+
+bool system_replace_file(const char *from, const char *to, char **out_err)
+{
+    wchar_t *wfrom, *wto;
+    char *err;
+    BOOL ok;
+
+    wfrom = utf8_to_wide(-1, from, NULL);
+    wto = utf8_to_wide(-1, to, NULL);
+    ok = MoveFileExW(wfrom, wto, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+    mem_free(wfrom);
+    mem_free(wto);
+    if (!ok) {
+        err = win32_strerror_alloc(GetLastError());
+        str_put(out_err, err);
+        mem_free(err);
+        return false;
+    }
+    return true;
+}
+
+/******************************************************************************/
+
+struct system_watch {
+    char *root;
+    HANDLE hDir;
+    OVERLAPPED overlapped;
+    DWORD buf[4096];
+};
+
+/*
+ * Queues an asynchronous ReadDirectoryChangesW request. Results are collected
+ * in system_watch_poll.
+ */
+static bool watch_queue_read(struct system_watch *watch)
+{
+    ResetEvent(watch->overlapped.hEvent);
+    return ReadDirectoryChangesW(watch->hDir, watch->buf, sizeof(watch->buf), TRUE,
+                                 FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE,
+                                 NULL, &watch->overlapped, NULL);
+}
+
+struct system_watch *system_watch_create(const char *path, char **out_err)
+{
+    struct system_watch *watch;
+    wchar_t *wpath;
+    char *err;
+
+    watch = mem_alloc(sizeof(*watch));
+    ZeroMemory(watch, sizeof(*watch));
+    watch->root = str_clone(path);
+
+    wpath = utf8_to_wide(-1, path, NULL);
+    watch->hDir = CreateFileW(wpath, FILE_LIST_DIRECTORY,
+                              FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+                              OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+    mem_free(wpath);
+    if (watch->hDir == INVALID_HANDLE_VALUE) {
+        err = win32_strerror_alloc(GetLastError());
+        str_putf(out_err, "CreateFileW: %s", err);
+        mem_free(err);
+        mem_free(watch->root);
+        mem_free(watch);
+        return NULL;
+    }
+
+    watch->overlapped.hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+    if (!watch->overlapped.hEvent || !watch_queue_read(watch)) {
+        err = win32_strerror_alloc(GetLastError());
+        str_putf(out_err, "ReadDirectoryChangesW: %s", err);
+        mem_free(err);
+        system_watch_destroy(watch);
+        return NULL;
+    }
+
+    return watch;
+}
+
+void system_watch_destroy(struct system_watch *watch)
+{
+    if (!watch) {
+        return;
+    }
+    if (watch->hDir != INVALID_HANDLE_VALUE) {
+        CancelIo(watch->hDir);
+        CloseHandle(watch->hDir);
+    }
+    if (watch->overlapped.hEvent) {
+        CloseHandle(watch->overlapped.hEvent);
+    }
+    mem_free(watch->root);
+    mem_free(watch);
+}
+
+void system_watch_poll(struct system_watch *watch, system_watch_callback_t callback, void *data)
+{
+    const FILE_NOTIFY_INFORMATION *info;
+    const char *pos;
+    char **changed = NULL;
+    int num_changed = 0;
+    DWORD len;
+    char *path;
+    char *full_path;
+    char *p;
+    bool is_dir;
+    int i;
+
+    DASSERT(watch && callback);
+
+    while (GetOverlappedResult(watch->hDir, &watch->overlapped, &len, FALSE)) {
+        pos = (const char *)watch->buf;
+        while (len) {
+            info = (const FILE_NOTIFY_INFORMATION *)pos;
+            if (info->Action == FILE_ACTION_ADDED || info->Action == FILE_ACTION_MODIFIED
+                || info->Action == FILE_ACTION_RENAMED_NEW_NAME)
+            {
+                path = wide_to_utf8((int)(info->FileNameLength / sizeof(wchar_t)), info->FileName, NULL);
+                for (p = path; *p; ++p) {
+                    if (*p == '\\') {
+                        *p = '/';
+                    }
+                }
+                for (i = 0; i < num_changed; ++i) {
+                    if (!strcmp(changed[i], path)) {
+                        break;
+                    }
+                }
+                full_path = str_printf("%s/%s", watch->root, path);
+                is_dir = system_is_dir(full_path);
+                mem_free(full_path);
+                if (i < num_changed || is_dir) {
+                    mem_free(path);
+                } else {
+                    changed = mem_realloc_array(changed, (size_t)num_changed + 1, sizeof(*changed));
+                    changed[num_changed++] = path;
+                }
+            }
+            if (!info->NextEntryOffset) {
+                break;
+            }
+            pos += info->NextEntryOffset;
+        }
+        if (!watch_queue_read(watch)) {
+            LOG_ERROR("ReadDirectoryChangesW failed");
+            break;
+        }
+    }
+
+    for (i = 0; i < num_changed; ++i) {
+        callback(changed[i], data);
+        mem_free(changed[i]);
+    }
+    mem_free(changed);
+}
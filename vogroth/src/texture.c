@@ -14,20 +14,49 @@
  * this program. If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <stdatomic.h>
+#include <string.h>
+
 #include "debug.h"
+#include "dxt.h"
 #include "gl_api.h"
 #include "gl_state.h"
+#include "math.h"
 #include "memory.h"
 #include "pixbuf.h"
+#include "render.h"
 #include "texture.h"
 
+/*
+ * Streaming uploads are written into a ring of pixel buffer objects. Each one
+ * is filled while mapped, then unmapped and copied into its textures by
+ * texture_flush_streams, and fenced so that it's only mapped again once the GL
+ * has finished copying out of it. Buffers which fill up between flushes are
+ * left mapped until then, because other threads may still be writing them.
+ */
+#define NUM_STREAM_BUFFERS 3
+#define STREAM_BUFFER_SIZE (8 << 20)
+#define MAX_STREAMS_PER_BUFFER 256
+#define STREAM_ALIGN 64 /* Keeps each upload's rows on their own cache lines */
+
+/* Compressed textures are decompressed into RGBA textures if the GL can't use them. */
+static bool use_compressed_storage(enum pixel_format format)
+{
+    return dxt_is_format(format) && gl_caps.texture_compression_s3tc;
+}
+
 static GLenum get_gl_pixel_format(enum pixel_format format)
 {
     switch (format) {
+    case PIXEL_FORMAT_DXT1:
+    case PIXEL_FORMAT_DXT5:
+        return GL_RGBA;
     case PIXEL_FORMAT_RGB_888:
         return GL_RGB;
     case PIXEL_FORMAT_RGBA_8888:
         return GL_RGBA;
+    case PIXEL_FORMAT_BGRA_8888:
+        return GL_BGRA; /* only valid as the format of client pixels, see get_gl_internal_format */
     case PIXEL_FORMAT_ALPHA_8:
         return GL_ALPHA; /* deprecated in OpenGL 3.0 */
     case PIXEL_FORMAT_LUMINANCE_8:
@@ -39,74 +68,966 @@ static GLenum get_gl_pixel_format(enum pixel_format format)
     }
 }
 
+static GLint get_gl_internal_format(enum pixel_format format)
+{
+    if (format == PIXEL_FORMAT_BGRA_8888) {
+        return GL_RGBA;
+    }
+    return (GLint)get_gl_pixel_format(format);
+}
+
 static GLenum get_gl_pixel_type(UNUSED enum pixel_format format)
 {
     return GL_UNSIGNED_BYTE;
 }
 
-struct texture *texture_create(struct vec2i size, enum pixel_format format)
+static GLenum get_gl_target(const struct texture *texture)
 {
-    struct texture *texture;
-    GLenum gl_pixel_format = get_gl_pixel_format(format);
-    GLenum gl_pixel_type = get_gl_pixel_type(format);
+    return texture->num_layers ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
+}
+
+/* Arrays have a full chain of mipmaps, down to 1x1, since their layers can't bleed into each other. */
+static int get_num_levels(const struct texture *texture)
+{
+    int size = max_int(texture->size.x, texture->size.y);
+    int num_levels = 1;
+
+    if (texture->num_layers) {
+        for (; size > 1; size >>= 1) {
+            ++num_levels;
+        }
+    }
+    return num_levels;
+}
+
+static struct vec2i get_level_size(struct vec2i size, int level)
+{
+    return (struct vec2i) {max_int(size.x >> level, 1), max_int(size.y >> level, 1)};
+}
+
+/* The GL parts of the functions below run on the render thread, if there is one. */
+static void init_gl_texture(void *data)
+{
+    struct texture *texture = data;
+    GLenum gl_pixel_format = get_gl_pixel_format(texture->format);
+    GLenum gl_pixel_type = get_gl_pixel_type(texture->format);
+    GLenum target = get_gl_target(texture);
+    int num_levels = get_num_levels(texture);
+    struct vec2i size;
     GLenum errcode;
+    int level;
 
     gl_flush_errors();
 
-    texture = mem_alloc(sizeof(*texture));
-    *texture = (struct texture){0};
-
     pglGenTextures(1, &texture->id);
     if (!texture->id) {
         FATAL("glGenTextures: %s", gl_strerror(pglGetError()));
     }
     pglActiveTexture(GL_TEXTURE0 + RENDER_GL_TEXTURE_UNIT_MANAGER);
-    pglBindTexture(GL_TEXTURE_2D, texture->id);
-    pglTexImage2D(GL_TEXTURE_2D, 0, (GLint)gl_pixel_format, size.x, size.y, 0,
-                  gl_pixel_format, gl_pixel_type, NULL);
-    pglTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    pglTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    pglBindTexture(target, texture->id);
+    if (texture->num_layers) {
+        for (level = 0; level < num_levels; ++level) {
+            size = get_level_size(texture->size, level);
+            pglTexImage3D(target, level, get_gl_internal_format(texture->format), size.x, size.y,
+                          texture->num_layers, 0, gl_pixel_format, gl_pixel_type, NULL);
+        }
+    } else if (use_compressed_storage(texture->format)) {
+        pglCompressedTexImage2D(GL_TEXTURE_2D, 0, (GLenum)texture->format, texture->size.x, texture->size.y, 0,
+                                (GLsizei)dxt_get_image_size(texture->format, texture->size), NULL);
+    } else {
+        pglTexImage2D(GL_TEXTURE_2D, 0, get_gl_internal_format(texture->format), texture->size.x, texture->size.y, 0,
+                      gl_pixel_format, gl_pixel_type, NULL);
+    }
+    pglTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    pglTexParameteri(target, GL_TEXTURE_MIN_FILTER, num_levels > 1 ? GL_NEAREST_MIPMAP_NEAREST : GL_NEAREST);
+    pglTexParameteri(target, GL_TEXTURE_MAX_LEVEL, num_levels - 1);
 
     if ((errcode = pglGetError()) != GL_NO_ERROR) {
         FATAL("Initializing texture failed: %s", gl_strerror(errcode));
     }
-
-    texture->size = size;
-    texture->format = format;
-    return texture;
 }
 
-void texture_destroy(struct texture *texture)
+static void fini_gl_texture(void *data)
 {
-    DASSERT(texture != NULL);
+    struct texture *texture = data;
+
     if (texture->id && pglDeleteTextures) {
         pglDeleteTextures(1, &texture->id);
     }
-    mem_free(texture);
 
     /* Detach the texture from the renderer */
     if (gl_state.texture == texture) {
         gl_state.texture = NULL;
     }
+    if (gl_state.palette == texture) {
+        gl_state.palette = NULL;
+    }
 }
 
-void texture_upload(struct texture *texture, const struct pixbuf *src, struct vec2i offset)
+struct upload_params {
+    struct texture *texture;
+    const struct pixview *src;
+    struct vec2i offset;
+    int layer; /* Ignored unless the texture is an array */
+    int level;
+};
+
+/* The default GL_UNPACK_ALIGNMENT, which matches the ideal row pitch */
+#define DEFAULT_UNPACK_ALIGNMENT 4
+
+/*
+ * Finds the GL_UNPACK_ROW_LENGTH and GL_UNPACK_ALIGNMENT which make GL step
+ * through rows by the view's row pitch. GL can't step backwards, so this fails
+ * for bottom-up views, as well as for pitches which no alignment can produce.
+ */
+static bool get_unpack_params(const struct pixview *src, GLint *out_row_length, GLint *out_alignment)
+{
+    static const int alignments[] = {8, 4, 2, 1};
+    int bytes_per_pixel = pixbuf_get_bytes_per_pixel(src->format);
+    int row_length, padded;
+    unsigned i;
+
+    if (!gl_caps.unpack_row_length || src->row_pitch <= 0) {
+        return false;
+    }
+    row_length = src->row_pitch / bytes_per_pixel;
+    for (i = 0; i < LENGTHOF(alignments); ++i) {
+        padded = (row_length * bytes_per_pixel + alignments[i] - 1) / alignments[i] * alignments[i];
+        if (padded == src->row_pitch && (uintptr_t)src->origin % (uintptr_t)alignments[i] == 0) {
+            *out_row_length = row_length;
+            *out_alignment = alignments[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Copies the view's rows into buf with the ideal pitch, for views that GL can't read directly. */
+static void repack_rows(const struct pixview *src, uint8_t *buf)
+{
+    int ideal_pitch = pixbuf_get_ideal_row_pitch(src->format, src->size.x);
+    size_t row_size = (size_t)src->size.x * (size_t)pixbuf_get_bytes_per_pixel(src->format);
+    int y;
+
+    for (y = 0; y < src->size.y; ++y) {
+        memcpy(buf + (size_t)y * (size_t)ideal_pitch, pixview_get_row(src, y), row_size);
+    }
+}
+
+static void upload_gl_texture(void *data)
 {
+    const struct upload_params *params = data;
+    const struct pixview *src = params->src;
     GLenum gl_pixel_format = get_gl_pixel_format(src->format);
     GLenum gl_pixel_type = get_gl_pixel_type(src->format);
+    GLint row_length = 0, alignment = DEFAULT_UNPACK_ALIGNMENT;
+    const uint8_t *pixels = src->origin;
+    uint8_t *repacked = NULL;
     GLenum errcode;
 
-    DASSERT(texture && texture->id && src);
-    ASSERT(pixbuf_is_ideal(src));
+    if (!pixview_is_ideal(src) && !get_unpack_params(src, &row_length, &alignment)) {
+        repacked = mem_alloc_array((size_t)src->size.y,
+                                   (size_t)pixbuf_get_ideal_row_pitch(src->format, src->size.x));
+        repack_rows(src, repacked);
+        pixels = repacked;
+    }
 
     gl_flush_errors();
 
     pglActiveTexture(GL_TEXTURE0 + RENDER_GL_TEXTURE_UNIT_MANAGER);
-    pglBindTexture(GL_TEXTURE_2D, texture->id);
-    pglTexSubImage2D(GL_TEXTURE_2D, 0, offset.x, offset.y, src->size.x, src->size.y,
-                     gl_pixel_format, gl_pixel_type, src->buf);
+    pglBindTexture(get_gl_target(params->texture), params->texture->id);
+    if (row_length) {
+        pglPixelStorei(GL_UNPACK_ROW_LENGTH, row_length);
+    }
+    if (alignment != DEFAULT_UNPACK_ALIGNMENT) {
+        pglPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+    }
+    if (params->texture->num_layers) {
+        pglTexSubImage3D(GL_TEXTURE_2D_ARRAY, params->level, params->offset.x, params->offset.y, params->layer,
+                         src->size.x, src->size.y, 1, gl_pixel_format, gl_pixel_type, pixels);
+    } else {
+        pglTexSubImage2D(GL_TEXTURE_2D, 0, params->offset.x, params->offset.y, src->size.x, src->size.y,
+                         gl_pixel_format, gl_pixel_type, pixels);
+    }
+    if (row_length) {
+        pglPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    }
+    if (alignment != DEFAULT_UNPACK_ALIGNMENT) {
+        pglPixelStorei(GL_UNPACK_ALIGNMENT, DEFAULT_UNPACK_ALIGNMENT);
+    }
 
     if ((errcode = pglGetError()) != GL_NO_ERROR) {
         FATAL("Uploading texture failed: %s", gl_strerror(errcode));
     }
+    mem_free(repacked);
+}
+
+struct compressed_upload_params {
+    struct texture *texture;
+    const uint8_t *blocks;
+    size_t size;
+};
+
+static void upload_compressed_gl_texture(void *data)
+{
+    const struct compressed_upload_params *params = data;
+    const struct texture *texture = params->texture;
+    GLenum errcode;
+
+    gl_flush_errors();
+
+    pglActiveTexture(GL_TEXTURE0 + RENDER_GL_TEXTURE_UNIT_MANAGER);
+    pglBindTexture(GL_TEXTURE_2D, texture->id);
+    pglCompressedTexImage2D(GL_TEXTURE_2D, 0, (GLenum)texture->format, texture->size.x, texture->size.y, 0,
+                            (GLsizei)params->size, params->blocks);
+
+    if ((errcode = pglGetError()) != GL_NO_ERROR) {
+        FATAL("Uploading compressed texture failed: %s", gl_strerror(errcode));
+    }
+}
+
+/******************************************************************************/
+
+struct pending_stream {
+    struct texture *texture; /* NULL if it was destroyed before the copy was issued */
+    struct vec2i offset;
+    struct vec2i size;
+    enum pixel_format format;
+    uint64_t seq; /* Streams are copied in the order they were begun */
+    atomic_bool ended; /* Set by texture_stream_end, on whichever thread wrote the pixels */
+    size_t buffer_offset;
+    uint8_t *pixels; /* For uploads which didn't go through a stream buffer */
+    struct pending_stream *next; /* In direct_streams */
+};
+
+struct stream_buffer {
+    GLuint id;
+    GLsync fence; /* Pending copies out of the buffer, if gl_caps.sync */
+    uint8_t *mapped;
+    size_t used;
+    struct pending_stream streams[MAX_STREAMS_PER_BUFFER];
+    int num_streams;
+};
+
+/* The buffers and direct streams which a flush submits: those begun before end */
+struct stream_flush {
+    int num_buffers;
+    uint64_t end;
+};
+
+static struct stream_buffer stream_buffers[NUM_STREAM_BUFFERS];
+static int cur_stream_buffer = 0;
+static int first_unflushed_buffer = 0;
+
+/* Uploads which were too big for a stream buffer, or had none to go through, oldest first */
+static struct pending_stream *direct_streams = NULL;
+static struct pending_stream *last_direct_stream = NULL;
+
+static uint64_t next_stream_seq = 0;
+static uint64_t total_streams = 0;
+static uint64_t total_stream_bytes = 0;
+static uint64_t stream_stalls = 0; /* Times a buffer was still being copied from when it was needed */
+
+static bool use_stream_buffers(void)
+{
+    return gl_caps.pixel_buffer_object;
+}
+
+/* Waits for the GL to finish copying out of the buffer, then maps it. */
+static void map_stream_buffer(void *data)
+{
+    struct stream_buffer *buffer = data;
+    GLenum status;
+
+    if (!buffer->id) {
+        pglGenBuffers(1, &buffer->id);
+        pglBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer->id);
+        pglBufferData(GL_PIXEL_UNPACK_BUFFER, STREAM_BUFFER_SIZE, NULL, GL_STREAM_DRAW);
+    } else {
+        pglBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer->id);
+    }
+
+    if (buffer->fence) {
+        status = pglClientWaitSync(buffer->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        if (status == GL_TIMEOUT_EXPIRED) {
+            ++stream_stalls;
+            do {
+                status = pglClientWaitSync(buffer->fence, 0, 1000000000u);
+            } while (status == GL_TIMEOUT_EXPIRED);
+        }
+        if (status == GL_WAIT_FAILED) {
+            FATAL("glClientWaitSync: %s", gl_strerror(pglGetError()));
+        }
+        pglDeleteSync(buffer->fence);
+        buffer->fence = NULL;
+    }
+
+    if (gl_caps.sync && gl_caps.map_buffer_range) {
+        /* The fence already did the synchronizing */
+        buffer->mapped = pglMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, STREAM_BUFFER_SIZE,
+                                           GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT
+                                           | GL_MAP_UNSYNCHRONIZED_BIT);
+    } else {
+        /* Orphan the old storage, so the driver doesn't wait for copies out of it either */
+        pglBufferData(GL_PIXEL_UNPACK_BUFFER, STREAM_BUFFER_SIZE, NULL, GL_STREAM_DRAW);
+        buffer->mapped = pglMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+    }
+    if (!buffer->mapped) {
+        FATAL("Mapping a texture stream buffer failed: %s", gl_strerror(pglGetError()));
+    }
+    pglBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+static void copy_stream(const struct pending_stream *stream, const GLvoid *pixels)
+{
+    if (!stream->texture) {
+        return;
+    }
+    pglActiveTexture(GL_TEXTURE0 + RENDER_GL_TEXTURE_UNIT_MANAGER);
+    pglBindTexture(GL_TEXTURE_2D, stream->texture->id);
+    pglTexSubImage2D(GL_TEXTURE_2D, 0, stream->offset.x, stream->offset.y, stream->size.x, stream->size.y,
+                     get_gl_pixel_format(stream->format), get_gl_pixel_type(stream->format), pixels);
+}
+
+/*
+ * Unmaps the buffers being flushed, then issues the copies out of them and
+ * out of the direct streams in the order the streams were begun, without
+ * waiting for them.
+ */
+static void submit_streams(void *data)
+{
+    const struct stream_flush *flush = data;
+    const struct pending_stream *direct = direct_streams;
+    struct stream_buffer *buffer;
+    bool intact[NUM_STREAM_BUFFERS];
+    GLenum errcode;
+    int i, j;
+
+    gl_flush_errors();
+
+    for (i = 0; i < flush->num_buffers; ++i) {
+        buffer = &stream_buffers[(first_unflushed_buffer + i) % NUM_STREAM_BUFFERS];
+        pglBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer->id);
+        intact[i] = pglUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) != GL_FALSE;
+        if (!intact[i]) {
+            /* The contents were lost, e.g. to a display mode change, so they'll have to be streamed again */
+            LOG_ERROR("Texture stream buffer was corrupted; dropping %d uploads", buffer->num_streams);
+        }
+    }
+
+    for (i = 0; i < flush->num_buffers; ++i) {
+        buffer = &stream_buffers[(first_unflushed_buffer + i) % NUM_STREAM_BUFFERS];
+        pglBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer->id);
+        for (j = 0; j < buffer->num_streams; ++j) {
+            if (direct && direct->seq < buffer->streams[j].seq) {
+                pglBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+                for (; direct && direct->seq < buffer->streams[j].seq; direct = direct->next) {
+                    copy_stream(direct, direct->pixels);
+                }
+                pglBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer->id);
+            }
+            if (intact[i]) {
+                copy_stream(&buffer->streams[j], (const GLvoid *)(uintptr_t)buffer->streams[j].buffer_offset);
+            }
+        }
+        pglBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+    for (; direct && direct->seq < flush->end; direct = direct->next) {
+        copy_stream(direct, direct->pixels);
+    }
+
+    if (gl_caps.sync) {
+        for (i = 0; i < flush->num_buffers; ++i) {
+            buffer = &stream_buffers[(first_unflushed_buffer + i) % NUM_STREAM_BUFFERS];
+            buffer->fence = pglFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        }
+    }
+
+    if ((errcode = pglGetError()) != GL_NO_ERROR) {
+        FATAL("Streaming texture uploads failed: %s", gl_strerror(errcode));
+    }
+}
+
+static void fini_stream_buffers(UNUSED void *data)
+{
+    struct stream_buffer *buffer;
+    int i;
+
+    for (i = 0; i < NUM_STREAM_BUFFERS; ++i) {
+        buffer = &stream_buffers[i];
+        if (buffer->fence && pglDeleteSync) {
+            pglDeleteSync(buffer->fence);
+        }
+        if (buffer->id && pglDeleteBuffers) {
+            if (buffer->mapped) {
+                pglBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer->id);
+                pglUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+                pglBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            }
+            pglDeleteBuffers(1, &buffer->id);
+        }
+        buffer->fence = NULL;
+        buffer->id = 0;
+        buffer->mapped = NULL;
+        buffer->used = 0;
+        buffer->num_streams = 0;
+    }
+}
+
+/*
+ * Works out how far the streams can be flushed. That's up to the first stream
+ * which is still being written, but whole buffers have to be unmapped at once,
+ * so a buffer holding a stream which can't be flushed holds back every stream
+ * after its first as well. Those are carried over to the next flush.
+ */
+static void find_stream_flush(struct stream_flush *flush)
+{
+    const struct stream_buffer *buffer;
+    const struct pending_stream *stream;
+    int i, j;
+
+    flush->end = next_stream_seq;
+    for (stream = direct_streams; stream; stream = stream->next) {
+        if (!atomic_load_explicit(&stream->ended, memory_order_acquire)) {
+            flush->end = stream->seq;
+            break;
+        }
+    }
+    for (i = 0; i < NUM_STREAM_BUFFERS; ++i) {
+        buffer = &stream_buffers[(first_unflushed_buffer + i) % NUM_STREAM_BUFFERS];
+        if (!buffer->num_streams) {
+            break;
+        }
+        for (j = 0; j < buffer->num_streams; ++j) {
+            stream = &buffer->streams[j];
+            if (stream->seq >= flush->end || !atomic_load_explicit(&stream->ended, memory_order_acquire)) {
+                break;
+            }
+        }
+        if (j < buffer->num_streams) {
+            flush->end = buffer->streams[0].seq;
+            break;
+        }
+    }
+    flush->num_buffers = i;
+}
+
+/* Submits every stream which can be, and forgets about them. */
+static void flush_streams(void)
+{
+    struct stream_flush flush;
+    struct stream_buffer *buffer;
+    struct pending_stream *stream;
+    int i;
+
+    find_stream_flush(&flush);
+    if (!flush.num_buffers && (!direct_streams || direct_streams->seq >= flush.end)) {
+        return;
+    }
+    render_run(&submit_streams, &flush);
+
+    for (i = 0; i < flush.num_buffers; ++i) {
+        buffer = &stream_buffers[(first_unflushed_buffer + i) % NUM_STREAM_BUFFERS];
+        buffer->mapped = NULL;
+        buffer->used = 0;
+        buffer->num_streams = 0;
+    }
+    first_unflushed_buffer = (first_unflushed_buffer + flush.num_buffers) % NUM_STREAM_BUFFERS;
+    if (!stream_buffers[cur_stream_buffer].num_streams) {
+        /* The buffer being filled was flushed too, so start on the next one */
+        cur_stream_buffer = first_unflushed_buffer;
+    }
+
+    while (direct_streams && direct_streams->seq < flush.end) {
+        stream = direct_streams;
+        direct_streams = stream->next;
+        mem_free(stream->pixels);
+        mem_free(stream);
+    }
+    if (!direct_streams) {
+        last_direct_stream = NULL;
+    }
+}
+
+/*
+ * Finds room for an upload in the stream buffers, moving on to the next one
+ * if the current one is full, and mapping it if needed. Returns NULL if every
+ * buffer has filled up since the last flush.
+ */
+static struct stream_buffer *reserve_stream_buffer(size_t bytes, size_t *out_start)
+{
+    struct stream_buffer *buffer = &stream_buffers[cur_stream_buffer];
+    size_t start = (buffer->used + STREAM_ALIGN - 1) / STREAM_ALIGN * STREAM_ALIGN;
+    int next;
+
+    if (buffer->num_streams == MAX_STREAMS_PER_BUFFER || start + bytes > STREAM_BUFFER_SIZE) {
+        next = (cur_stream_buffer + 1) % NUM_STREAM_BUFFERS;
+        if (next == first_unflushed_buffer) {
+            return NULL;
+        }
+        cur_stream_buffer = next;
+        buffer = &stream_buffers[next];
+        start = 0;
+    }
+    if (!buffer->mapped) {
+        render_run(&map_stream_buffer, buffer);
+    }
+    *out_start = start;
+    return buffer;
+}
+
+/* Forgets any pending copies into a texture which is being destroyed. */
+static void cancel_streams(const struct texture *texture)
+{
+    struct pending_stream *stream;
+    int i, j;
+
+    for (i = 0; i < NUM_STREAM_BUFFERS; ++i) {
+        for (j = 0; j < stream_buffers[i].num_streams; ++j) {
+            if (stream_buffers[i].streams[j].texture == texture) {
+                stream_buffers[i].streams[j].texture = NULL;
+            }
+        }
+    }
+    for (stream = direct_streams; stream; stream = stream->next) {
+        if (stream->texture == texture) {
+            stream->texture = NULL;
+        }
+    }
+}
+
+/******************************************************************************/
+
+/* Every texture, from least to most recently used */
+static struct texture *lru_head = NULL;
+static struct texture *lru_tail = NULL;
+
+static size_t memory_budget = SIZE_MAX;
+static size_t resident_bytes = 0;
+static unsigned evict_frames = TEXTURE_DEFAULT_EVICT_FRAMES;
+static unsigned cur_frame = 0;
+static uint64_t total_evictions = 0;
+static uint64_t total_restores = 0;
+
+static void unlink_texture(struct texture *texture)
+{
+    if (texture->prev) {
+        texture->prev->next = texture->next;
+    } else {
+        lru_head = texture->next;
+    }
+    if (texture->next) {
+        texture->next->prev = texture->prev;
+    } else {
+        lru_tail = texture->prev;
+    }
+    texture->prev = texture->next = NULL;
+}
+
+static void append_texture(struct texture *texture)
+{
+    texture->prev = lru_tail;
+    texture->next = NULL;
+    if (lru_tail) {
+        lru_tail->next = texture;
+    } else {
+        lru_head = texture;
+    }
+    lru_tail = texture;
+}
+
+/*
+ * Recreates an evicted texture and has its owner upload the pixels again,
+ * unless the caller is about to overwrite all of them anyway.
+ */
+static void restore_texture(struct texture *texture, bool overwriting)
+{
+    DASSERT(!texture->id && texture->restore);
+    render_run(&init_gl_texture, texture);
+    resident_bytes += texture_get_memory_size(texture);
+    if (!overwriting) {
+        texture->restore(texture, texture->restore_data);
+        ++total_restores;
+    }
+}
+
+static void evict_texture(struct texture *texture)
+{
+    DASSERT(texture->id && texture->restore);
+    cancel_streams(texture);
+    render_run(&fini_gl_texture, texture);
+    texture->id = 0;
+    resident_bytes -= texture_get_memory_size(texture);
+    ++total_evictions;
+}
+
+/*
+ * Evicts the least recently used textures which can be restored and have
+ * gone unused for long enough, until the rest fit in the budget. Evicted
+ * textures stay in the list, but since they've gone unused the longest,
+ * they're all at the front.
+ */
+static void enforce_budget(void)
+{
+    struct texture *texture;
+
+    for (texture = lru_head; texture && resident_bytes > memory_budget; texture = texture->next) {
+        if (cur_frame - texture->last_used_frame < evict_frames) {
+            break;
+        }
+        if (texture->id && texture->restore) {
+            evict_texture(texture);
+        }
+    }
+}
+
+static struct texture *create_texture(struct vec2i size, int num_layers, enum pixel_format format)
+{
+    struct texture *texture;
+
+    texture = mem_alloc(sizeof(*texture));
+    *texture = (struct texture){0};
+    texture->size = size;
+    texture->format = format;
+    texture->num_layers = num_layers;
+    texture->last_used_frame = cur_frame;
+    render_run(&init_gl_texture, texture);
+    resident_bytes += texture_get_memory_size(texture);
+    append_texture(texture);
+    return texture;
+}
+
+/*
+ * Halves a view's size with a box filter, for the next mipmap level. Colors
+ * are weighted by alpha, so that transparent texels don't darken the edges
+ * of what's next to them. ALPHA_8 may hold palette indices, which can't be
+ * averaged, so it's point sampled instead.
+ */
+static void downsample(const struct pixview *src, struct pixbuf *out)
+{
+    int bytes_per_pixel = pixbuf_get_bytes_per_pixel(src->format);
+    bool has_alpha = src->format == PIXEL_FORMAT_RGBA_8888 || src->format == PIXEL_FORMAT_BGRA_8888
+                     || src->format == PIXEL_FORMAT_LUMINANCE_ALPHA_88;
+    int alpha_index = has_alpha ? bytes_per_pixel - 1 : -1;
+    const uint8_t *texels[4];
+    unsigned weights[4], total_weight, sum;
+    uint8_t *dst;
+    int x, y, i, c;
+
+    out->size = (struct vec2i) {max_int(src->size.x / 2, 1), max_int(src->size.y / 2, 1)};
+    out->format = src->format;
+    out->row_pitch = 0;
+    pixbuf_alloc(out);
+
+    for (y = 0; y < out->size.y; ++y) {
+        dst = pixbuf_get_row(out, y);
+        for (x = 0; x < out->size.x; ++x) {
+            /* An odd row or column at the end is left out, and a size of 1 is sampled twice */
+            texels[0] = pixview_get_row(src, 2 * y) + (size_t)(2 * x) * (size_t)bytes_per_pixel;
+            texels[1] = texels[0] + (2 * x + 1 < src->size.x ? bytes_per_pixel : 0);
+            texels[2] = pixview_get_row(src, min_int(2 * y + 1, src->size.y - 1))
+                        + (size_t)(2 * x) * (size_t)bytes_per_pixel;
+            texels[3] = texels[2] + (2 * x + 1 < src->size.x ? bytes_per_pixel : 0);
+
+            if (src->format == PIXEL_FORMAT_ALPHA_8) {
+                *dst++ = texels[0][0];
+                continue;
+            }
+            total_weight = 0;
+            for (i = 0; i < 4; ++i) {
+                weights[i] = alpha_index >= 0 ? texels[i][alpha_index] : 1;
+                total_weight += weights[i];
+            }
+            for (c = 0; c < bytes_per_pixel; ++c) {
+                sum = 0;
+                if (c == alpha_index || !total_weight) {
+                    for (i = 0; i < 4; ++i) {
+                        sum += texels[i][c];
+                    }
+                    dst[c] = (uint8_t)((sum + 2) / 4);
+                } else {
+                    for (i = 0; i < 4; ++i) {
+                        sum += texels[i][c] * weights[i];
+                    }
+                    dst[c] = (uint8_t)((sum + total_weight / 2) / total_weight);
+                }
+            }
+            dst += bytes_per_pixel;
+        }
+    }
+}
+
+static void upload_view(struct texture *texture, const struct pixview *src, struct vec2i offset, int layer,
+                        int level)
+{
+    struct upload_params params = {texture, src, offset, layer, level};
+    struct vec2i size = get_level_size(texture->size, level);
+
+    DASSERT(texture && src && src->origin);
+    ASSERT(!use_compressed_storage(texture->format));
+    ASSERT(offset.x >= 0 && offset.y >= 0);
+    ASSERT(src->size.x <= size.x - offset.x && src->size.y <= size.y - offset.y);
+    if (!texture->id) {
+        restore_texture(texture, texture->num_layers <= 1 && level == 0 && offset.x == 0 && offset.y == 0
+                                 && src->size.x == size.x && src->size.y == size.y);
+    }
+    render_run(&upload_gl_texture, &params);
+}
+
+/******************************************************************************/
+
+struct texture *texture_create(struct vec2i size, enum pixel_format format)
+{
+    return create_texture(size, 0, format);
+}
+
+struct texture *texture_create_array(struct vec2i size, int num_layers, enum pixel_format format)
+{
+    ASSERT(gl_caps.texture_array);
+    ASSERT(num_layers > 0 && num_layers <= gl_caps.max_texture_layers);
+    ASSERT(!dxt_is_format(format));
+    return create_texture(size, num_layers, format);
+}
+
+void texture_destroy(struct texture *texture)
+{
+    DASSERT(texture != NULL);
+    cancel_streams(texture);
+    if (texture->id) {
+        resident_bytes -= texture_get_memory_size(texture);
+        render_run(&fini_gl_texture, texture);
+    }
+    unlink_texture(texture);
+    mem_free(texture);
+}
+
+void texture_set_restore(struct texture *texture, void(*restore)(struct texture *texture, void *data), void *data)
+{
+    DASSERT(texture != NULL);
+    texture->restore = restore;
+    texture->restore_data = data;
+}
+
+void texture_touch(struct texture *texture)
+{
+    DASSERT(texture != NULL);
+    if (!texture->id) {
+        restore_texture(texture, false);
+    }
+    texture->last_used_frame = cur_frame;
+    if (texture != lru_tail) {
+        unlink_texture(texture);
+        append_texture(texture);
+    }
+}
+
+size_t texture_get_memory_size(const struct texture *texture)
+{
+    struct vec2i size;
+    size_t texels = 0;
+    int bytes_per_texel, level;
+
+    DASSERT(texture != NULL);
+    if (use_compressed_storage(texture->format)) {
+        return dxt_get_image_size(texture->format, texture->size);
+    } else if (dxt_is_format(texture->format)) {
+        return (size_t)texture->size.x * (size_t)texture->size.y * 4;
+    }
+    /* Drivers generally pad 24-bit texels to 32 bits */
+    bytes_per_texel = texture->format == PIXEL_FORMAT_RGB_888 ? 4 : pixbuf_get_bytes_per_pixel(texture->format);
+    for (level = 0; level < get_num_levels(texture); ++level) {
+        size = get_level_size(texture->size, level);
+        texels += (size_t)size.x * (size_t)size.y;
+    }
+    return texels * (size_t)max_int(texture->num_layers, 1) * (size_t)bytes_per_texel;
+}
+
+size_t texture_get_resident_bytes(void)
+{
+    return resident_bytes;
+}
+
+void texture_set_memory_budget(size_t bytes, unsigned min_idle_frames)
+{
+    memory_budget = bytes;
+    evict_frames = min_idle_frames;
+}
+
+void texture_begin_frame(void)
+{
+    texture_flush_streams();
+    ++cur_frame;
+    enforce_budget();
+}
+
+void texture_upload(struct texture *texture, const struct pixbuf *src, struct vec2i offset)
+{
+    struct pixview view;
+
+    DASSERT(src != NULL);
+    view = pixbuf_get_view(src);
+    texture_upload_view(texture, &view, offset);
+}
+
+void texture_upload_view(struct texture *texture, const struct pixview *src, struct vec2i offset)
+{
+    DASSERT(texture != NULL);
+    ASSERT(!texture->num_layers);
+    upload_view(texture, src, offset, 0, 0);
+}
+
+void texture_upload_layer(struct texture *texture, int layer, const struct pixview *src)
+{
+    struct pixbuf mipmaps[2]; /* The last two levels, since each is made from the one before */
+    struct pixview view;
+    int num_levels, level;
+
+    DASSERT(texture && src);
+    ASSERT(layer >= 0 && layer < texture->num_layers);
+    ASSERT(src->size.x == texture->size.x && src->size.y == texture->size.y);
+    upload_view(texture, src, (struct vec2i) {0, 0}, layer, 0);
+
+    num_levels = get_num_levels(texture);
+    mipmaps[0] = mipmaps[1] = PIXBUF_NULL;
+    view = *src;
+    for (level = 1; level < num_levels; ++level) {
+        downsample(&view, &mipmaps[level & 1]);
+        view = pixbuf_get_view(&mipmaps[level & 1]);
+        upload_view(texture, &view, (struct vec2i) {0, 0}, layer, level);
+    }
+    pixbuf_fini(&mipmaps[0]);
+    pixbuf_fini(&mipmaps[1]);
+}
+
+void texture_upload_compressed(struct texture *texture, const uint8_t *blocks, size_t size)
+{
+    struct compressed_upload_params params = {texture, blocks, size};
+    struct pixbuf decompressed = PIXBUF_INIT;
+    struct pixview view;
+
+    DASSERT(texture && blocks);
+    ASSERT(dxt_is_format(texture->format));
+    ASSERT(size == dxt_get_image_size(texture->format, texture->size));
+    if (use_compressed_storage(texture->format)) {
+        if (!texture->id) {
+            restore_texture(texture, true);
+        }
+        render_run(&upload_compressed_gl_texture, &params);
+    } else {
+        dxt_decompress(texture->format, texture->size, blocks, &decompressed);
+        view = pixbuf_get_view(&decompressed);
+        texture_upload_view(texture, &view, (struct vec2i) {0, 0});
+        pixbuf_fini(&decompressed);
+    }
+}
+
+void texture_stream_begin(struct texture_stream *stream, struct texture *texture,
+                          struct vec2i offset, struct vec2i size)
+{
+    struct stream_buffer *buffer = NULL;
+    struct pending_stream *pending;
+    size_t bytes, start = 0;
+
+    DASSERT(stream && texture);
+    ASSERT(offset.x >= 0 && offset.y >= 0 && size.x > 0 && size.y > 0);
+    ASSERT(!dxt_is_format(texture->format) && !texture->num_layers);
+    ASSERT(size.x <= texture->size.x - offset.x && size.y <= texture->size.y - offset.y);
+    if (!texture->id) {
+        restore_texture(texture, size.x == texture->size.x && size.y == texture->size.y);
+    }
+
+    stream->row_pitch = pixbuf_get_ideal_row_pitch(texture->format, size.x);
+    bytes = (size_t)stream->row_pitch * (size_t)size.y;
+    if (use_stream_buffers() && bytes <= STREAM_BUFFER_SIZE) {
+        buffer = reserve_stream_buffer(bytes, &start);
+    }
+
+    if (!buffer) {
+        pending = mem_alloc(sizeof(*pending));
+        pending->pixels = mem_alloc(bytes);
+        pending->buffer_offset = 0;
+        pending->next = NULL;
+        if (last_direct_stream) {
+            last_direct_stream->next = pending;
+        } else {
+            direct_streams = pending;
+        }
+        last_direct_stream = pending;
+        stream->pixels = pending->pixels;
+    } else {
+        pending = &buffer->streams[buffer->num_streams++];
+        pending->pixels = NULL;
+        pending->buffer_offset = start;
+        buffer->used = start + bytes;
+        stream->pixels = buffer->mapped + start;
+    }
+
+    pending->texture = texture;
+    pending->offset = offset;
+    pending->size = size;
+    pending->format = texture->format;
+    pending->seq = next_stream_seq++;
+    atomic_init(&pending->ended, false);
+    stream->pending = pending;
+    ++total_streams;
+    total_stream_bytes += bytes;
+}
+
+void texture_stream_end(struct texture_stream *stream)
+{
+    DASSERT(stream && stream->pixels && stream->pending);
+    stream->pixels = NULL;
+    atomic_store_explicit(&stream->pending->ended, true, memory_order_release);
+    stream->pending = NULL;
+}
+
+void texture_stream_view(struct texture *texture, const struct pixview *src, struct vec2i offset)
+{
+    struct texture_stream stream;
+    size_t row_size;
+    int band_rows, y, i;
+
+    DASSERT(texture && src && src->origin);
+    ASSERT(src->format == texture->format);
+
+    /* Split big images into bands of rows which fit in a stream buffer */
+    row_size = (size_t)src->size.x * (size_t)pixbuf_get_bytes_per_pixel(src->format);
+    band_rows = (int)(STREAM_BUFFER_SIZE / (size_t)pixbuf_get_ideal_row_pitch(src->format, src->size.x));
+    band_rows = band_rows > 0 ? min_int(band_rows, src->size.y) : src->size.y;
+
+    for (y = 0; y < src->size.y; y += band_rows) {
+        texture_stream_begin(&stream, texture, (struct vec2i) {offset.x, offset.y + y},
+                             (struct vec2i) {src->size.x, min_int(band_rows, src->size.y - y)});
+        for (i = 0; i < band_rows && y + i < src->size.y; ++i) {
+            memcpy(stream.pixels + (size_t)i * (size_t)stream.row_pitch, pixview_get_row(src, y + i), row_size);
+        }
+        texture_stream_end(&stream);
+    }
+}
+
+void texture_flush_streams(void)
+{
+    flush_streams();
+}
+
+void texture_fini(void)
+{
+    texture_flush_streams();
+    ASSERT(!direct_streams && !stream_buffers[first_unflushed_buffer].num_streams);
+    render_run(&fini_stream_buffers, NULL);
+    cur_stream_buffer = 0;
+    first_unflushed_buffer = 0;
+    next_stream_seq = 0;
+    if (total_streams) {
+        LOG_DEBUG("Streamed %" PRIu64 " texture uploads (%.1f MiB); waited for a stream buffer %" PRIu64 " times",
+                  total_streams, (double)total_stream_bytes / (1024.0 * 1024.0), stream_stalls);
+    }
+    if (total_evictions) {
+        LOG_DEBUG("Evicted %" PRIu64 " textures and restored %" PRIu64, total_evictions, total_restores);
+    }
+    total_streams = 0;
+    total_stream_bytes = 0;
+    stream_stalls = 0;
+    total_evictions = 0;
+    total_restores = 0;
 }
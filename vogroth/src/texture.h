@@ -20,9 +20,86 @@
 #include "pixbuf.h"
 
 struct texture;
+struct pending_stream;
+
+/*
+ * Streaming upload into part of a texture. The pixels are written in place,
+ * with the ideal row pitch for the texture's format.
+ */
+struct texture_stream {
+    uint8_t *pixels;
+    int row_pitch;
+    struct pending_stream *pending; /* Used by texture_stream_end */
+};
 
 struct texture *texture_create(struct vec2i size, enum pixel_format format);
+/*
+ * Creates a GL_TEXTURE_2D_ARRAY of num_layers images of the given size, which
+ * needs gl_caps.texture_array, and at most gl_caps.max_texture_layers layers.
+ * Arrays can't be compressed or streamed, and texture_upload_layer is the
+ * only way to upload them. Each layer has its own mipmaps, which are made
+ * from it when it's uploaded, so that minified tiles don't shimmer.
+ */
+struct texture *texture_create_array(struct vec2i size, int num_layers, enum pixel_format format);
 void texture_destroy(struct texture *texture);
 void texture_upload(struct texture *texture, const struct pixbuf *src, struct vec2i offset);
+/*
+ * Uploads any view, including part of a larger image or bottom-up rows, to
+ * the texture at offset. GL reads the rows in place when it can step through
+ * them by the view's pitch, so only bottom-up views are copied first.
+ */
+void texture_upload_view(struct texture *texture, const struct pixview *src, struct vec2i offset);
+/* Uploads a whole layer, which must be the texture's size, and generates its mipmaps. */
+void texture_upload_layer(struct texture *texture, int layer, const struct pixview *src);
+/*
+ * Uploads the whole of a texture created with a DXT format (see dxt.h). If the
+ * GL doesn't support S3TC, the texture is kept as RGBA instead, and the blocks
+ * are decompressed before uploading. Compressed textures can't be streamed.
+ */
+void texture_upload_compressed(struct texture *texture, const uint8_t *blocks, size_t size);
+
+/*
+ * Streaming uploads don't make the caller wait for the GL to copy the pixels.
+ * texture_stream_begin reserves space for them in a mapped pixel buffer
+ * object, where they may be written by any thread until texture_stream_end.
+ * texture_flush_streams then issues the copies into the textures, in the
+ * order the streams were begun. Streams which haven't ended yet, and any begun
+ * after them, are left for the next flush. The copies happen in the
+ * background, and are fenced so that the buffers are only reused once
+ * they're done. The other functions must be called on the main thread.
+ *
+ * Without pixel buffer objects, or if an upload doesn't fit in one, the
+ * pixels are kept in ordinary memory and copied when flushed instead.
+ */
+void texture_stream_begin(struct texture_stream *stream, struct texture *texture,
+                          struct vec2i offset, struct vec2i size);
+void texture_stream_end(struct texture_stream *stream);
+/* Streams a copy of a view, split into parts that fit in the stream buffers. */
+void texture_stream_view(struct texture *texture, const struct pixview *src, struct vec2i offset);
+void texture_flush_streams(void);
+
+/*
+ * Residency. Textures which have been given a restore function may be evicted
+ * from GPU memory when the resident textures are over budget, least recently
+ * used first, once they've gone unused for min_idle_frames. They're recreated
+ * and restore is called to upload their pixels again, e.g. from a copy or
+ * the assets, as soon as they're used or uploaded to. Uploads of the whole
+ * image replace the pixels without calling restore. Partial uploads to an
+ * evictable texture must be reflected in what restore uploads, or they'll be
+ * lost when it's evicted. The budget is unlimited by default.
+ */
+void texture_set_restore(struct texture *texture, void(*restore)(struct texture *texture, void *data), void *data);
+/* Marks the texture as used in this frame, restoring it if it was evicted. The renderer calls this. */
+void texture_touch(struct texture *texture);
+/* Estimates the GPU memory used by the texture, whether it's resident or not. */
+size_t texture_get_memory_size(const struct texture *texture);
+size_t texture_get_resident_bytes(void);
+void texture_set_memory_budget(size_t bytes, unsigned min_idle_frames);
+#define TEXTURE_DEFAULT_EVICT_FRAMES 120
+
+/* Flushes streams, then evicts textures if needed. Called before rendering each frame. */
+void texture_begin_frame(void);
+/* Flushes the remaining streams, deletes the stream buffers and logs stats. */
+void texture_fini(void);
 
 #endif /* INCLUDED_TEXTURE_H */
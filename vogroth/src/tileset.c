@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2021 Marty Mills <daggerbot@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "debug.h"
+#include "gl_api.h"
+#include "memory.h"
+#include "texture.h"
+#include "tileset.h"
+
+struct tileset {
+    struct vec2i tile_size;
+    int num_tiles;
+    enum pixel_format format;
+    struct texture *texture;
+    int columns; /* Of the grid, or 1 for an array, whose layers are stacked vertically */
+};
+
+/* Lays out the tiles in a grid which is about as wide as it is tall. */
+static int get_grid_columns(struct vec2i tile_size, int num_tiles)
+{
+    int columns = 1;
+
+    while (columns < num_tiles && (int64_t)columns * tile_size.x < (int64_t)(num_tiles / columns) * tile_size.y) {
+        ++columns;
+    }
+    return columns;
+}
+
+struct tileset *tileset_create(struct vec2i tile_size, int num_tiles, enum pixel_format format)
+{
+    struct tileset *tileset;
+    int rows;
+
+    ASSERT(tile_size.x > 0 && tile_size.y > 0 && num_tiles > 0);
+    tileset = mem_alloc(sizeof(*tileset));
+    tileset->tile_size = tile_size;
+    tileset->num_tiles = num_tiles;
+    tileset->format = format;
+
+    if (gl_caps.texture_array && num_tiles <= gl_caps.max_texture_layers) {
+        tileset->columns = 1;
+        tileset->texture = texture_create_array(tile_size, num_tiles, format);
+    } else {
+        tileset->columns = get_grid_columns(tile_size, num_tiles);
+        rows = (num_tiles + tileset->columns - 1) / tileset->columns;
+        ASSERT(tileset->columns <= INT_MAX / tile_size.x && rows <= INT_MAX / tile_size.y);
+        tileset->texture = texture_create((struct vec2i) {tileset->columns * tile_size.x, rows * tile_size.y},
+                                          format);
+    }
+    return tileset;
+}
+
+void tileset_destroy(struct tileset *tileset)
+{
+    if (tileset) {
+        texture_destroy(tileset->texture);
+        mem_free(tileset);
+    }
+}
+
+void tileset_upload(struct tileset *tileset, int tile, const struct pixview *src)
+{
+    struct rect2i rect;
+
+    DASSERT(tileset && src);
+    ASSERT(tile >= 0 && tile < tileset->num_tiles);
+    ASSERT(src->size.x == tileset->tile_size.x && src->size.y == tileset->tile_size.y);
+    ASSERT(src->format == tileset->format);
+    if (tileset->texture->num_layers) {
+        texture_upload_layer(tileset->texture, tile, src);
+    } else {
+        rect = tileset_get_rect(tileset, tile);
+        texture_upload_view(tileset->texture, src, rect.a);
+    }
+}
+
+struct texture *tileset_get_texture(const struct tileset *tileset)
+{
+    DASSERT(tileset != NULL);
+    return tileset->texture;
+}
+
+/* For arrays, this is the layer's place in the stack that the sprite shader unstacks. */
+struct rect2i tileset_get_rect(const struct tileset *tileset, int tile)
+{
+    struct vec2i a;
+
+    DASSERT(tileset && tile >= 0 && tile < tileset->num_tiles);
+    a.x = tile % tileset->columns * tileset->tile_size.x;
+    a.y = tile / tileset->columns * tileset->tile_size.y;
+    return (struct rect2i) {a, {a.x + tileset->tile_size.x, a.y + tileset->tile_size.y}};
+}
+
+bool tileset_is_array(const struct tileset *tileset)
+{
+    DASSERT(tileset != NULL);
+    return tileset->texture->num_layers != 0;
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2021 Marty Mills <daggerbot@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_TILESET_H
+#define INCLUDED_TILESET_H
+
+#include "pixbuf.h"
+
+/*
+ * Tiles of a uniform size, such as those compiled by tilesetcomp.py, in a
+ * single texture. If the GL supports texture arrays, each tile is a layer of
+ * an array, so filtering can't bleed between neighbouring tiles, and a
+ * tileset can hold as many tiles as the GL allows layers. Otherwise the tiles
+ * are laid out in a grid on a 2D texture.
+ *
+ * Either way, the sprites are put with tileset_get_rect as their source
+ * rectangle and drawn with tileset_get_texture in use.
+ */
+
+struct tileset;
+struct texture;
+
+struct tileset *tileset_create(struct vec2i tile_size, int num_tiles, enum pixel_format format);
+void tileset_destroy(struct tileset *tileset);
+
+/* Uploads a tile, which must be the tile size and the tileset's format. */
+void tileset_upload(struct tileset *tileset, int tile, const struct pixview *src);
+
+struct texture *tileset_get_texture(const struct tileset *tileset);
+struct rect2i tileset_get_rect(const struct tileset *tileset, int tile);
+bool tileset_is_array(const struct tileset *tileset);
+
+#endif /* INCLUDED_TILESET_H */
@@ -14,34 +14,55 @@
  * this program. If not, see <https://www.gnu.org/licenses/>.
  */
 
-#include <SDL_timer.h>
 #include <SDL_video.h>
 
 #include "debug.h"
 #include "game_defs.h"
 #include "gl_api.h"
+#include "pacing.h"
 #include "video.h"
 
 #define DEFAULT_WINDOW_WIDTH 640
 #define DEFAULT_WINDOW_HEIGHT 480
+#define DEFAULT_FPS_LIMIT 60 /* Used when vsync is unavailable */
 
 static SDL_Window *window = NULL;
 static SDL_GLContext gl_context = NULL;
 static bool vsync_enabled = false;
+static bool throttle = true;
+static int fps_limit = -1;
+static bool headless = false;
+static bool depth_buffer = false;
+static struct vec2i headless_size = {0, 0};
+static bool video_subsystem_initialized = false; /* By us rather than by SDL_CreateWindow */
 
 static void init_window(void)
 {
+    struct vec2i size = {DEFAULT_WINDOW_WIDTH, DEFAULT_WINDOW_HEIGHT};
+    Uint32 flags = SDL_WINDOW_ALLOW_HIGHDPI | SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE | SDL_WINDOW_SHOWN;
+
     if (window) {
         return;
     }
 
+    if (headless) {
+        /* Fall back to whatever driver SDL picks, such as X11 on Xvfb, if offscreen isn't available. */
+        if (!SDL_VideoInit("offscreen")) {
+            video_subsystem_initialized = true;
+        } else {
+            LOG_DEBUG("Can't use offscreen video driver: %s", SDL_GetError());
+        }
+        size = headless_size;
+        flags = SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN;
+    }
+
     SDL_GL_ResetAttributes();
     SDL_GL_SetAttribute(SDL_GL_BUFFER_SIZE, 32);
     SDL_GL_SetAttribute(SDL_GL_RED_SIZE, 8);
     SDL_GL_SetAttribute(SDL_GL_GREEN_SIZE, 8);
     SDL_GL_SetAttribute(SDL_GL_BLUE_SIZE, 8);
     SDL_GL_SetAttribute(SDL_GL_ALPHA_SIZE, 0);
-    SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 0);
+    SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, depth_buffer ? 24 : 0);
     SDL_GL_SetAttribute(SDL_GL_STENCIL_SIZE, 0);
     SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, SDL_TRUE);
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, RENDER_GL_MAJOR_VERSION);
@@ -49,8 +70,7 @@ static void init_window(void)
 
     window = SDL_CreateWindow(GAME_TITLE,
                               SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
-                              DEFAULT_WINDOW_WIDTH, DEFAULT_WINDOW_HEIGHT,
-                              SDL_WINDOW_ALLOW_HIGHDPI | SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE | SDL_WINDOW_SHOWN);
+                              size.x, size.y, flags);
 
     if (!window) {
         FATAL("Can't create game window: %s", SDL_GetError());
@@ -68,6 +88,12 @@ static void init_gl_context(void)
         FATAL("Can't create OpenGL context: %s", SDL_GetError());
     }
 
+    /* Headless frames are never presented, and benchmarks shouldn't wait for the display. */
+    if (headless || !throttle) {
+        SDL_GL_SetSwapInterval(0);
+        return;
+    }
+
     /* Try to enable vsync, but don't treat it as a hard error if we can't. */
     if (!SDL_GL_SetSwapInterval(-1)) {
         LOG_DEBUG("Enabled adaptive vsync");
@@ -80,14 +106,62 @@ static void init_gl_context(void)
     }
 }
 
+void video_set_headless(struct vec2i size)
+{
+    ASSERT(!window);
+    ASSERT(size.x > 0 && size.y > 0);
+    headless = true;
+    headless_size = size;
+}
+
+void video_disable_throttling(void)
+{
+    ASSERT(!window);
+    throttle = false;
+}
+
+bool video_is_headless(void)
+{
+    return headless;
+}
+
+void video_request_depth_buffer(void)
+{
+    ASSERT(!window);
+    depth_buffer = true;
+}
+
+/*
+ * Try not to render zillions of frames per second. This would be a huge waste
+ * of system resources in such a simple game.
+ */
+static void init_pacing(void)
+{
+    if (headless || !throttle) {
+        pacing_init(0);
+    } else if (fps_limit >= 0) {
+        pacing_init(fps_limit);
+    } else {
+        pacing_init(vsync_enabled ? 0 : DEFAULT_FPS_LIMIT);
+    }
+}
+
+void video_set_fps_limit(int fps)
+{
+    ASSERT(!window);
+    fps_limit = fps;
+}
+
 void video_init(void)
 {
     init_window();
     init_gl_context();
+    init_pacing();
 }
 
 void video_fini(void)
 {
+    pacing_fini();
     if (gl_context) {
         SDL_GL_DeleteContext(gl_context);
         gl_context = NULL;
@@ -96,6 +170,10 @@ void video_fini(void)
         SDL_DestroyWindow(window);
         window = NULL;
     }
+    if (video_subsystem_initialized) {
+        SDL_VideoQuit();
+        video_subsystem_initialized = false;
+    }
     vsync_enabled = false;
 }
 
@@ -103,6 +181,9 @@ struct vec2i video_get_surface_size(void)
 {
     struct vec2i size = {0, 0};
 
+    if (headless) {
+        return headless_size;
+    }
     if (window) {
         SDL_GetWindowSize(window, &size.x, &size.y);
     }
@@ -111,17 +192,26 @@ struct vec2i video_get_surface_size(void)
 
 void video_swap_buffers(void)
 {
-    if (!window) {
+    if (!window || headless) {
         return;
     }
     SDL_GL_SwapWindow(window);
+    pacing_wait();
+}
 
-    /*
-     * Try not to render zillions of frames per second. This would be a huge
-     * waste of system resources in such a simple game.
-     */
-    if (!vsync_enabled) {
-        SDL_Delay(1);
+void video_make_gl_context_current(void)
+{
+    DASSERT(window && gl_context);
+    if (SDL_GL_MakeCurrent(window, gl_context)) {
+        FATAL("Can't make OpenGL context current: %s", SDL_GetError());
+    }
+}
+
+void video_release_gl_context(void)
+{
+    DASSERT(window);
+    if (SDL_GL_MakeCurrent(window, NULL)) {
+        FATAL("Can't release OpenGL context: %s", SDL_GetError());
     }
 }
 
@@ -19,11 +19,48 @@
 
 #include "types.h"
 
+/*
+ * Selects headless mode, which must be done before video_init. The GL context
+ * is created for a hidden window, preferably using SDL's offscreen driver so
+ * that no display is needed, and the surface size is fixed.
+ */
+void video_set_headless(struct vec2i size);
+bool video_is_headless(void);
+
+/*
+ * Disables vsync and the delay between frames, so that the game runs as fast
+ * as it can. Must be called before video_init. Used for benchmarks.
+ */
+void video_disable_throttling(void);
+
+/*
+ * Limits the frame rate, or disables the limit if fps is 0. By default, the
+ * frame rate is only limited if vsync is unavailable. Must be called before
+ * video_init.
+ */
+void video_set_fps_limit(int fps);
+
+/*
+ * Asks for a depth buffer with the window, which we otherwise go without
+ * because sprites are drawn in painter's order. Must be called before
+ * video_init. The offscreen framebuffer used in headless mode needs its own
+ * depth buffer, which gl_init_offscreen attaches.
+ */
+void video_request_depth_buffer(void);
+
 void video_init(void);
 void video_fini(void);
 struct vec2i video_get_surface_size(void);
 void video_swap_buffers(void);
 
+/*
+ * Makes the GL context current on the calling thread, or releases it from the
+ * calling thread so that another one can make it current. Used to hand the
+ * context over to the render thread.
+ */
+void video_make_gl_context_current(void);
+void video_release_gl_context(void);
+
 void *video_gl_get_proc_address(const char *name);
 
 #endif /* INCLUDED_VIDEO_H */